@@ -0,0 +1,90 @@
+// Copyright (c) 2022 Clemens Elflein. All rights reserved.
+//
+// This work is licensed under a Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//
+// Feel free to use the design in your private/educational projects, but don't try to sell the design or products based on it without getting my consent first.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//
+
+#ifndef SRC_ACTUATIONTRACE_H
+#define SRC_ACTUATIONTRACE_H
+
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+#include "LinkStats.h"
+
+
+/// \brief Monotonic stamps of one cmd_vel on its way to the motors.
+///
+/// The callback stores it, the next control tick takes it when it applies the duty cycles.
+struct ActuationTrace {
+    // Arrival of the message in roscpp, before it waited in the callback queue
+    uint64_t receipt_ns = 0;
+    // Entry of velReceived()
+    uint64_t callback_ns = 0;
+};
+
+/// \brief Latency of the stages from cmd_vel to the serial port.
+///
+/// Same single writer rule as LinkStats, the writing thread is noted for each stage.
+struct ActuationStats {
+    // Written by the ROS spinner thread
+    // cmd_vel received by roscpp until velReceived() was called
+    LatencyHistogram receipt_to_callback;
+    // velReceived() until the control tick applied the duty cycles
+    LatencyHistogram callback_to_applied;
+    // Time spent setting the duty cycles of all ESCs in one tick
+    LatencyHistogram duty_apply;
+    // Commands which were replaced by a newer one before a control tick applied them
+    Counter superseded;
+
+    // Written by the serial thread
+    // Duty cycles applied until the LL frames of the same tick were written to the serial port
+    LatencyHistogram applied_to_written;
+    // cmd_vel received by roscpp until the LL frames of the tick which applied it were written
+    LatencyHistogram receipt_to_written;
+
+    struct Stage {
+        const char *name;
+        const LatencyHistogram *histogram;
+    };
+
+    static constexpr size_t STAGES = 5;
+
+    /// \brief All stages in the order a command passes them, receipt_to_written spans the whole chain.
+    void stages(Stage (&result)[STAGES]) const {
+        result[0] = {"receipt_to_callback", &receipt_to_callback};
+        result[1] = {"callback_to_applied", &callback_to_applied};
+        result[2] = {"duty_apply", &duty_apply};
+        result[3] = {"applied_to_written", &applied_to_written};
+        result[4] = {"receipt_to_written", &receipt_to_written};
+    }
+};
+
+/// \brief One line with count, p50, p99 and max of a histogram, followed by the non-empty buckets.
+inline std::string describeHistogram(const char *name, const LatencyHistogram::Snapshot &snapshot) {
+    std::ostringstream line;
+    line << name << ": n=" << snapshot.total()
+         << " p50=" << snapshot.percentileMs(0.5) << "ms"
+         << " p99=" << snapshot.percentileMs(0.99) << "ms"
+         << " max=" << snapshot.percentileMs(1.0) << "ms";
+    for (size_t i = 0; i < LatencyHistogram::BUCKETS; i++) {
+        if (snapshot.counts[i] != 0) {
+            line << " <" << (1ULL << i) / 1000.0 << "ms:" << snapshot.counts[i];
+        }
+    }
+    return line.str();
+}
+
+
+#endif //SRC_ACTUATIONTRACE_H
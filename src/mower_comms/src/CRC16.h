@@ -0,0 +1,90 @@
+// Copyright (c) 2022 Clemens Elflein. All rights reserved.
+//
+// This work is licensed under a Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//
+// Feel free to use the design in your private/educational projects, but don't try to sell the design or products based on it without getting my consent first.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//
+
+#ifndef SRC_CRC16_H
+#define SRC_CRC16_H
+
+#include <cstddef>
+#include <cstdint>
+
+
+/// \brief Stateless CRC-16-CCITT as used on the low level link.
+///
+/// Polynomial 0x1021, initial value 0xFFFF, no reflection and no final XOR.
+/// This is the same checksum as boost::crc_ccitt_type (CRC-16/CCITT-FALSE).
+///
+/// The lookup tables are generated at compile time. Blocks of 8 bytes are processed
+/// with slice-by-8 (eight table lookups, no dependency between them), the rest byte by byte.
+namespace crc16 {
+    namespace detail {
+        constexpr uint16_t POLYNOMIAL = 0x1021;
+
+        struct Tables {
+            // table[k][b] is the CRC contribution of byte b followed by k zero bytes.
+            uint16_t table[8][256];
+        };
+
+        constexpr Tables makeTables() {
+            Tables t{};
+            for (int b = 0; b < 256; b++) {
+                uint16_t crc = b << 8;
+                for (int bit = 0; bit < 8; bit++) {
+                    crc = (crc & 0x8000) ? (crc << 1) ^ POLYNOMIAL : (crc << 1);
+                }
+                t.table[0][b] = crc;
+            }
+            for (int k = 1; k < 8; k++) {
+                for (int b = 0; b < 256; b++) {
+                    uint16_t prev = t.table[k - 1][b];
+                    t.table[k][b] = (prev << 8) ^ t.table[0][prev >> 8];
+                }
+            }
+            return t;
+        }
+
+        constexpr Tables TABLES = makeTables();
+    }
+
+    /// \brief Continue a CRC over more data.
+    /// \param crc The CRC of the data before (0xFFFF to start a new one).
+    /// \param data The data to process.
+    /// \param size The number of bytes in \p data.
+    /// \returns The updated CRC.
+    inline uint16_t update(uint16_t crc, const void *data, size_t size) {
+        const auto *bytes = static_cast<const uint8_t *>(data);
+        const auto &t = detail::TABLES.table;
+
+        while (size >= 8) {
+            crc = t[7][bytes[0] ^ (crc >> 8)] ^ t[6][bytes[1] ^ (crc & 0xFF)] ^
+                  t[5][bytes[2]] ^ t[4][bytes[3]] ^ t[3][bytes[4]] ^ t[2][bytes[5]] ^
+                  t[1][bytes[6]] ^ t[0][bytes[7]];
+            bytes += 8;
+            size -= 8;
+        }
+        while (size--) {
+            crc = (crc << 8) ^ t[0][(crc >> 8) ^ *bytes++];
+        }
+        return crc;
+    }
+
+    /// \brief Calculate the CRC of a buffer.
+    inline uint16_t checksum(const void *data, size_t size) {
+        return update(0xFFFF, data, size);
+    }
+}
+
+
+#endif //SRC_CRC16_H
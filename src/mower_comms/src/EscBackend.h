@@ -0,0 +1,165 @@
+// Copyright (c) 2022 Clemens Elflein. All rights reserved.
+//
+// This work is licensed under a Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//
+// Feel free to use the design in your private/educational projects, but don't try to sell the design or products based on it without getting my consent first.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//
+
+#ifndef SRC_ESCBACKEND_H
+#define SRC_ESCBACKEND_H
+
+#include <cmath>
+#include <cstdint>
+#include <mutex>
+
+#include <ros/ros.h>
+#include <xesc_driver/xesc_driver.h>
+#include <xesc_msgs/XescStateStamped.h>
+
+
+/// \brief The ESC values mower_comms uses. Small enough to share a cache line with the SeqLock sequence.
+struct EscSnapshot {
+    // ROS time of the ESC state [ns]
+    uint64_t stamp_ns;
+    int32_t tacho;
+    uint32_t tacho_absolute;
+    uint32_t fault_code;
+    float duty_cycle;
+    float current_input;
+    float temperature_motor;
+    float temperature_pcb;
+    uint8_t connection_state;
+    bool direction;
+};
+
+inline EscSnapshot makeEscSnapshot(const xesc_msgs::XescStateStamped &state) {
+    EscSnapshot snapshot = {};
+    snapshot.stamp_ns = state.header.stamp.toNSec();
+    snapshot.tacho = static_cast<int32_t>(state.state.tacho);
+    snapshot.tacho_absolute = state.state.tacho_absolute;
+    snapshot.fault_code = state.state.fault_code;
+    snapshot.duty_cycle = state.state.duty_cycle;
+    snapshot.current_input = state.state.current_input;
+    snapshot.temperature_motor = state.state.temperature_motor;
+    snapshot.temperature_pcb = state.state.temperature_pcb;
+    snapshot.connection_state = state.state.connection_state;
+    snapshot.direction = state.state.direction;
+    return snapshot;
+}
+
+/// \brief The motor controller interface used by mower_comms.
+class EscBackend {
+public:
+    virtual ~EscBackend() = default;
+
+    virtual void getStatus(xesc_msgs::XescStateStamped &state) = 0;
+
+    virtual void setDutyCycle(float duty_cycle) = 0;
+
+    virtual void stop() = 0;
+};
+
+/// \brief The real xESC / VESC, see xesc_driver.
+class XescBackend : public EscBackend {
+public:
+    XescBackend(ros::NodeHandle &n, ros::NodeHandle &param_nh) : driver_(n, param_nh) {
+    }
+
+    void getStatus(xesc_msgs::XescStateStamped &state) override {
+        driver_.getStatus(state);
+    }
+
+    void setDutyCycle(float duty_cycle) override {
+        driver_.setDutyCycle(duty_cycle);
+    }
+
+    void stop() override {
+        driver_.stop();
+    }
+
+private:
+    xesc_driver::XescDriver driver_;
+};
+
+/// \brief Simulated ESC for running mower_comms without hardware.
+///
+/// The motor speed follows the duty cycle with a first order lag and is integrated into the tacho.
+/// Like a real ESC, the state is only refreshed at a fixed rate.
+class MockEscBackend : public EscBackend {
+public:
+    /// \param ticks_per_second Tacho ticks per second at full duty cycle.
+    explicit MockEscBackend(double ticks_per_second) : ticks_per_second_(ticks_per_second) {
+        state_.state.connection_state = xesc_msgs::XescState::XESC_CONNECTION_STATE_CONNECTED;
+        state_.state.temperature_motor = 25.0;
+        state_.state.temperature_pcb = 25.0;
+    }
+
+    void getStatus(xesc_msgs::XescStateStamped &state) override {
+        std::unique_lock<std::mutex> lk(mutex_);
+        simulate(ros::Time::now());
+        state = state_;
+    }
+
+    void setDutyCycle(float duty_cycle) override {
+        std::unique_lock<std::mutex> lk(mutex_);
+        simulate(ros::Time::now());
+        duty_cycle_ = std::fmax(-1.0, std::fmin(1.0, duty_cycle));
+    }
+
+    void stop() override {
+        setDutyCycle(0.0);
+    }
+
+private:
+    // State update rate of the simulated ESC
+    static constexpr double UPDATE_PERIOD_S = 0.01;
+    // Time constant of the motor
+    static constexpr double TIME_CONSTANT_S = 0.1;
+
+    void simulate(const ros::Time &now) {
+        if (last_update_.isZero()) {
+            last_update_ = now;
+            state_.header.stamp = now;
+            return;
+        }
+        double dt = (now - last_update_).toSec();
+        if (dt < UPDATE_PERIOD_S) {
+            return;
+        }
+        last_update_ = now;
+
+        speed_ += (duty_cycle_ * ticks_per_second_ - speed_) * std::fmin(1.0, dt / TIME_CONSTANT_S);
+        tacho_ += speed_ * dt;
+        tacho_absolute_ += std::fabs(speed_ * dt);
+
+        state_.header.stamp = now;
+        state_.header.seq++;
+        state_.state.duty_cycle = duty_cycle_;
+        state_.state.direction = speed_ < 0.0;
+        state_.state.tacho = static_cast<int32_t>(std::lround(tacho_));
+        state_.state.tacho_absolute = static_cast<uint32_t>(tacho_absolute_);
+        state_.state.rpm = speed_ * 60.0;
+        state_.state.current_input = std::fabs(duty_cycle_) * 2.0;
+    }
+
+    double ticks_per_second_;
+    std::mutex mutex_;
+    xesc_msgs::XescStateStamped state_;
+    ros::Time last_update_;
+    double duty_cycle_ = 0.0;
+    double speed_ = 0.0;
+    double tacho_ = 0.0;
+    double tacho_absolute_ = 0.0;
+};
+
+
+#endif //SRC_ESCBACKEND_H
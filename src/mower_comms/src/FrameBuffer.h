@@ -0,0 +1,121 @@
+// Copyright (c) 2022 Clemens Elflein. All rights reserved.
+//
+// This work is licensed under a Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//
+// Feel free to use the design in your private/educational projects, but don't try to sell the design or products based on it without getting my consent first.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//
+
+#ifndef SRC_FRAMEBUFFER_H
+#define SRC_FRAMEBUFFER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+
+/// \brief Fixed size receive buffer which splits a byte stream into 0x00 delimited COBS frames.
+///
+/// Bytes are read from the port directly into the free space at the end of the buffer
+/// (writePtr() / writeSpace() / commit()). nextFrame() then searches the new bytes for
+/// delimiters using memchr and returns complete frames as pointers into the buffer, so
+/// nothing is copied before the COBS decoder.
+///
+/// Consumed frames are never moved. Only when the end of the buffer is reached, the
+/// (at most one) incomplete frame at the tail is moved back to the front.
+/// If a single frame does not fit into the buffer at all, only this frame is dropped
+/// and the buffer resynchronizes on the next delimiter.
+///
+/// \warning Pointers returned by nextFrame() are only valid until the next call to writePtr().
+template<size_t Capacity>
+class FrameBuffer {
+public:
+    /// \brief Get the pointer to read new bytes into. Makes room in the buffer, if needed.
+    uint8_t *writePtr() {
+        if (head_ == tail_) {
+            // Everything consumed, start over at the front.
+            head_ = scan_ = tail_ = 0;
+        } else if (tail_ == Capacity) {
+            if (head_ > 0) {
+                // Move the incomplete frame to the front.
+                size_t pending = tail_ - head_;
+                memmove(buffer_, buffer_ + head_, pending);
+                scan_ -= head_;
+                head_ = 0;
+                tail_ = pending;
+            } else {
+                // A single frame filled the whole buffer. Drop it and skip everything up to the next delimiter.
+                head_ = scan_ = tail_ = 0;
+                if (!discarding_) {
+                    discarding_ = true;
+                    overflows_++;
+                }
+            }
+        }
+        return buffer_ + tail_;
+    }
+
+    /// \brief Number of bytes which can be written to writePtr().
+    size_t writeSpace() const {
+        return Capacity - tail_;
+    }
+
+    /// \brief Mark bytes written to writePtr() as valid.
+    void commit(size_t size) {
+        tail_ += size;
+    }
+
+    /// \brief Get the next complete frame (without the delimiter).
+    /// \param frame Set to the start of the encoded frame inside the buffer.
+    /// \param size Set to the number of encoded bytes.
+    /// \returns true, if a frame was found.
+    bool nextFrame(const uint8_t *&frame, size_t &size) {
+        while (scan_ < tail_) {
+            auto *delimiter = static_cast<uint8_t *>(memchr(buffer_ + scan_, 0, tail_ - scan_));
+            if (!delimiter) {
+                scan_ = tail_;
+                return false;
+            }
+
+            size_t end = delimiter - buffer_;
+            frame = buffer_ + head_;
+            size = end - head_;
+            head_ = scan_ = end + 1;
+
+            if (discarding_) {
+                // This is the rest of an oversized frame, throw it away.
+                discarding_ = false;
+                continue;
+            }
+            return true;
+        }
+        return false;
+    }
+
+    /// \brief Number of times a frame was dropped, because it didn't fit into the buffer.
+    size_t getOverflowCount() const {
+        return overflows_;
+    }
+
+private:
+    uint8_t buffer_[Capacity];
+    // Start of the first unconsumed byte
+    size_t head_ = 0;
+    // Everything before this index was already searched for delimiters
+    size_t scan_ = 0;
+    // End of valid data
+    size_t tail_ = 0;
+    bool discarding_ = false;
+    size_t overflows_ = 0;
+};
+
+
+#endif //SRC_FRAMEBUFFER_H
@@ -0,0 +1,173 @@
+// Copyright (c) 2022 Clemens Elflein. All rights reserved.
+//
+// This work is licensed under a Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//
+// Feel free to use the design in your private/educational projects, but don't try to sell the design or products based on it without getting my consent first.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//
+
+#ifndef SRC_GYROBIASESTIMATOR_H
+#define SRC_GYROBIASESTIMATOR_H
+
+#include <cmath>
+#include <cstdint>
+
+
+/// \brief Estimates the gyro bias whenever the mower stands still.
+///
+/// The samples are collected in blocks. A block counts as stationary, if the accelerometer and the gyro
+/// are quiet, the mean rate is close to the current bias and the caller says no motion was commanded.
+/// The mean rate of a stationary block is then fed into a Kalman filter per axis, which models the bias as
+/// a random walk. So the uncertainty grows while the mower is moving and the bias can follow temperature drift.
+class GyroBiasEstimator {
+public:
+    struct Config {
+        // Duration of a block [s]
+        double block_s = 0.25;
+        // Limits for a stationary block
+        double max_accel_std = 0.05;
+        double max_gyro_std = 0.02;
+        // Largest accepted difference between the mean rate and the bias [rad/s]
+        double max_gyro_offset = 0.1;
+        // Bias random walk [(rad/s)^2 / s]
+        double bias_drift = 1e-8;
+        // The estimate is converged below this standard deviation [rad/s] and after this many stationary blocks
+        double converged_std = 1e-3;
+        uint64_t min_stationary_blocks = 8;
+    };
+
+    struct Estimate {
+        double bias[3] = {0.0, 0.0, 0.0};
+        // Standard deviation of the bias, the worst axis [rad/s]
+        double stddev = 0.0;
+        bool converged = false;
+        // Time of the last stationary block, 0 if there was none [s]
+        double last_stationary_s = 0.0;
+        uint64_t stationary_blocks = 0;
+        uint64_t blocks = 0;
+    };
+
+    GyroBiasEstimator() {
+        setConfig(Config());
+    }
+
+    void setConfig(const Config &config) {
+        config_ = config;
+        for (double &variance: variance_) {
+            // Start with the accepted offset as the uncertainty
+            variance = config_.max_gyro_offset * config_.max_gyro_offset;
+        }
+        updateEstimate();
+    }
+
+    /// \brief Add a sample.
+    /// \param stamp_s Sample time [s].
+    /// \param moving True, if the mower was told to move (or just stopped).
+    /// \returns true, if a block was finished with this sample.
+    bool update(double stamp_s, const double acceleration[3], const double gyro[3], bool moving) {
+        if (block_samples_ == 0) {
+            block_start_s_ = stamp_s;
+        }
+        block_moving_ |= moving;
+        double accel_norm = std::sqrt(acceleration[0] * acceleration[0] + acceleration[1] * acceleration[1] +
+                                      acceleration[2] * acceleration[2]);
+        accel_sum_ += accel_norm;
+        accel_sq_sum_ += accel_norm * accel_norm;
+        for (int i = 0; i < 3; i++) {
+            gyro_sum_[i] += gyro[i];
+            gyro_sq_sum_[i] += gyro[i] * gyro[i];
+        }
+        block_samples_++;
+
+        if (stamp_s - block_start_s_ < config_.block_s || block_samples_ < 2) {
+            return false;
+        }
+        finishBlock(stamp_s);
+        return true;
+    }
+
+    /// \brief Remove the bias from a rate.
+    void correct(double gyro[3]) const {
+        for (int i = 0; i < 3; i++) {
+            gyro[i] -= estimate_.bias[i];
+        }
+    }
+
+    const Estimate &getEstimate() const {
+        return estimate_;
+    }
+
+private:
+    void finishBlock(double stamp_s) {
+        double n = block_samples_;
+        double accel_mean = accel_sum_ / n;
+        double accel_var = std::fmax(0.0, accel_sq_sum_ / n - accel_mean * accel_mean);
+        bool stationary = !block_moving_ && accel_var < config_.max_accel_std * config_.max_accel_std;
+
+        double mean[3], measurement_var[3];
+        for (int i = 0; i < 3; i++) {
+            mean[i] = gyro_sum_[i] / n;
+            double var = std::fmax(0.0, gyro_sq_sum_[i] / n - mean[i] * mean[i]);
+            // Variance of the block mean, with a floor for the sensor quantization
+            measurement_var[i] = var / n + 1e-10;
+            stationary &= var < config_.max_gyro_std * config_.max_gyro_std &&
+                          std::fabs(mean[i] - estimate_.bias[i]) < config_.max_gyro_offset;
+        }
+
+        // The bias drifts, no matter if we see it or not
+        double dt = last_block_s_ > 0.0 ? std::fmax(0.0, stamp_s - last_block_s_) : 0.0;
+        for (double &variance: variance_) {
+            variance += config_.bias_drift * dt;
+        }
+        last_block_s_ = stamp_s;
+
+        if (stationary) {
+            for (int i = 0; i < 3; i++) {
+                double gain = variance_[i] / (variance_[i] + measurement_var[i]);
+                estimate_.bias[i] += gain * (mean[i] - estimate_.bias[i]);
+                variance_[i] *= 1.0 - gain;
+            }
+            estimate_.last_stationary_s = stamp_s;
+            estimate_.stationary_blocks++;
+        }
+        estimate_.blocks++;
+        updateEstimate();
+
+        block_samples_ = 0;
+        block_moving_ = false;
+        accel_sum_ = accel_sq_sum_ = 0.0;
+        for (int i = 0; i < 3; i++) {
+            gyro_sum_[i] = gyro_sq_sum_[i] = 0.0;
+        }
+    }
+
+    void updateEstimate() {
+        double max_variance = std::fmax(variance_[0], std::fmax(variance_[1], variance_[2]));
+        estimate_.stddev = std::sqrt(max_variance);
+        estimate_.converged = estimate_.stationary_blocks >= config_.min_stationary_blocks &&
+                              estimate_.stddev < config_.converged_std;
+    }
+
+    Config config_;
+    Estimate estimate_;
+    double variance_[3] = {0.0, 0.0, 0.0};
+    double last_block_s_ = 0.0;
+
+    // Current block
+    double block_start_s_ = 0.0;
+    uint64_t block_samples_ = 0;
+    bool block_moving_ = false;
+    double accel_sum_ = 0.0, accel_sq_sum_ = 0.0;
+    double gyro_sum_[3] = {0.0, 0.0, 0.0}, gyro_sq_sum_[3] = {0.0, 0.0, 0.0};
+};
+
+
+#endif //SRC_GYROBIASESTIMATOR_H
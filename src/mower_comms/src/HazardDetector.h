@@ -0,0 +1,155 @@
+// Copyright (c) 2022 Clemens Elflein. All rights reserved.
+//
+// This work is licensed under a Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//
+// Feel free to use the design in your private/educational projects, but don't try to sell the design or products based on it without getting my consent first.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//
+
+#ifndef SRC_HAZARDDETECTOR_H
+#define SRC_HAZARDDETECTOR_H
+
+#include <cmath>
+#include <cstdint>
+
+
+/// \brief Detects tipping and lifting from the accelerometer, sample by sample.
+///
+/// Tilt is the angle between the (low pass filtered) gravity vector and the IMU z axis. Lifting or hitting
+/// something shows up as jerk, the change of the acceleration over time. Differentiating single samples would
+/// mostly amplify the vibration, so the jerk is the difference of a fast and a slow low pass divided by the
+/// difference of their time constants. For a constant jerk, this is exact after a few time constants.
+/// Each check triggers after a few consecutive samples over its threshold and re-arms only after it dropped
+/// below a lower one.
+class HazardDetector {
+public:
+    enum Hazard : uint8_t {
+        NONE = 0,
+        TILT = 1,
+        JERK = 2
+    };
+
+    struct Config {
+        // Time constants of the fast (also used for the tilt) and the slow acceleration low pass [s]
+        double filter_s = 0.01;
+        double slow_filter_s = 0.03;
+        // Tilt angle which triggers and the one which re-arms [deg]
+        double tilt_trigger_deg = 35.0;
+        double tilt_release_deg = 25.0;
+        // Jerk which triggers and the one which re-arms [m/s^3]
+        double jerk_trigger = 80.0;
+        double jerk_release = 40.0;
+        // Consecutive samples over the threshold before triggering
+        int confirm_samples = 2;
+    };
+
+    struct Stats {
+        // Current tilt and the maximums since the start
+        double tilt_deg = 0.0;
+        double max_tilt_deg = 0.0;
+        double max_jerk = 0.0;
+        uint64_t tilt_triggers = 0;
+        uint64_t jerk_triggers = 0;
+    };
+
+    void setConfig(const Config &config) {
+        config_ = config;
+    }
+
+    /// \brief Check a sample.
+    /// \param stamp_s Sample time [s].
+    /// \param acceleration Measured acceleration [m/s^2], gravity points to +z when level.
+    /// \returns The hazard, if one was triggered by this sample. Only reported once until it re-arms.
+    Hazard update(double stamp_s, const double acceleration[3]) {
+        if (!initialized_ || stamp_s <= last_stamp_s_ || stamp_s - last_stamp_s_ > 1.0) {
+            // First sample or a gap, start over without a jerk
+            for (int i = 0; i < 3; i++) {
+                filtered_[i] = slow_[i] = acceleration[i];
+            }
+            initialized_ = true;
+            last_stamp_s_ = stamp_s;
+            return NONE;
+        }
+        double dt = stamp_s - last_stamp_s_;
+        last_stamp_s_ = stamp_s;
+
+        double alpha = dt / (dt + config_.filter_s);
+        double slow_alpha = dt / (dt + config_.slow_filter_s);
+        double jerk_sq = 0.0;
+        for (int i = 0; i < 3; i++) {
+            filtered_[i] += alpha * (acceleration[i] - filtered_[i]);
+            slow_[i] += slow_alpha * (acceleration[i] - slow_[i]);
+            double jerk = (filtered_[i] - slow_[i]) / (config_.slow_filter_s - config_.filter_s);
+            jerk_sq += jerk * jerk;
+        }
+        double jerk = std::sqrt(jerk_sq);
+        double norm = std::sqrt(filtered_[0] * filtered_[0] + filtered_[1] * filtered_[1] +
+                                filtered_[2] * filtered_[2]);
+        double tilt_deg = norm > 0.0 ? std::acos(std::fmax(-1.0, std::fmin(1.0, filtered_[2] / norm))) * 180.0 / M_PI
+                                     : 0.0;
+
+        stats_.tilt_deg = tilt_deg;
+        stats_.max_tilt_deg = std::fmax(stats_.max_tilt_deg, tilt_deg);
+        stats_.max_jerk = std::fmax(stats_.max_jerk, jerk);
+
+        Hazard result = NONE;
+        if (tilt_.update(tilt_deg, config_.tilt_trigger_deg, config_.tilt_release_deg, config_.confirm_samples)) {
+            stats_.tilt_triggers++;
+            result = TILT;
+        }
+        if (jerk_.update(jerk, config_.jerk_trigger, config_.jerk_release, config_.confirm_samples)) {
+            stats_.jerk_triggers++;
+            if (result == NONE) {
+                result = JERK;
+            }
+        }
+        return result;
+    }
+
+    const Stats &getStats() const {
+        return stats_;
+    }
+
+private:
+    // A threshold with hysteresis and a confirmation count
+    struct Trigger {
+        int count = 0;
+        bool triggered = false;
+
+        bool update(double value, double trigger, double release, int confirm) {
+            if (triggered) {
+                if (value < release) {
+                    triggered = false;
+                    count = 0;
+                }
+                return false;
+            }
+            count = value > trigger ? count + 1 : 0;
+            if (count >= confirm) {
+                triggered = true;
+                return true;
+            }
+            return false;
+        }
+    };
+
+    Config config_;
+    Stats stats_;
+    Trigger tilt_, jerk_;
+
+    bool initialized_ = false;
+    double last_stamp_s_ = 0.0;
+    double filtered_[3] = {0.0, 0.0, 0.0};
+    double slow_[3] = {0.0, 0.0, 0.0};
+};
+
+
+#endif //SRC_HAZARDDETECTOR_H
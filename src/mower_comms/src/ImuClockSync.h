@@ -0,0 +1,188 @@
+// Copyright (c) 2022 Clemens Elflein. All rights reserved.
+//
+// This work is licensed under a Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//
+// Feel free to use the design in your private/educational projects, but don't try to sell the design or products based on it without getting my consent first.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//
+
+#ifndef SRC_IMUCLOCKSYNC_H
+#define SRC_IMUCLOCKSYNC_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+
+/// \brief Reconstructs sensor timestamps for the LL IMU samples.
+///
+/// The LL board only sends the time since the last sample (dt_millis). Summing those up gives
+/// a LL clock, which we map to the host's monotonic clock with an exponentially weighted linear
+/// fit (offset + skew) against the receive times. Since the receive time is always late by the
+/// serial delay, the stamp is placed at the lower envelope of the residuals, not at the mean.
+///
+/// If a sample arrives more than half a sample period later than the fit predicts from its dt,
+/// the samples in between were dropped on the link and the LL clock is advanced accordingly.
+class ImuClockSync {
+public:
+    struct Stats {
+        // Host time of LL time zero, relative to the first sample's receive time [s]
+        double offset_s = 0.0;
+        // Average time between sampling and receiving, i.e. what was removed from the receive time [ms]
+        double delay_ms = 0.0;
+        // Clock rate difference of LL vs host [ppm]
+        double skew_ppm = 0.0;
+        // Standard deviation of the receive time around the fit [ms]
+        double jitter_ms = 0.0;
+        // Nominal sample period [ms]
+        double period_ms = 0.0;
+        uint64_t samples = 0;
+        uint64_t dropped = 0;
+        uint64_t resets = 0;
+        bool synced = false;
+    };
+
+    /// \param forgetting Weight of old samples per update, 0.999 remembers roughly the last 1000 samples.
+    explicit ImuClockSync(double forgetting = 0.999) : forgetting_(forgetting) {
+    }
+
+    /// \brief Add a sample and get its reconstructed time.
+    /// \param dt_millis The dt_millis of the LL IMU packet.
+    /// \param rx_ns Host monotonic receive time.
+    /// \returns The estimated host monotonic time at which the sample was taken.
+    uint64_t update(uint16_t dt_millis, uint64_t rx_ns) {
+        return update(dt_millis * 1e-3, rx_ns);
+    }
+
+    /// \brief Same as above, for LL clocks with a finer resolution.
+    /// \param dt_s LL time since the last sample [s].
+    uint64_t update(double dt_s, uint64_t rx_ns) {
+        bool corrected = false;
+        double dt_ms = dt_s * 1e3;
+        double period_s = stats_.period_ms * 1e-3;
+        // How late this sample is, if nothing was dropped. Before we are synced, all we have is the gap to the last one.
+        double late_s = stats_.synced ? relativeTime(rx_ns) - predict(ll_time_s_ + dt_s)
+                                      : relativeTime(rx_ns) - relativeTime(last_rx_ns_) - dt_s;
+
+        if (stats_.samples == 0) {
+            reset(rx_ns);
+        } else if (std::fabs(late_s) > MAX_RESIDUAL_S) {
+            // LL board rebooted or the link was down for a long time, start over.
+            stats_.resets++;
+            stats_.samples = 0;
+            reset(rx_ns);
+        } else {
+            if (period_s > 0.0 && late_s > 0.5 * period_s) {
+                uint64_t missing = static_cast<uint64_t>(std::round(late_s / period_s));
+                stats_.dropped += missing;
+                dt_s += missing * period_s;
+                corrected = true;
+            } else if (stats_.synced && period_s > 0.0 && late_s < -0.5 * period_s) {
+                // Early by whole periods: the last sample was delayed, not preceded by drops. Take back the
+                // extra periods, so a single delay spike doesn't shift the LL clock for good.
+                uint64_t extra = static_cast<uint64_t>(std::round(-late_s / period_s));
+                stats_.dropped -= std::min(extra, stats_.dropped);
+                dt_s = std::max(0.0, dt_s - extra * period_s);
+                corrected = true;
+            }
+            ll_time_s_ += dt_s;
+            stats_.period_ms = stats_.period_ms > 0.0 ? 0.99 * stats_.period_ms + 0.01 * dt_ms : dt_ms;
+        }
+        last_rx_ns_ = rx_ns;
+        stats_.samples++;
+
+        double x = ll_time_s_;
+        double y = relativeTime(rx_ns);
+
+        if (corrected && stats_.synced) {
+            // Either dropped samples or a delay spike. Both make this sample a bad fit point, so just stamp it.
+            return base_rx_ns_ + static_cast<int64_t>(predict(x) * 1e9);
+        }
+
+        // Exponentially weighted least squares for y = offset + skew * x. Kept as weighted means
+        // and centered sums, so it stays accurate when x gets large.
+        weight_ = forgetting_ * weight_ + 1.0;
+        double dx = x - mean_x_;
+        mean_x_ += dx / weight_;
+        mean_y_ += (y - mean_y_) / weight_;
+        sxx_ = forgetting_ * sxx_ + dx * (x - mean_x_);
+        sxy_ = forgetting_ * sxy_ + dx * (y - mean_y_);
+
+        if (stats_.samples < MIN_SAMPLES || sxx_ <= 0.0) {
+            return rx_ns;
+        }
+        skew_ = sxy_ / sxx_;
+        double fit = mean_y_ + skew_ * (x - mean_x_);
+        double residual = y - fit;
+
+        // Lower envelope of the residuals: follows new minimums immediately, drifts up slowly.
+        lower_envelope_ = stats_.synced ? std::fmin(lower_envelope_ + ENVELOPE_DRIFT_S, residual) : residual;
+        residual_var_ = stats_.synced ? 0.99 * residual_var_ + 0.01 * residual * residual : residual * residual;
+        double delay_ms = (residual - lower_envelope_) * 1e3;
+
+        stats_.delay_ms = stats_.synced ? 0.99 * stats_.delay_ms + 0.01 * delay_ms : delay_ms;
+        stats_.synced = true;
+        stats_.offset_s = predict(0.0);
+        stats_.skew_ppm = (skew_ - 1.0) * 1e6;
+        stats_.jitter_ms = std::sqrt(residual_var_) * 1e3;
+
+        return base_rx_ns_ + static_cast<int64_t>(predict(x) * 1e9);
+    }
+
+    const Stats &getStats() const {
+        return stats_;
+    }
+
+private:
+    // Don't trust the fit before we have this many samples
+    static constexpr uint64_t MIN_SAMPLES = 20;
+    // Start over, if a sample is this far off the fit
+    static constexpr double MAX_RESIDUAL_S = 0.5;
+    // Upward drift of the lower envelope per sample
+    static constexpr double ENVELOPE_DRIFT_S = 1e-6;
+
+    // Seconds since base_rx_ns_
+    double relativeTime(uint64_t ns) const {
+        return (static_cast<int64_t>(ns) - static_cast<int64_t>(base_rx_ns_)) * 1e-9;
+    }
+
+    // Host time (relative to base_rx_ns_) at which the sample with the given LL time was taken
+    double predict(double ll_time_s) const {
+        return mean_y_ + skew_ * (ll_time_s - mean_x_) + lower_envelope_;
+    }
+
+    void reset(uint64_t rx_ns) {
+        base_rx_ns_ = rx_ns;
+        last_rx_ns_ = rx_ns;
+        ll_time_s_ = 0.0;
+        weight_ = mean_x_ = mean_y_ = sxx_ = sxy_ = 0.0;
+        skew_ = 1.0;
+        lower_envelope_ = 0.0;
+        residual_var_ = 0.0;
+        stats_.synced = false;
+    }
+
+    double forgetting_;
+    Stats stats_;
+
+    uint64_t base_rx_ns_ = 0;
+    uint64_t last_rx_ns_ = 0;
+    // Sum of all dt_millis (plus dropped samples) since base_rx_ns_
+    double ll_time_s_ = 0.0;
+
+    double weight_ = 0.0, mean_x_ = 0.0, mean_y_ = 0.0, sxx_ = 0.0, sxy_ = 0.0;
+    double skew_ = 1.0;
+    double lower_envelope_ = 0.0;
+    double residual_var_ = 0.0;
+};
+
+
+#endif //SRC_IMUCLOCKSYNC_H
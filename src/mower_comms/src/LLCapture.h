@@ -0,0 +1,220 @@
+// Copyright (c) 2022 Clemens Elflein. All rights reserved.
+//
+// This work is licensed under a Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//
+// Feel free to use the design in your private/educational projects, but don't try to sell the design or products based on it without getting my consent first.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//
+
+#ifndef SRC_LLCAPTURE_H
+#define SRC_LLCAPTURE_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+/// Capture file for the raw byte stream on the low level link.
+///
+/// File layout: LLCaptureHeader, followed by records. Each record is a LLCaptureRecord
+/// followed by `size` raw bytes. A record with time_ns == 0 marks the end of the data
+/// (the file is preallocated in chunks, so after a crash the rest is zero filled).
+namespace ll_capture {
+    constexpr char MAGIC[8] = {'L', 'L', 'C', 'A', 'P', 'T', '0', '1'};
+    constexpr uint32_t VERSION = 1;
+
+    enum Direction : uint8_t {
+        // Bytes received from the low level board
+        RX = 0,
+        // Bytes sent to the low level board
+        TX = 1
+    };
+
+#pragma pack(push, 1)
+    struct FileHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t reserved;
+    } __attribute__((packed));
+
+    struct Record {
+        // Monotonic time when the bytes were read / written
+        uint64_t time_ns;
+        uint8_t direction;
+        uint8_t reserved;
+        uint16_t size;
+    } __attribute__((packed));
+#pragma pack(pop)
+
+    /// \brief Appends records to a memory mapped capture file. Not thread safe, only the serial thread writes.
+    class Writer {
+    public:
+        ~Writer() {
+            close();
+        }
+
+        /// \brief Create (or truncate) the capture file.
+        /// \returns false, if the file could not be created.
+        bool open(const std::string &filename) {
+            close();
+            fd_ = ::open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+            if (fd_ < 0) {
+                return false;
+            }
+            if (!reserve(sizeof(FileHeader))) {
+                close();
+                return false;
+            }
+            FileHeader header = {};
+            memcpy(header.magic, MAGIC, sizeof(MAGIC));
+            header.version = VERSION;
+            memcpy(data_, &header, sizeof(header));
+            size_ = sizeof(header);
+            return true;
+        }
+
+        bool isOpen() const {
+            return fd_ >= 0;
+        }
+
+        /// \brief Append one chunk of bytes.
+        void append(Direction direction, uint64_t time_ns, const uint8_t *bytes, size_t size) {
+            if (fd_ < 0 || size == 0) {
+                return;
+            }
+            while (size > 0) {
+                uint16_t chunk = size > UINT16_MAX ? UINT16_MAX : size;
+                if (!reserve(size_ + sizeof(Record) + chunk)) {
+                    // Out of space, stop capturing but keep what we have.
+                    close();
+                    return;
+                }
+                Record record = {time_ns, direction, 0, chunk};
+                memcpy(data_ + size_, &record, sizeof(record));
+                memcpy(data_ + size_ + sizeof(record), bytes, chunk);
+                size_ += sizeof(record) + chunk;
+                bytes += chunk;
+                size -= chunk;
+            }
+        }
+
+        /// \brief Unmap the file and truncate it to the written size.
+        void close() {
+            if (data_) {
+                munmap(data_, capacity_);
+                data_ = nullptr;
+            }
+            if (fd_ >= 0) {
+                if (ftruncate(fd_, size_) != 0) {
+                    // Nothing we can do, the zero filled rest is skipped by the reader.
+                }
+                ::close(fd_);
+                fd_ = -1;
+            }
+            size_ = capacity_ = 0;
+        }
+
+    private:
+        // The file grows in chunks of this size, so we don't remap on every append.
+        static constexpr size_t CHUNK_SIZE = 16 * 1024 * 1024;
+
+        bool reserve(size_t size) {
+            if (size <= capacity_) {
+                return true;
+            }
+            size_t new_capacity = ((size + CHUNK_SIZE - 1) / CHUNK_SIZE) * CHUNK_SIZE;
+            if (ftruncate(fd_, new_capacity) != 0) {
+                return false;
+            }
+            void *mapped = data_ ? mremap(data_, capacity_, new_capacity, MREMAP_MAYMOVE)
+                                 : mmap(nullptr, new_capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+            if (mapped == MAP_FAILED) {
+                return false;
+            }
+            data_ = static_cast<uint8_t *>(mapped);
+            capacity_ = new_capacity;
+            return true;
+        }
+
+        int fd_ = -1;
+        uint8_t *data_ = nullptr;
+        size_t size_ = 0;
+        size_t capacity_ = 0;
+    };
+
+    /// \brief Reads records from a capture file without copying.
+    class Reader {
+    public:
+        ~Reader() {
+            if (data_) {
+                munmap(const_cast<uint8_t *>(data_), size_);
+            }
+        }
+
+        /// \returns false, if the file can't be read or is not a capture file.
+        bool open(const std::string &filename) {
+            int fd = ::open(filename.c_str(), O_RDONLY);
+            if (fd < 0) {
+                return false;
+            }
+            struct stat st = {};
+            if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(FileHeader))) {
+                ::close(fd);
+                return false;
+            }
+            void *mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if (mapped == MAP_FAILED) {
+                return false;
+            }
+            data_ = static_cast<const uint8_t *>(mapped);
+            size_ = st.st_size;
+
+            FileHeader header;
+            memcpy(&header, data_, sizeof(header));
+            if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION) {
+                return false;
+            }
+            offset_ = sizeof(FileHeader);
+            return true;
+        }
+
+        /// \brief Get the next record.
+        /// \param record The record header.
+        /// \param bytes Points to the record data inside the mapped file.
+        /// \returns false at the end of the capture.
+        bool next(Record &record, const uint8_t *&bytes) {
+            if (offset_ + sizeof(Record) > size_) {
+                return false;
+            }
+            memcpy(&record, data_ + offset_, sizeof(record));
+            if (record.time_ns == 0 || offset_ + sizeof(Record) + record.size > size_) {
+                return false;
+            }
+            bytes = data_ + offset_ + sizeof(Record);
+            offset_ += sizeof(Record) + record.size;
+            return true;
+        }
+
+    private:
+        const uint8_t *data_ = nullptr;
+        size_t size_ = 0;
+        size_t offset_ = 0;
+    };
+}
+
+
+#endif //SRC_LLCAPTURE_H
@@ -0,0 +1,187 @@
+// Copyright (c) 2022 Clemens Elflein. All rights reserved.
+//
+// This work is licensed under a Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//
+// Feel free to use the design in your private/educational projects, but don't try to sell the design or products based on it without getting my consent first.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//
+
+#ifndef SRC_LINKSTATS_H
+#define SRC_LINKSTATS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+
+/// \brief Nanoseconds on the monotonic clock. Used for all link timestamps.
+inline uint64_t monotonicNanos() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/// \brief A counter with exactly one writing thread, which can be read from any thread.
+///
+/// Since there is only one writer, incrementing is a plain load and store without a locked instruction.
+class Counter {
+public:
+    void add(uint64_t n = 1) {
+        value_.store(value_.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    uint64_t get() const {
+        return value_.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<uint64_t> value_{0};
+};
+
+/// \brief Histogram of durations with power of two buckets in microseconds.
+///
+/// Bucket 0 counts everything below 1us, bucket i counts [2^(i-1), 2^i) us.
+/// The last bucket also counts everything above. Same single writer rule as Counter.
+class LatencyHistogram {
+public:
+    static constexpr size_t BUCKETS = 26;
+
+    struct Snapshot {
+        uint64_t counts[BUCKETS] = {0};
+
+        uint64_t total() const {
+            uint64_t sum = 0;
+            for (auto c: counts) {
+                sum += c;
+            }
+            return sum;
+        }
+
+        /// \brief Upper bound of the bucket containing the given fraction (0-1) of samples in milliseconds.
+        double percentileMs(double fraction) const {
+            uint64_t target = static_cast<uint64_t>(fraction * total() + 0.5);
+            uint64_t sum = 0;
+            for (size_t i = 0; i < BUCKETS; i++) {
+                sum += counts[i];
+                if (sum >= target && sum > 0) {
+                    return (1ULL << i) / 1000.0;
+                }
+            }
+            return 0.0;
+        }
+
+        Snapshot operator-(const Snapshot &other) const {
+            Snapshot result;
+            for (size_t i = 0; i < BUCKETS; i++) {
+                result.counts[i] = counts[i] - other.counts[i];
+            }
+            return result;
+        }
+    };
+
+    void record(uint64_t nanos) {
+        buckets_[bucketFor(nanos)].add();
+    }
+
+    Snapshot snapshot() const {
+        Snapshot result;
+        for (size_t i = 0; i < BUCKETS; i++) {
+            result.counts[i] = buckets_[i].get();
+        }
+        return result;
+    }
+
+    static size_t bucketFor(uint64_t nanos) {
+        uint64_t micros = nanos / 1000;
+        if (micros == 0) {
+            return 0;
+        }
+        size_t bucket = 64 - __builtin_clzll(micros);
+        return bucket < BUCKETS ? bucket : BUCKETS - 1;
+    }
+
+private:
+    Counter buckets_[BUCKETS];
+};
+
+/// \brief Health statistics for the low level link.
+///
+/// Every counter is only written by one thread (noted below), the publisher reads them at 1Hz.
+struct LinkStats {
+    // Written by the serial thread
+    Counter rx_bytes;
+    Counter rx_frames;
+    Counter empty_frames;
+    Counter decode_errors;
+    Counter crc_errors;
+    Counter oversized_frames;
+    Counter overflows;
+    Counter rx_queue_drops;
+    Counter tx_batches;
+    Counter tx_bytes;
+    Counter tx_errors;
+    // Successful (re)connects and the time from losing the link (or starting) until the board was ready
+    Counter connects;
+    LatencyHistogram connect_time;
+    // Connects where the board didn't send a status in time
+    Counter ready_timeouts;
+
+    // Written by the main thread
+    Counter wrong_size;
+    Counter unknown_type;
+    // Time from receiving a LL status until mower/status is published
+    LatencyHistogram status_latency;
+    // IMU batches missing in the sequence (protocol v2)
+    Counter imu_batches_lost;
+    // IMU batches with a sequence number at or behind the last one, they are dropped
+    Counter imu_batches_out_of_order;
+    // Time from the IMU sample which showed a hazard until the motors were stopped
+    LatencyHistogram hazard_latency;
+
+    struct PacketType {
+        Counter count;
+        LatencyHistogram inter_arrival;
+        // Only used by the writer
+        uint64_t last_rx_ns = 0;
+    };
+    PacketType packet_types[256];
+
+    // Written by the ROS spinner thread
+    Counter tx_queue_drops;
+    Counter tx_budget_exceeded;
+    Counter tx_batch_max_bytes;
+
+    /// \brief Count a valid packet and its time since the last one of the same type. Main thread only.
+    void recordPacket(uint8_t type, uint64_t rx_ns) {
+        PacketType &stats = packet_types[type];
+        if (stats.last_rx_ns != 0 && rx_ns > stats.last_rx_ns) {
+            stats.inter_arrival.record(rx_ns - stats.last_rx_ns);
+        }
+        stats.last_rx_ns = rx_ns;
+        stats.count.add();
+    }
+
+    /// \brief Track the largest batch of frames sent in one control tick. Spinner thread only.
+    void recordTxBatch(size_t size) {
+        if (size > tx_batch_max_bytes.get()) {
+            tx_batch_max_bytes.add(size - tx_batch_max_bytes.get());
+        }
+    }
+
+    /// \brief All errors which indicate a problem with the link itself.
+    uint64_t errorCount() const {
+        return decode_errors.get() + crc_errors.get() + oversized_frames.get() + overflows.get() +
+               wrong_size.get() + unknown_type.get() + tx_errors.get();
+    }
+};
+
+
+#endif //SRC_LINKSTATS_H
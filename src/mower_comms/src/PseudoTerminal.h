@@ -0,0 +1,94 @@
+// Copyright (c) 2022 Clemens Elflein. All rights reserved.
+//
+// This work is licensed under a Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//
+// Feel free to use the design in your private/educational projects, but don't try to sell the design or products based on it without getting my consent first.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//
+
+#ifndef SRC_PSEUDOTERMINAL_H
+#define SRC_PSEUDOTERMINAL_H
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+
+/// Helpers for the tools which pretend to be the low level board on a pseudo terminal.
+namespace pty {
+
+    /// \brief Open a pseudo terminal in raw mode.
+    /// \param slave_name Set to the device mower_comms has to open.
+    /// \returns The master fd or -1.
+    inline int openRaw(std::string &slave_name) {
+        int master = posix_openpt(O_RDWR | O_NOCTTY);
+        if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+            return -1;
+        }
+        slave_name = ptsname(master);
+
+        // Set raw mode on the slave, so the bytes are passed through unmodified.
+        int slave = open(slave_name.c_str(), O_RDWR | O_NOCTTY);
+        if (slave < 0) {
+            return -1;
+        }
+        struct termios tio = {};
+        tcgetattr(slave, &tio);
+        cfmakeraw(&tio);
+        tcsetattr(slave, TCSANOW, &tio);
+        close(slave);
+        return master;
+    }
+
+    /// \brief Poll for bytes from mower_comms.
+    /// \param timeout_ms Time to wait for the first byte.
+    /// \returns The number of bytes read, 0 if there were none or -1, if no client has the slave side open.
+    inline ssize_t read(int master, uint8_t *buffer, size_t size, int timeout_ms) {
+        struct pollfd pfd = {master, POLLIN, 0};
+        if (poll(&pfd, 1, timeout_ms) <= 0) {
+            return 0;
+        }
+        if (pfd.revents & POLLHUP) {
+            return -1;
+        }
+        if (!(pfd.revents & POLLIN)) {
+            return 0;
+        }
+        ssize_t result = ::read(master, buffer, size);
+        return result < 0 ? 0 : result;
+    }
+
+    /// \brief Write all bytes.
+    /// \returns false on error.
+    inline bool writeAll(int master, const uint8_t *bytes, size_t size) {
+        size_t written = 0;
+        while (written < size) {
+            ssize_t result = ::write(master, bytes + written, size - written);
+            if (result < 0) {
+                if (errno == EAGAIN || errno == EINTR) {
+                    continue;
+                }
+                return false;
+            }
+            written += result;
+        }
+        return true;
+    }
+}
+
+
+#endif //SRC_PSEUDOTERMINAL_H
@@ -0,0 +1,180 @@
+// Copyright (c) 2022 Clemens Elflein. All rights reserved.
+//
+// This work is licensed under a Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//
+// Feel free to use the design in your private/educational projects, but don't try to sell the design or products based on it without getting my consent first.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//
+
+#ifndef SRC_SERIALRECONNECT_H
+#define SRC_SERIALRECONNECT_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+
+/// \brief Exponential backoff for reconnect attempts.
+class Backoff {
+public:
+    Backoff(double floor_s, double ceiling_s) : floor_s_(floor_s), ceiling_s_(ceiling_s), next_s_(floor_s) {
+    }
+
+    /// \returns The delay before the next attempt and doubles it for the one after.
+    double next() {
+        double delay = next_s_;
+        next_s_ = std::min(next_s_ * 2.0, ceiling_s_);
+        return delay;
+    }
+
+    /// \brief Start over at the floor, call when the connection works again.
+    void reset() {
+        next_s_ = floor_s_;
+    }
+
+private:
+    double floor_s_, ceiling_s_, next_s_;
+};
+
+/// \brief Watches for a device node (e.g. /dev/ttyACM0) to appear, so we can reconnect as soon as
+/// udev created it instead of waiting for the next retry.
+///
+/// Symlinks like /dev/serial/by-id/... work as well, since their directory is watched. udev only creates
+/// /dev/serial/by-id with the first USB serial device and removes it with the last one. While the directory
+/// is missing, its closest existing parent is watched instead, and the watch moves down again once it is back.
+class DeviceWatcher {
+public:
+    ~DeviceWatcher() {
+        if (fd_ >= 0) {
+            close(fd_);
+        }
+    }
+
+    /// \returns false, if inotify is not available. wait() then just sleeps.
+    bool watch(const std::string &path) {
+        path_ = path;
+        directory_ = parentOf(path);
+        size_t slash = path.find_last_of('/');
+        name_ = slash == std::string::npos ? path : path.substr(slash + 1);
+
+        fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd_ < 0) {
+            return false;
+        }
+        if (!addWatch()) {
+            close(fd_);
+            fd_ = -1;
+            return false;
+        }
+        return true;
+    }
+
+    /// \brief Sleep for the given time, but return early if the device was created or changed.
+    /// \returns true, if the device showed up.
+    bool wait(double timeout_s) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(timeout_s);
+        if (fd_ < 0) {
+            std::this_thread::sleep_until(deadline);
+            return false;
+        }
+        while (true) {
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    deadline - std::chrono::steady_clock::now()).count();
+            if (remaining <= 0) {
+                return false;
+            }
+            struct pollfd pfd = {fd_, POLLIN, 0};
+            if (poll(&pfd, 1, static_cast<int>(remaining)) > 0 && readEvents()) {
+                return true;
+            }
+        }
+    }
+
+private:
+    static constexpr uint32_t WATCH_MASK = IN_CREATE | IN_ATTRIB | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF |
+                                           IN_ONLYDIR;
+
+    static std::string parentOf(const std::string &path) {
+        size_t slash = path.find_last_of('/');
+        return slash == std::string::npos ? "." : path.substr(0, std::max<size_t>(slash, 1));
+    }
+
+    // Watch the device directory or, if it doesn't exist, its closest existing parent.
+    bool addWatch() {
+        if (wd_ >= 0) {
+            inotify_rm_watch(fd_, wd_);
+            wd_ = -1;
+        }
+        watched_ = directory_;
+        while ((wd_ = inotify_add_watch(fd_, watched_.c_str(), WATCH_MASK)) < 0) {
+            if (watched_ == "/" || watched_ == ".") {
+                return false;
+            }
+            watched_ = parentOf(watched_);
+        }
+        return true;
+    }
+
+    // Read all pending events. Returns true, if one of them is about our device.
+    bool readEvents() {
+        alignas(struct inotify_event) char buffer[4096];
+        bool found = false;
+        bool rewatch = false;
+        ssize_t size;
+        while ((size = read(fd_, buffer, sizeof(buffer))) > 0) {
+            for (char *ptr = buffer; ptr < buffer + size;) {
+                auto *event = reinterpret_cast<struct inotify_event *>(ptr);
+                ptr += sizeof(struct inotify_event) + event->len;
+                if (event->wd != wd_) {
+                    // Left over from a watch we replaced
+                    continue;
+                }
+                if (event->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) {
+                    // The watched directory is gone
+                    rewatch = true;
+                } else if (watched_ != directory_) {
+                    // Something was created in a parent, maybe the next directory on the way to the device
+                    rewatch = rewatch || (event->mask & (IN_CREATE | IN_MOVED_TO)) != 0;
+                } else if (event->len > 0 && name_ == event->name) {
+                    found = true;
+                }
+            }
+        }
+        if (rewatch) {
+            if (!addWatch()) {
+                // Nothing left to watch, wait() only sleeps from now on
+                close(fd_);
+                fd_ = -1;
+                return false;
+            }
+            // The device could have been created before the new watch was added
+            found = found || (watched_ == directory_ && access(path_.c_str(), F_OK) == 0);
+        }
+        return found;
+    }
+
+    int fd_ = -1;
+    int wd_ = -1;
+    std::string path_;
+    std::string directory_;
+    std::string name_;
+    // The directory which is watched right now, directory_ or one of its parents
+    std::string watched_;
+};
+
+
+#endif //SRC_SERIALRECONNECT_H
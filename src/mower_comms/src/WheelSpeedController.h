@@ -0,0 +1,131 @@
+// Copyright (c) 2022 Clemens Elflein. All rights reserved.
+//
+// This work is licensed under a Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//
+// Feel free to use the design in your private/educational projects, but don't try to sell the design or products based on it without getting my consent first.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//
+
+#ifndef SRC_WHEELSPEEDCONTROLLER_H
+#define SRC_WHEELSPEEDCONTROLLER_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+
+/// \brief PI speed controller for one wheel, output is the ESC duty cycle.
+///
+/// duty = feed_forward * target + kp * error + ki * integral(error)
+///
+/// The speed is measured from the ESC tacho, so it is only updated when the ESC sent a new state.
+/// The integral is frozen while the output saturates in the direction of the error (anti-windup).
+class WheelSpeedController {
+public:
+    struct Gains {
+        // Duty cycle per m/s, roughly 1 / (speed at full duty cycle)
+        double feed_forward = 1.0;
+        double kp = 0.5;
+        double ki = 2.0;
+    };
+
+    struct Stats {
+        // Last measured speed [m/s]
+        double speed = 0.0;
+        // Last target speed [m/s]
+        double target = 0.0;
+        double duty = 0.0;
+        // Sum of squared tracking errors and the number of updates, so the reader can build an RMS over any interval
+        double error_sq_sum = 0.0;
+        uint64_t updates = 0;
+        // Largest absolute tracking error since the last resetMaxError() [m/s]
+        double max_error = 0.0;
+        uint64_t saturated = 0;
+    };
+
+    void setGains(const Gains &gains) {
+        gains_ = gains;
+    }
+
+    /// \brief Feed a new ESC state.
+    /// \param ticks The signed tacho count, oriented so that positive means forward.
+    /// \param stamp_s Time of the ESC state. States with an unchanged stamp are ignored.
+    /// \param ticks_per_m Tacho ticks per meter.
+    void updateMeasurement(int32_t ticks, double stamp_s, double ticks_per_m) {
+        if (has_measurement_ && stamp_s > last_stamp_s_ && ticks_per_m > 0.0) {
+            // Tacho is an int32 on the ESC, the difference is right even when it wraps.
+            int32_t delta = static_cast<int32_t>(static_cast<uint32_t>(ticks) - static_cast<uint32_t>(last_ticks_));
+            stats_.speed = delta / ticks_per_m / (stamp_s - last_stamp_s_);
+        }
+        if (!has_measurement_ || stamp_s > last_stamp_s_) {
+            last_ticks_ = ticks;
+            last_stamp_s_ = stamp_s;
+            has_measurement_ = true;
+        }
+    }
+
+    /// \brief Run the controller for one control tick.
+    /// \param target Target speed [m/s].
+    /// \param dt Time since the last update [s].
+    /// \returns The duty cycle in [-1, 1].
+    double update(double target, double dt) {
+        if (target == 0.0) {
+            // Don't hold the wheel against the load when we want to stop, just let go.
+            reset();
+            stats_.target = 0.0;
+            stats_.duty = 0.0;
+            return 0.0;
+        }
+
+        double error = target - stats_.speed;
+        double unclamped = gains_.feed_forward * target + gains_.kp * error + gains_.ki * integral_;
+        double duty = std::max(-1.0, std::min(1.0, unclamped));
+        bool saturated = duty != unclamped;
+        if (!saturated || (unclamped > 0.0) != (error > 0.0)) {
+            integral_ += error * dt;
+        }
+        if (saturated) {
+            stats_.saturated++;
+        }
+
+        stats_.target = target;
+        stats_.duty = duty;
+        stats_.error_sq_sum += error * error;
+        stats_.updates++;
+        stats_.max_error = std::max(stats_.max_error, std::fabs(error));
+        return duty;
+    }
+
+    /// \brief Forget the integral, e.g. after an emergency stop.
+    void reset() {
+        integral_ = 0.0;
+    }
+
+    const Stats &getStats() const {
+        return stats_;
+    }
+
+    void resetMaxError() {
+        stats_.max_error = 0.0;
+    }
+
+private:
+    Gains gains_;
+    Stats stats_;
+    double integral_ = 0.0;
+
+    bool has_measurement_ = false;
+    int32_t last_ticks_ = 0;
+    double last_stamp_s_ = 0.0;
+};
+
+
+#endif //SRC_WHEELSPEEDCONTROLLER_H
@@ -0,0 +1,123 @@
+// Copyright (c) 2022 Clemens Elflein. All rights reserved.
+//
+// This work is licensed under a Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//
+// Feel free to use the design in your private/educational projects, but don't try to sell the design or products based on it without getting my consent first.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//
+
+#ifndef SRC_WHEELTICKFILTER_H
+#define SRC_WHEELTICKFILTER_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+
+/// \brief Wheel speed from a stream of timestamped ESC tick counts.
+///
+/// The speed is the slope of a least squares line through the last few counts. Compared to the difference
+/// of the last two counts, this averages out the tick quantization and the stamp jitter, and the stamps
+/// don't need to be evenly spaced. The delay is half the window.
+class WheelTickFilter {
+public:
+    // An enumerator, so std::min() can take it by reference without a definition outside the class
+    enum : size_t { MAX_WINDOW = 16 };
+
+    /// \param window Number of counts in the fit, at least 2.
+    /// \param max_gap_s Start over, if there were no counts for this long (e.g. ESC reconnected).
+    explicit WheelTickFilter(size_t window = 5, double max_gap_s = 0.5)
+            : window_(std::max<size_t>(2, std::min<size_t>(window, MAX_WINDOW))), max_gap_s_(max_gap_s) {
+    }
+
+    /// \brief Add a tick count.
+    /// \param ticks The signed tacho count, wraps around like the ESC's int32.
+    /// \param stamp_ns Time of the count.
+    /// \returns false, if the stamp is not newer than the last one and the count was ignored.
+    bool add(int32_t ticks, uint64_t stamp_ns) {
+        if (count_ > 0) {
+            if (stamp_ns <= stamps_[last_]) {
+                return false;
+            }
+            if ((stamp_ns - stamps_[last_]) * 1e-9 > max_gap_s_) {
+                count_ = 0;
+            }
+        }
+        if (count_ == 0) {
+            unwrapped_ = 0;
+        } else {
+            unwrapped_ += static_cast<int32_t>(static_cast<uint32_t>(ticks) - static_cast<uint32_t>(ticks_));
+        }
+        ticks_ = ticks;
+
+        last_ = (last_ + 1) % window_;
+        counts_[last_] = unwrapped_;
+        stamps_[last_] = stamp_ns;
+        count_ = std::min(count_ + 1, window_);
+        velocity_ = fit();
+        return true;
+    }
+
+    /// \returns The latest tick count.
+    int32_t ticks() const {
+        return ticks_;
+    }
+
+    /// \returns The time of the latest tick count, 0 if there was none.
+    uint64_t stamp() const {
+        return count_ > 0 ? stamps_[last_] : 0;
+    }
+
+    /// \returns The speed [ticks/s], 0 until there are two counts.
+    double velocity() const {
+        return velocity_;
+    }
+
+private:
+    double fit() const {
+        if (count_ < 2) {
+            return 0.0;
+        }
+        // Relative to the latest sample, so the values stay small
+        double mean_t = 0.0, mean_y = 0.0;
+        for (size_t i = 0; i < count_; i++) {
+            size_t idx = (last_ + window_ - i) % window_;
+            mean_t += static_cast<int64_t>(stamps_[idx] - stamps_[last_]) * 1e-9;
+            mean_y += static_cast<double>(counts_[idx] - counts_[last_]);
+        }
+        mean_t /= count_;
+        mean_y /= count_;
+        double stt = 0.0, sty = 0.0;
+        for (size_t i = 0; i < count_; i++) {
+            size_t idx = (last_ + window_ - i) % window_;
+            double dt = static_cast<int64_t>(stamps_[idx] - stamps_[last_]) * 1e-9 - mean_t;
+            stt += dt * dt;
+            sty += dt * (static_cast<double>(counts_[idx] - counts_[last_]) - mean_y);
+        }
+        return stt > 0.0 ? sty / stt : 0.0;
+    }
+
+    size_t window_;
+    double max_gap_s_;
+
+    // Ring buffer of the unwrapped counts and their stamps, last_ is the newest one
+    int64_t counts_[MAX_WINDOW] = {0};
+    uint64_t stamps_[MAX_WINDOW] = {0};
+    size_t last_ = 0;
+    size_t count_ = 0;
+
+    int64_t unwrapped_ = 0;
+    int32_t ticks_ = 0;
+    double velocity_ = 0.0;
+};
+
+
+#endif //SRC_WHEELTICKFILTER_H
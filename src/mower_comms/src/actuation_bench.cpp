@@ -0,0 +1,164 @@
+// Copyright (c) 2022 Clemens Elflein. All rights reserved.
+//
+// This work is licensed under a Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//
+// Feel free to use the design in your private/educational projects, but don't try to sell the design or products based on it without getting my consent first.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//
+
+// Benchmark for the cmd_vel latency of mower_comms. It publishes cmd_vel at a fixed rate and reports
+// p50/p99 of every trace stage from mower_service/dump_actuation_latency for the time it ran.
+//
+// Runs without hardware against ll_sim and the mock ESC:
+//   rosrun mower_comms ll_sim --link /tmp/ll_board
+//   rosrun mower_comms mower_comms _ll_serial_port:=/tmp/ll_board _esc_backend:=mock
+//   rosrun mower_comms actuation_bench --rate 20 --duration 30
+//
+// Don't run it while twist_mux or anything else publishes cmd_vel.
+//
+// Usage: actuation_bench [options]
+//   --rate <hz>          cmd_vel rate (default 20)
+//   --duration <s>       Benchmark duration (default 30)
+//   --speed <m/s>        Linear speed, the sign flips every second (default 0, the mower doesn't move but
+//                        the commands still go all the way to the ESCs)
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "ros/ros.h"
+#include <geometry_msgs/Twist.h>
+#include "mower_msgs/DumpLatencySrv.h"
+
+
+/// \brief Bucket counts of one stage from the dump service.
+std::vector<uint64_t> stageCounts(const mower_msgs::DumpLatencySrvResponse &dump, size_t stage) {
+    size_t buckets = dump.bucket_limits_ms.size();
+    return std::vector<uint64_t>(dump.counts.begin() + stage * buckets, dump.counts.begin() + (stage + 1) * buckets);
+}
+
+/// \brief Upper limit of the bucket containing the given fraction (0-1) of samples in milliseconds.
+double percentileMs(const std::vector<uint64_t> &counts, const std::vector<double> &limits_ms, double fraction) {
+    uint64_t total = 0;
+    for (auto c: counts) {
+        total += c;
+    }
+    uint64_t target = static_cast<uint64_t>(fraction * total + 0.5);
+    uint64_t sum = 0;
+    for (size_t i = 0; i < counts.size(); i++) {
+        sum += counts[i];
+        if (sum >= target && sum > 0) {
+            return limits_ms[i];
+        }
+    }
+    return 0.0;
+}
+
+int main(int argc, char **argv) {
+    double rate_hz = 20.0;
+    double duration_s = 30.0;
+    double speed = 0.0;
+
+    ros::init(argc, argv, "actuation_bench");
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            fprintf(stderr, "Unknown or incomplete option: %s\n", arg.c_str());
+            return 1;
+        }
+        if (arg == "--rate") {
+            rate_hz = atof(argv[++i]);
+        } else if (arg == "--duration") {
+            duration_s = atof(argv[++i]);
+        } else if (arg == "--speed") {
+            speed = atof(argv[++i]);
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", arg.c_str());
+            return 1;
+        }
+    }
+    if (rate_hz <= 0.0 || duration_s <= 0.0) {
+        fprintf(stderr, "Rate and duration must be positive\n");
+        return 1;
+    }
+
+    ros::NodeHandle n;
+    ros::Publisher cmd_vel_pub = n.advertise<geometry_msgs::Twist>("cmd_vel", 1);
+    ros::ServiceClient dump_client = n.serviceClient<mower_msgs::DumpLatencySrv>(
+            "mower_service/dump_actuation_latency");
+    if (!dump_client.waitForExistence(ros::Duration(10.0))) {
+        fprintf(stderr, "mower_comms is not running\n");
+        return 1;
+    }
+
+    // Give the subscriber time to connect, so we don't lose the first commands
+    ros::Time connect_deadline = ros::Time::now() + ros::Duration(5.0);
+    while (ros::ok() && cmd_vel_pub.getNumSubscribers() == 0 && ros::Time::now() < connect_deadline) {
+        ros::Duration(0.01).sleep();
+    }
+
+    mower_msgs::DumpLatencySrv before;
+    if (!dump_client.call(before)) {
+        fprintf(stderr, "Error calling the dump service\n");
+        return 1;
+    }
+
+    printf("Publishing cmd_vel at %.1f Hz for %.1f s\n", rate_hz, duration_s);
+    fflush(stdout);
+    ros::Rate rate(rate_hz);
+    ros::Time start = ros::Time::now();
+    size_t sent = 0;
+    while (ros::ok() && (ros::Time::now() - start).toSec() < duration_s) {
+        geometry_msgs::Twist twist;
+        twist.linear.x = static_cast<int64_t>((ros::Time::now() - start).toSec()) % 2 == 0 ? speed : -speed;
+        cmd_vel_pub.publish(twist);
+        sent++;
+        rate.sleep();
+    }
+    cmd_vel_pub.publish(geometry_msgs::Twist());
+    // Let the last commands pass the next control tick
+    ros::Duration(0.1).sleep();
+
+    mower_msgs::DumpLatencySrv after;
+    if (!dump_client.call(after)) {
+        fprintf(stderr, "Error calling the dump service\n");
+        return 1;
+    }
+    if (after.response.counts.size() != before.response.counts.size()) {
+        fprintf(stderr, "mower_comms restarted during the benchmark\n");
+        return 1;
+    }
+
+    printf("Sent %zu commands\n", sent);
+    printf("%-22s %8s %10s %10s %10s\n", "stage", "n", "p50 [ms]", "p99 [ms]", "max [ms]");
+    const auto &limits = after.response.bucket_limits_ms;
+    for (size_t stage = 0; stage < after.response.stages.size(); stage++) {
+        std::vector<uint64_t> counts = stageCounts(after.response, stage);
+        std::vector<uint64_t> counts_before = stageCounts(before.response, stage);
+        uint64_t total = 0;
+        for (size_t i = 0; i < counts.size(); i++) {
+            if (counts[i] < counts_before[i]) {
+                fprintf(stderr, "mower_comms restarted during the benchmark\n");
+                return 1;
+            }
+            counts[i] -= counts_before[i];
+            total += counts[i];
+        }
+        printf("%-22s %8lu %10.3f %10.3f %10.3f\n", after.response.stages[stage].c_str(),
+               static_cast<unsigned long>(total), percentileMs(counts, limits, 0.5),
+               percentileMs(counts, limits, 0.99), percentileMs(counts, limits, 1.0));
+    }
+    printf("Percentiles are the upper limits of power of two buckets.\n");
+    return 0;
+}
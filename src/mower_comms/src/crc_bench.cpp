@@ -0,0 +1,64 @@
+// Copyright (c) 2022 Clemens Elflein. All rights reserved.
+//
+// This work is licensed under a Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//
+// Feel free to use the design in your private/educational projects, but don't try to sell the design or products based on it without getting my consent first.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//
+
+// Benchmark of the CRC-16 of the low level link against boost::crc_ccitt_type, for frame sized buffers.
+//
+// Usage: rosrun mower_comms crc_bench [google benchmark options]
+//
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+#include <boost/crc.hpp>
+
+#include "CRC16.h"
+
+
+static std::vector<uint8_t> randomBuffer(size_t size) {
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<int> byte(0, 255);
+    std::vector<uint8_t> data(size);
+    for (auto &b: data) {
+        b = byte(rng);
+    }
+    return data;
+}
+
+static void BM_Crc16(benchmark::State &state) {
+    auto data = randomBuffer(state.range(0));
+    for (auto _: state) {
+        benchmark::DoNotOptimize(crc16::checksum(data.data(), data.size()));
+    }
+    state.SetBytesProcessed(state.iterations() * data.size());
+}
+
+static void BM_BoostCrcCcitt(benchmark::State &state) {
+    auto data = randomBuffer(state.range(0));
+    for (auto _: state) {
+        boost::crc_ccitt_type crc;
+        crc.process_bytes(data.data(), data.size());
+        benchmark::DoNotOptimize(crc.checksum());
+    }
+    state.SetBytesProcessed(state.iterations() * data.size());
+}
+
+// Status and IMU frames are a few dozen bytes, batched IMU frames up to a few hundred
+BENCHMARK(BM_Crc16)->Arg(8)->Arg(32)->Arg(64)->Arg(256)->Arg(1024);
+BENCHMARK(BM_BoostCrcCcitt)->Arg(8)->Arg(32)->Arg(64)->Arg(256)->Arg(1024);
+
+BENCHMARK_MAIN();
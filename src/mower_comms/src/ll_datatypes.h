@@ -26,6 +26,15 @@
 #define PACKET_ID_LL_HEARTBEAT 0x42
 #define PACKET_ID_LL_HIGH_LEVEL_STATE 0x43
 
+// Protocol v2, see ll_hello. A v1 board ignores the hello, so both sides keep using v1.
+#define PACKET_ID_LL_CAPABILITIES 4
+#define PACKET_ID_LL_IMU_BATCH 5
+#define PACKET_ID_LL_HELLO 0x44
+
+#define LL_PROTOCOL_VERSION 2
+// Number of samples in a ll_imu_batch
+#define LL_IMU_BATCH_SAMPLES 4
+
 
 #pragma pack(push, 1)
 struct ll_status {
@@ -109,4 +118,56 @@ struct ll_high_level_state {
 } __attribute__((packed));
 #pragma pack(pop)
 
+// Sent by the host until it gets ll_capabilities back.
+#pragma pack(push, 1)
+struct ll_hello {
+    // Type of this message. Has to be PACKET_ID_LL_HELLO
+    uint8_t type;
+    // Highest protocol version the host supports
+    uint8_t protocol_version;
+    // Requested IMU sample rate, 0 for the firmware default
+    uint16_t imu_rate_hz;
+    uint16_t crc;
+} __attribute__((packed));
+#pragma pack(pop)
+
+// Answer to ll_hello. From now on, the board sends ll_imu_batch instead of ll_imu.
+#pragma pack(push, 1)
+struct ll_capabilities {
+    // Type of this message. Has to be PACKET_ID_LL_CAPABILITIES
+    uint8_t type;
+    // Protocol version both sides use from now on
+    uint8_t protocol_version;
+    // Actual IMU sample rate
+    uint16_t imu_rate_hz;
+    uint16_t crc;
+} __attribute__((packed));
+#pragma pack(pop)
+
+#pragma pack(push, 1)
+struct ll_imu_sample {
+    // Acceleration[m^s2] and Gyro[rad/s]
+    float acceleration_mss[3];
+    float gyro_rads[3];
+} __attribute__((packed));
+#pragma pack(pop)
+
+// LL_IMU_BATCH_SAMPLES consecutive IMU samples in one frame.
+#pragma pack(push, 1)
+struct ll_imu_batch {
+    // Type of this message. Has to be PACKET_ID_LL_IMU_BATCH
+    uint8_t type;
+    // Incremented with every batch, so the host can detect lost frames
+    uint8_t seq;
+    // LL time of the first sample in microseconds, wraps around
+    uint32_t base_time_micros;
+    // Time between two samples in microseconds
+    uint16_t sample_period_micros;
+    // Magnetic field[uT] at the last sample
+    float mag_uT[3];
+    struct ll_imu_sample samples[LL_IMU_BATCH_SAMPLES];
+    uint16_t crc;
+} __attribute__((packed));
+#pragma pack(pop)
+
 #endif
\ No newline at end of file
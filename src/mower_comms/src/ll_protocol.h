@@ -0,0 +1,210 @@
+// Copyright (c) 2022 Clemens Elflein. All rights reserved.
+//
+// This work is licensed under a Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//
+// Feel free to use the design in your private/educational projects, but don't try to sell the design or products based on it without getting my consent first.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//
+
+#ifndef SRC_LL_PROTOCOL_H
+#define SRC_LL_PROTOCOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include "ll_datatypes.h"
+#include "COBS.h"
+#include "CRC16.h"
+
+
+/// Framing and dispatching of the packets in ll_datatypes.h.
+///
+/// On the wire, every packet is the packed struct (type byte first, CRC-16 last),
+/// COBS encoded and terminated by a 0x00 delimiter.
+///
+/// To add a new packet type, declare its PacketTraits below and add one entry to the
+/// dispatch table (receiving side) or call encodeFrame() with it (sending side).
+namespace ll {
+
+    /// \brief Maps a packet struct to its type ID.
+    template<typename Packet>
+    struct PacketTraits;
+
+    template<> struct PacketTraits<ll_status> { static constexpr uint8_t ID = PACKET_ID_LL_STATUS; };
+    template<> struct PacketTraits<ll_imu> { static constexpr uint8_t ID = PACKET_ID_LL_IMU; };
+    template<> struct PacketTraits<ll_ui_event> { static constexpr uint8_t ID = PACKET_ID_LL_UI_EVENT; };
+    template<> struct PacketTraits<ll_heartbeat> { static constexpr uint8_t ID = PACKET_ID_LL_HEARTBEAT; };
+    template<> struct PacketTraits<ll_high_level_state> { static constexpr uint8_t ID = PACKET_ID_LL_HIGH_LEVEL_STATE; };
+    template<> struct PacketTraits<ll_hello> { static constexpr uint8_t ID = PACKET_ID_LL_HELLO; };
+    template<> struct PacketTraits<ll_capabilities> { static constexpr uint8_t ID = PACKET_ID_LL_CAPABILITIES; };
+    template<> struct PacketTraits<ll_imu_batch> { static constexpr uint8_t ID = PACKET_ID_LL_IMU_BATCH; };
+
+    /// \brief Checks the layout every packet has to follow. This has to match the LL firmware.
+    template<typename Packet>
+    constexpr bool checkLayout() {
+        static_assert(std::is_standard_layout<Packet>::value && std::is_trivially_copyable<Packet>::value,
+                      "Packets have to be plain structs");
+        static_assert(alignof(Packet) == 1, "Packets have to be packed");
+        static_assert(offsetof(Packet, type) == 0, "The type has to be the first byte");
+        static_assert(offsetof(Packet, crc) == sizeof(Packet) - 2, "The CRC has to be the last two bytes");
+        static_assert(sizeof(Packet) < 254, "Packets have to fit into one COBS block");
+        return true;
+    }
+
+    static_assert(checkLayout<ll_status>() && sizeof(ll_status) == 38, "Unexpected size of ll_status");
+    static_assert(checkLayout<ll_imu>() && sizeof(ll_imu) == 41, "Unexpected size of ll_imu");
+    static_assert(checkLayout<ll_ui_event>() && sizeof(ll_ui_event) == 5, "Unexpected size of ll_ui_event");
+    static_assert(checkLayout<ll_heartbeat>() && sizeof(ll_heartbeat) == 5, "Unexpected size of ll_heartbeat");
+    static_assert(checkLayout<ll_high_level_state>() && sizeof(ll_high_level_state) == 5,
+                  "Unexpected size of ll_high_level_state");
+    static_assert(checkLayout<ll_hello>() && sizeof(ll_hello) == 6, "Unexpected size of ll_hello");
+    static_assert(checkLayout<ll_capabilities>() && sizeof(ll_capabilities) == 6, "Unexpected size of ll_capabilities");
+    static_assert(checkLayout<ll_imu_batch>() && sizeof(ll_imu_batch) == 22 + 24 * LL_IMU_BATCH_SAMPLES,
+                  "Unexpected size of ll_imu_batch");
+
+    /// \brief Size of the encoded frame for a packet, including the delimiter.
+    template<typename Packet>
+    constexpr size_t encodedFrameSize() {
+        return sizeof(Packet) + sizeof(Packet) / 254 + 1 + 1;
+    }
+
+    /// \brief Set type and CRC of a packet and write it as delimited COBS frame.
+    /// \param packet The packet to send. Type and CRC are filled in.
+    /// \param buffer The buffer for the frame.
+    /// \param buffer_size The capacity of \p buffer.
+    /// \returns The frame size or 0, if the buffer was too small.
+    template<typename Packet>
+    size_t encodeFrame(Packet &packet, uint8_t *buffer, size_t buffer_size) {
+        static_assert(checkLayout<Packet>(), "Invalid packet layout");
+        if (buffer_size < encodedFrameSize<Packet>()) {
+            return 0;
+        }
+        packet.type = PacketTraits<Packet>::ID;
+        packet.crc = crc16::checksum(&packet, sizeof(Packet) - 2);
+        size_t size = COBS::encode(reinterpret_cast<const uint8_t *>(&packet), sizeof(Packet), buffer);
+        buffer[size++] = 0;
+        return size;
+    }
+
+    /// \brief Fixed size buffer collecting several frames, so they can be written with a single call.
+    template<size_t Capacity>
+    struct FrameBatch {
+        uint16_t size = 0;
+        uint8_t data[Capacity];
+
+        /// \brief Encode a packet and append it to the batch.
+        /// \returns false, if there was not enough space left.
+        template<typename Packet>
+        bool add(Packet &packet) {
+            size_t frame_size = encodeFrame(packet, data + size, Capacity - size);
+            size += frame_size;
+            return frame_size > 0;
+        }
+    };
+
+    enum class Result {
+        OK,
+        // Two delimiters in a row
+        EMPTY,
+        // Malformed COBS data or less than type + CRC
+        DECODE_ERROR,
+        // Frame larger than the decode buffer
+        TOO_LARGE,
+        CRC_ERROR,
+        UNKNOWN_TYPE,
+        WRONG_SIZE
+    };
+
+    /// \brief Decode a frame (without delimiter) and check its CRC.
+    /// \param frame The COBS encoded frame.
+    /// \param size The number of bytes in \p frame.
+    /// \param buffer The buffer for the decoded packet.
+    /// \param data_size Set to the decoded packet size.
+    template<size_t BufferSize>
+    Result decodeFrame(const uint8_t *frame, size_t size, uint8_t (&buffer)[BufferSize], size_t &data_size) {
+        if (size == 0) {
+            return Result::EMPTY;
+        }
+        // The decoded data is never larger than the encoded one.
+        if (size > BufferSize) {
+            return Result::TOO_LARGE;
+        }
+        data_size = COBS::decode(frame, size, buffer);
+        if (data_size < 3) {
+            return Result::DECODE_ERROR;
+        }
+        uint16_t received_checksum;
+        memcpy(&received_checksum, buffer + data_size - 2, sizeof(received_checksum));
+        if (crc16::checksum(buffer, data_size - 2) != received_checksum) {
+            return Result::CRC_ERROR;
+        }
+        return Result::OK;
+    }
+
+    /// \brief Dispatch table entry: The expected packet size and the handler to call.
+    struct DispatchEntry {
+        uint16_t size;
+        void (*handler)(const uint8_t *data);
+    };
+
+    /// \brief One entry per possible type byte, so dispatching is a single indexed lookup.
+    struct DispatchTable {
+        DispatchEntry entries[256];
+    };
+
+    /// \brief Binds a handler function to a packet type. Use as argument for makeDispatchTable().
+    template<typename Packet, void (*Handler)(const Packet *)>
+    struct On {
+        static_assert(checkLayout<Packet>(), "Invalid packet layout");
+        static constexpr uint8_t ID = PacketTraits<Packet>::ID;
+        static constexpr uint16_t SIZE = sizeof(Packet);
+
+        static void invoke(const uint8_t *data) {
+            // Packets are packed (alignment of 1), so we can use the buffer directly.
+            Handler(reinterpret_cast<const Packet *>(data));
+        }
+    };
+
+    /// \brief Build the dispatch table at compile time, e.g.
+    /// constexpr auto table = makeDispatchTable<On<ll_status, handleStatus>, On<ll_imu, handleImu>>();
+    template<typename... Handlers>
+    constexpr DispatchTable makeDispatchTable() {
+        DispatchTable table{};
+        const DispatchEntry entries[] = {{0, nullptr}, {Handlers::SIZE, &Handlers::invoke}...};
+        const uint8_t ids[] = {0, Handlers::ID...};
+        for (size_t i = 1; i < sizeof(ids); i++) {
+            if (table.entries[ids[i]].handler != nullptr) {
+                // Not a constant expression, so a duplicate ID fails to compile.
+                throw "Duplicate packet ID in dispatch table";
+            }
+            table.entries[ids[i]] = entries[i];
+        }
+        return table;
+    }
+
+    /// \brief Call the handler for a decoded packet.
+    inline Result dispatch(const DispatchTable &table, const uint8_t *data, size_t data_size) {
+        const DispatchEntry &entry = table.entries[data[0]];
+        if (entry.handler == nullptr) {
+            return Result::UNKNOWN_TYPE;
+        }
+        if (entry.size != data_size) {
+            return Result::WRONG_SIZE;
+        }
+        entry.handler(data);
+        return Result::OK;
+    }
+}
+
+
+#endif //SRC_LL_PROTOCOL_H
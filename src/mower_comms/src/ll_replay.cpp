@@ -0,0 +1,137 @@
+// Copyright (c) 2022 Clemens Elflein. All rights reserved.
+//
+// This work is licensed under a Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//
+// Feel free to use the design in your private/educational projects, but don't try to sell the design or products based on it without getting my consent first.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//
+// Replays the RX bytes of a low level link capture (see capture_file parameter of mower_comms)
+// on a pseudo terminal. Point ll_serial_port of an unmodified mower_comms to the printed
+// device (or the --link path) to feed it the recorded byte stream.
+//
+// Usage: ll_replay <capture file> [--speed <factor>] [--link <path>] [--loop]
+//   --speed 0 replays as fast as possible.
+//
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include <unistd.h>
+
+#include "LLCapture.h"
+#include "PseudoTerminal.h"
+
+
+/**
+ * Read and drop everything mower_comms sent us, so the pty buffer doesn't fill up.
+ * @return true, if a client has the slave side open.
+ */
+bool drain(int master) {
+    uint8_t buffer[1024];
+    ssize_t result;
+    while ((result = pty::read(master, buffer, sizeof(buffer), 0)) > 0) {
+    }
+    return result == 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <capture file> [--speed <factor>] [--link <path>] [--loop]\n", argv[0]);
+        return 1;
+    }
+
+    std::string capture_file = argv[1];
+    double speed = 1.0;
+    std::string link_path;
+    bool loop = false;
+    for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--speed" && i + 1 < argc) {
+            speed = atof(argv[++i]);
+        } else if (arg == "--link" && i + 1 < argc) {
+            link_path = argv[++i];
+        } else if (arg == "--loop") {
+            loop = true;
+        } else {
+            fprintf(stderr, "Unknown argument: %s\n", arg.c_str());
+            return 1;
+        }
+    }
+
+    std::string slave_name;
+    int master = pty::openRaw(slave_name);
+    if (master < 0) {
+        perror("Error opening pseudo terminal");
+        return 1;
+    }
+    if (!link_path.empty()) {
+        unlink(link_path.c_str());
+        if (symlink(slave_name.c_str(), link_path.c_str()) != 0) {
+            perror("Error creating link");
+            return 1;
+        }
+    }
+    printf("Replaying %s on %s\n", capture_file.c_str(), link_path.empty() ? slave_name.c_str() : link_path.c_str());
+    printf("Waiting for mower_comms to connect...\n");
+    fflush(stdout);
+
+    while (!drain(master)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    do {
+        ll_capture::Reader reader;
+        if (!reader.open(capture_file)) {
+            fprintf(stderr, "Error reading capture file %s\n", capture_file.c_str());
+            return 1;
+        }
+
+        ll_capture::Record record;
+        const uint8_t *bytes;
+        uint64_t first_time_ns = 0;
+        size_t total_bytes = 0;
+        auto start = std::chrono::steady_clock::now();
+        while (reader.next(record, bytes)) {
+            if (record.direction != ll_capture::RX) {
+                continue;
+            }
+            if (first_time_ns == 0) {
+                first_time_ns = record.time_ns;
+            }
+            if (speed > 0.0) {
+                auto offset = std::chrono::nanoseconds(
+                        static_cast<int64_t>((record.time_ns - first_time_ns) / speed));
+                std::this_thread::sleep_until(start + offset);
+            }
+            if (!pty::writeAll(master, bytes, record.size)) {
+                perror("Error writing to pseudo terminal");
+                return 1;
+            }
+            total_bytes += record.size;
+            drain(master);
+        }
+
+        double duration = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("Replayed %zu bytes in %.3f s (%.0f bytes/s)\n", total_bytes, duration,
+               duration > 0.0 ? total_bytes / duration : 0.0);
+        fflush(stdout);
+    } while (loop);
+
+    if (!link_path.empty()) {
+        unlink(link_path.c_str());
+    }
+    close(master);
+    return 0;
+}
@@ -0,0 +1,461 @@
+// Copyright (c) 2022 Clemens Elflein. All rights reserved.
+//
+// This work is licensed under a Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//
+// Feel free to use the design in your private/educational projects, but don't try to sell the design or products based on it without getting my consent first.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//
+// Simulated low level board on a pseudo terminal. Point ll_serial_port of mower_comms to the printed
+// device (or the --link path), optionally with esc_backend set to mock, to run it without any hardware.
+//
+// Usage: ll_sim [options]
+//   --link <path>        Create a symlink to the pseudo terminal
+//   --scale <factor>     Multiply all packet rates, e.g. 10 for a load test
+//   --status-hz <hz>     ll_status rate (default 10)
+//   --imu-hz <hz>        IMU sample rate (default 50). With protocol v2, mower_comms can request another one.
+//   --ui-hz <hz>         ll_ui_event rate (default 0). The events use a button without an action.
+//   --protocol <1|2>     Highest protocol version to accept (default 2). Version 1 ignores the hello
+//                        and sends ll_imu, version 2 sends ll_imu_batch after the capability exchange.
+//   --drop <p>           Probability of dropping a frame
+//   --crc-errors <p>     Probability of sending a frame with a wrong CRC
+//   --truncate <p>       Probability of cutting a frame short
+//   --bursts <p>         Probability of holding back frames and sending them at once
+//   --burst-ms <ms>      Duration of a burst (default 50)
+//   --duration <s>       Stop after this time (default: run until mower_comms disconnects)
+//   --seed <n>           Seed for the error injection
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "ll_datatypes.h"
+#include "ll_protocol.h"
+#include "FrameBuffer.h"
+#include "PseudoTerminal.h"
+
+typedef std::chrono::steady_clock Clock;
+
+// Nominal packet rates of the LL firmware
+const double nominal_status_hz = 10.0;
+const double nominal_imu_hz = 50.0;
+// The LL board raises an emergency, if it doesn't get a heartbeat for this long
+const double heartbeat_timeout_s = 0.5;
+
+struct SimStats {
+    uint64_t status_sent = 0;
+    uint64_t imu_sent = 0;
+    uint64_t imu_batches_sent = 0;
+    uint64_t ui_sent = 0;
+    uint64_t dropped = 0;
+    uint64_t crc_errors = 0;
+    uint64_t truncated = 0;
+    uint64_t bursts = 0;
+    uint64_t tx_bytes = 0;
+    uint64_t heartbeats = 0;
+    uint64_t hl_states = 0;
+    uint64_t hellos = 0;
+    uint64_t rx_errors = 0;
+};
+
+SimStats sim_stats;
+
+// Emergency state of the simulated board
+bool emergency = false;
+bool got_heartbeat = false;
+Clock::time_point last_heartbeat;
+
+// Highest protocol version of the simulated firmware and the one negotiated with mower_comms
+int max_protocol = 2;
+int protocol = 1;
+// Set when a hello was accepted, the main loop answers it
+bool capabilities_pending = false;
+uint16_t requested_imu_hz = 0;
+
+void handleHeartbeat(const ll_heartbeat *heartbeat) {
+    sim_stats.heartbeats++;
+    got_heartbeat = true;
+    last_heartbeat = Clock::now();
+    if (heartbeat->emergency_requested) {
+        emergency = true;
+    } else if (heartbeat->emergency_release_requested) {
+        emergency = false;
+    }
+}
+
+void handleHighLevelState(const ll_high_level_state *) {
+    sim_stats.hl_states++;
+}
+
+void handleHello(const ll_hello *hello) {
+    sim_stats.hellos++;
+    if (max_protocol < 2) {
+        // v1 firmware doesn't know this packet
+        sim_stats.rx_errors++;
+        return;
+    }
+    protocol = std::min<int>(hello->protocol_version, max_protocol);
+    requested_imu_hz = hello->imu_rate_hz;
+    capabilities_pending = true;
+}
+
+constexpr ll::DispatchTable sim_dispatch_table = ll::makeDispatchTable<
+        ll::On<ll_heartbeat, handleHeartbeat>,
+        ll::On<ll_high_level_state, handleHighLevelState>,
+        ll::On<ll_hello, handleHello>
+>();
+
+/**
+ * Encodes the packets and applies the error injection.
+ */
+class FrameWriter {
+public:
+    FrameWriter(int master, double drop_p, double crc_error_p, double truncate_p, double burst_p, double burst_ms,
+                unsigned seed)
+            : master_(master), drop_p_(drop_p), crc_error_p_(crc_error_p), truncate_p_(truncate_p), burst_p_(burst_p),
+              burst_duration_(std::chrono::microseconds(static_cast<int64_t>(burst_ms * 1000.0))), random_(seed) {
+    }
+
+    template<typename Packet>
+    bool send(Packet &packet) {
+        if (chance(drop_p_)) {
+            sim_stats.dropped++;
+            return true;
+        }
+        uint8_t frame[ll::encodedFrameSize<Packet>()];
+        size_t size = ll::encodeFrame(packet, frame, sizeof(frame));
+
+        if (chance(crc_error_p_)) {
+            // Re-encode with a broken CRC, so the COBS framing itself stays valid.
+            packet.crc ^= 0x5a5a;
+            size = COBS::encode(reinterpret_cast<const uint8_t *>(&packet), sizeof(Packet), frame);
+            frame[size++] = 0;
+            sim_stats.crc_errors++;
+        } else if (chance(truncate_p_)) {
+            // Drop some bytes at the end, but keep the delimiter.
+            size_t cut = 1 + random_() % (size - 2);
+            size -= cut;
+            frame[size - 1] = 0;
+            sim_stats.truncated++;
+        }
+
+        pending_.insert(pending_.end(), frame, frame + size);
+        Clock::time_point now = Clock::now();
+        if (!bursting_ && chance(burst_p_)) {
+            bursting_ = true;
+            burst_end_ = now + burst_duration_;
+            sim_stats.bursts++;
+        }
+        return bursting_ ? true : flush();
+    }
+
+    /// \brief Send everything held back, once the burst is over.
+    bool poll() {
+        if (bursting_ && Clock::now() >= burst_end_) {
+            bursting_ = false;
+            return flush();
+        }
+        return true;
+    }
+
+private:
+    bool chance(double p) {
+        return p > 0.0 && std::uniform_real_distribution<double>(0.0, 1.0)(random_) < p;
+    }
+
+    bool flush() {
+        if (pending_.empty()) {
+            return true;
+        }
+        bool result = pty::writeAll(master_, pending_.data(), pending_.size());
+        sim_stats.tx_bytes += pending_.size();
+        pending_.clear();
+        return result;
+    }
+
+    int master_;
+    double drop_p_, crc_error_p_, truncate_p_, burst_p_;
+    Clock::duration burst_duration_;
+    std::mt19937 random_;
+    std::vector<uint8_t> pending_;
+    bool bursting_ = false;
+    Clock::time_point burst_end_;
+};
+
+/**
+ * A packet stream with a fixed rate.
+ */
+struct Stream {
+    Clock::duration period;
+    Clock::time_point next;
+
+    Stream(double hz, Clock::time_point start) : period(periodFor(hz)), next(start) {
+    }
+
+    bool enabled() const {
+        return period != Clock::duration::max();
+    }
+
+    /// \returns true, if a packet is due. Catches up, if we fell behind.
+    bool due(Clock::time_point now) {
+        if (!enabled() || now < next) {
+            return false;
+        }
+        next += period;
+        return true;
+    }
+
+    static Clock::duration periodFor(double hz) {
+        if (hz <= 0.0) {
+            return Clock::duration::max();
+        }
+        return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / hz));
+    }
+};
+
+int main(int argc, char **argv) {
+    std::string link_path;
+    double scale = 1.0;
+    double status_hz = nominal_status_hz, imu_hz = nominal_imu_hz, ui_hz = 0.0;
+    double drop_p = 0.0, crc_error_p = 0.0, truncate_p = 0.0, burst_p = 0.0, burst_ms = 50.0;
+    double duration = 0.0;
+    unsigned seed = 42;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            fprintf(stderr, "Missing value for %s\n", arg.c_str());
+            return 1;
+        }
+        const char *value = argv[++i];
+        if (arg == "--link") {
+            link_path = value;
+        } else if (arg == "--scale") {
+            scale = atof(value);
+        } else if (arg == "--status-hz") {
+            status_hz = atof(value);
+        } else if (arg == "--imu-hz") {
+            imu_hz = atof(value);
+        } else if (arg == "--ui-hz") {
+            ui_hz = atof(value);
+        } else if (arg == "--protocol") {
+            max_protocol = atoi(value);
+        } else if (arg == "--drop") {
+            drop_p = atof(value);
+        } else if (arg == "--crc-errors") {
+            crc_error_p = atof(value);
+        } else if (arg == "--truncate") {
+            truncate_p = atof(value);
+        } else if (arg == "--bursts") {
+            burst_p = atof(value);
+        } else if (arg == "--burst-ms") {
+            burst_ms = atof(value);
+        } else if (arg == "--duration") {
+            duration = atof(value);
+        } else if (arg == "--seed") {
+            seed = static_cast<unsigned>(atoi(value));
+        } else {
+            fprintf(stderr, "Unknown argument: %s\n", arg.c_str());
+            return 1;
+        }
+    }
+
+    std::string slave_name;
+    int master = pty::openRaw(slave_name);
+    if (master < 0) {
+        perror("Error opening pseudo terminal");
+        return 1;
+    }
+    if (!link_path.empty()) {
+        unlink(link_path.c_str());
+        if (symlink(slave_name.c_str(), link_path.c_str()) != 0) {
+            perror("Error creating link");
+            return 1;
+        }
+    }
+    printf("Simulating the low level board on %s\n", link_path.empty() ? slave_name.c_str() : link_path.c_str());
+    printf("Rates: status %.1f Hz, IMU %.1f Hz, UI %.1f Hz\n", status_hz * scale, imu_hz * scale, ui_hz * scale);
+    printf("Waiting for mower_comms to connect...\n");
+    fflush(stdout);
+
+    uint8_t buffer[1024];
+    while (pty::read(master, buffer, sizeof(buffer), 10) < 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    FrameWriter writer(master, drop_p, crc_error_p, truncate_p, burst_p, burst_ms, seed);
+    FrameBuffer<1024> rx_buffer;
+    std::mt19937 noise_random(seed + 1);
+    std::normal_distribution<float> noise(0.0f, 0.01f);
+
+    Clock::time_point start = Clock::now();
+    Stream status_stream(status_hz * scale, start);
+    Stream imu_stream(imu_hz * scale, start);
+    Stream ui_stream(ui_hz * scale, start);
+    Stream report_stream(1.0, start + std::chrono::seconds(1));
+    SimStats last_stats;
+    uint16_t imu_dt_millis = imu_stream.enabled() ? static_cast<uint16_t>(std::lround(1000.0 / (imu_hz * scale))) : 0;
+    ll_imu_batch imu_batch = {};
+    uint8_t imu_batch_samples = 0;
+
+    bool connected = true;
+    while (connected) {
+        Clock::time_point now = Clock::now();
+        if (duration > 0.0 && now - start > std::chrono::duration<double>(duration)) {
+            break;
+        }
+
+        if (got_heartbeat && std::chrono::duration<double>(now - last_heartbeat).count() > heartbeat_timeout_s) {
+            emergency = true;
+        }
+
+        bool ok = true;
+        while (ok && status_stream.due(now)) {
+            ll_status status = {};
+            // Initialized, Raspberry, GPS and ESC power on
+            status.status_bitmask = got_heartbeat ? 0b00001111 : 0b00001110;
+            status.emergency_bitmask = emergency ? 1 : 0;
+            status.v_system = 28.5f;
+            status.v_charge = 0.0f;
+            status.charging_current = 0.0f;
+            status.batt_percentage = 80;
+            ok = writer.send(status);
+            sim_stats.status_sent++;
+        }
+        if (ok && capabilities_pending) {
+            capabilities_pending = false;
+            if (requested_imu_hz > 0) {
+                imu_hz = requested_imu_hz;
+                imu_stream = Stream(imu_hz * scale, now);
+            }
+            ll_capabilities capabilities = {};
+            capabilities.protocol_version = protocol;
+            capabilities.imu_rate_hz = static_cast<uint16_t>(imu_hz);
+            imu_batch_samples = 0;
+            ok = writer.send(capabilities);
+            printf("Negotiated protocol v%d, IMU at %.1f Hz\n", protocol, imu_hz * scale);
+        }
+        while (ok && imu_stream.due(now)) {
+            ll_imu_sample sample = {};
+            sample.acceleration_mss[0] = noise(noise_random);
+            sample.acceleration_mss[1] = noise(noise_random);
+            sample.acceleration_mss[2] = 9.81f + noise(noise_random);
+            for (int i = 0; i < 3; i++) {
+                sample.gyro_rads[i] = noise(noise_random);
+            }
+            sim_stats.imu_sent++;
+
+            if (protocol < 2) {
+                ll_imu imu = {};
+                imu.dt_millis = imu_dt_millis;
+                memcpy(imu.acceleration_mss, sample.acceleration_mss, sizeof(imu.acceleration_mss));
+                memcpy(imu.gyro_rads, sample.gyro_rads, sizeof(imu.gyro_rads));
+                imu.mag_uT[0] = 20.0f;
+                imu.mag_uT[2] = -40.0f;
+                ok = writer.send(imu);
+                continue;
+            }
+
+            if (imu_batch_samples == 0) {
+                // LL time of the first sample is the time it was due
+                auto due = imu_stream.next - imu_stream.period - start;
+                imu_batch.base_time_micros = static_cast<uint32_t>(
+                        std::chrono::duration_cast<std::chrono::microseconds>(due).count());
+                imu_batch.sample_period_micros = static_cast<uint16_t>(
+                        std::chrono::duration_cast<std::chrono::microseconds>(imu_stream.period).count());
+            }
+            imu_batch.samples[imu_batch_samples++] = sample;
+            if (imu_batch_samples == LL_IMU_BATCH_SAMPLES) {
+                imu_batch.mag_uT[0] = 20.0f;
+                imu_batch.mag_uT[2] = -40.0f;
+                ok = writer.send(imu_batch);
+                // Dropped frames still use up a sequence number
+                imu_batch.seq++;
+                imu_batch_samples = 0;
+                sim_stats.imu_batches_sent++;
+            }
+        }
+        while (ok && ui_stream.due(now)) {
+            // Button 1 has no action in mower_comms, so this doesn't trigger high level commands.
+            ll_ui_event ui_event = {};
+            ui_event.button_id = 1;
+            ok = writer.send(ui_event);
+            sim_stats.ui_sent++;
+        }
+        if (!ok || !writer.poll()) {
+            perror("Error writing to pseudo terminal");
+            break;
+        }
+
+        if (report_stream.due(now)) {
+            SimStats &s = sim_stats;
+            printf("TX %.0f bytes/s, status %" PRIu64 ", IMU %" PRIu64 " (%" PRIu64 " batches), UI %" PRIu64
+                   " | injected drops %" PRIu64 ", CRC %" PRIu64 ", truncated %" PRIu64 ", bursts %" PRIu64
+                   " | RX heartbeats %" PRIu64 ", HL states %" PRIu64 ", hellos %" PRIu64 ", errors %" PRIu64 "%s\n",
+                   static_cast<double>(s.tx_bytes - last_stats.tx_bytes),
+                   s.status_sent - last_stats.status_sent, s.imu_sent - last_stats.imu_sent,
+                   s.imu_batches_sent - last_stats.imu_batches_sent, s.ui_sent - last_stats.ui_sent,
+                   s.dropped, s.crc_errors, s.truncated, s.bursts,
+                   s.heartbeats - last_stats.heartbeats, s.hl_states - last_stats.hl_states, s.hellos, s.rx_errors,
+                   emergency ? ", EMERGENCY" : "");
+            fflush(stdout);
+            last_stats = s;
+        }
+
+        // Wait for the next packet and handle whatever mower_comms sends in the meantime.
+        Clock::time_point next = report_stream.next;
+        for (const Stream *stream: {&status_stream, &imu_stream, &ui_stream}) {
+            if (stream->enabled() && stream->next < next) {
+                next = stream->next;
+            }
+        }
+        Clock::time_point now_rx;
+        while ((now_rx = Clock::now()) < next) {
+            auto wait = std::chrono::duration_cast<std::chrono::microseconds>(next - now_rx).count();
+            ssize_t result = pty::read(master, rx_buffer.writePtr(), rx_buffer.writeSpace(),
+                                       static_cast<int>((wait + 999) / 1000));
+            if (result < 0) {
+                printf("mower_comms disconnected\n");
+                connected = false;
+                break;
+            }
+            rx_buffer.commit(result);
+            const uint8_t *frame;
+            size_t frame_size;
+            while (rx_buffer.nextFrame(frame, frame_size)) {
+                uint8_t packet[256];
+                size_t packet_size = 0;
+                ll::Result decoded = ll::decodeFrame(frame, frame_size, packet, packet_size);
+                if (decoded == ll::Result::OK) {
+                    decoded = ll::dispatch(sim_dispatch_table, packet, packet_size);
+                }
+                if (decoded != ll::Result::OK && decoded != ll::Result::EMPTY) {
+                    sim_stats.rx_errors++;
+                }
+            }
+        }
+    }
+
+    if (!link_path.empty()) {
+        unlink(link_path.c_str());
+    }
+    close(master);
+    return 0;
+}
@@ -17,72 +17,224 @@
 //
 #include "ros/ros.h"
 
-#include "boost/crc.hpp"
 #include "std_msgs/Empty.h"
 #include <mower_msgs/Status.h>
 #include <geometry_msgs/Twist.h>
 #include <sensor_msgs/Joy.h>
 #include <serial/serial.h>
 #include "ll_datatypes.h"
-#include "COBS.h"
+#include "ll_protocol.h"
+#include "FrameBuffer.h"
+#include "SpscQueue.h"
+#include "LinkStats.h"
+#include "ActuationTrace.h"
+#include "LLCapture.h"
+#include "ImuClockSync.h"
+#include "GyroBiasEstimator.h"
+#include "HazardDetector.h"
+#include "WheelSpeedController.h"
+#include "WheelTickFilter.h"
+#include "EscBackend.h"
+#include "SeqLock.h"
+#include "SerialReconnect.h"
 #include "std_msgs/Bool.h"
 #include "mower_msgs/MowerControlSrv.h"
 #include "mower_msgs/EmergencyStopSrv.h"
 #include "mower_msgs/ImuRaw.h"
 #include "mower_msgs/HighLevelControlSrv.h"
+#include "mower_msgs/GetGyroBiasSrv.h"
+#include "mower_msgs/DumpLatencySrv.h"
 #include "sensor_msgs/Imu.h"
 #include "sensor_msgs/MagneticField.h"
 
-#include <xesc_driver/xesc_driver.h>
 #include <xesc_msgs/XescStateStamped.h>
 #include <xbot_msgs/WheelTick.h>
+#include "mower_msgs/WheelTicks.h"
 #include "mower_msgs/HighLevelStatus.h"
+#include "diagnostic_msgs/DiagnosticArray.h"
+#include "xbot_msgs/SensorInfo.h"
+#include "xbot_msgs/SensorDataDouble.h"
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <thread>
+#include <pthread.h>
 
 ros::Publisher status_pub;
 ros::Publisher wheel_tick_pub;
+ros::Publisher drive_ticks_pub;
 
 ros::Publisher sensor_imu_pub;
+ros::Publisher sensor_imu_corrected_pub;
 ros::Publisher sensor_mag_pub;
 
-COBS cobs;
+ros::Publisher diagnostics_pub;
+ros::Publisher si_ll_rx_rate_pub;
+ros::Publisher ll_rx_rate_data_pub;
+ros::Publisher si_ll_error_rate_pub;
+ros::Publisher ll_error_rate_data_pub;
 
 
 // True, if ROS thinks there sould be an emergency
-bool emergency_high_level = false;
+std::atomic<bool> emergency_high_level{false};
 // True, if the LL board thinks there should be an emergency
-bool emergency_low_level = false;
+std::atomic<bool> emergency_low_level{false};
 
 // True, if the LL emergency should be cleared in the next request
-bool ll_clear_emergency = false;
+std::atomic<bool> ll_clear_emergency{false};
 
 // True, if we can send to the low level board
-bool allow_send = false;
+std::atomic<bool> allow_send{false};
+
+enum LinkState : uint8_t {
+    LINK_DISCONNECTED = 0,
+    // Port is open, but the board didn't send a status yet (e.g. still booting after the port reset it)
+    LINK_WAITING_FOR_BOARD = 1,
+    LINK_CONNECTED = 2
+};
+// Written by the serial thread
+std::atomic<uint8_t> link_state{LINK_DISCONNECTED};
 
 // Current speeds (duty cycle) for the three ESCs
 float speed_l = 0, speed_r = 0, speed_mow = 0;
 
+// If true, cmd_vel is converted to wheel speeds in m/s, which are held by a PI loop on the ESC tacho.
+// Otherwise it is mapped to the duty cycle directly. The controllers are only used by the spinner thread.
+bool speed_control = false;
+double target_speed_l = 0, target_speed_r = 0;
+WheelSpeedController left_speed_controller, right_speed_controller;
+
+// Wheel speeds from the drive ESC ticks. Only used by the ESC poller thread.
+WheelTickFilter left_tick_filter, right_tick_filter;
+mower_msgs::WheelTicks drive_ticks_msg;
+// Set when a drive ESC sent a new state that is not in a mower/wheel_ticks message yet
+bool left_wheel_tick_pending = false, right_wheel_tick_pending = false;
+
 // Ticks / m and wheel distance for this robot
 double wheel_ticks_per_m = 0.0;
 double wheel_distance_m = 0.0;
 
-// Serial port and buffer for the low level connection
+// A decoded and CRC checked packet from the low level board
+struct ll_packet {
+    // Monotonic time when the frame was received
+    uint64_t rx_time_ns;
+    uint16_t size;
+    uint8_t data[256];
+};
+
+// All COBS encoded frames for one control tick, ready to be written to the low level board at once
+typedef ll::FrameBatch<256> ll_frame_batch;
+
+// Baud rate of the low level link and the resulting number of bytes we can send per second (8N1)
+const uint32_t ll_baudrate = 115200;
+const double ll_bytes_per_second = ll_baudrate / 10.0;
+// Period of the control tick (heartbeat)
+const double control_tick_s = 0.02;
+// Reconnect delays, doubled after every failed attempt
+const double reconnect_delay_min_s = 0.1;
+const double reconnect_delay_max_s = 5.0;
+// If the board doesn't send a status after opening the port, start sending anyway after this time
+const double board_ready_timeout_s = 5.0;
+
+// The serial port is owned by the serial thread. It is the only thread reading and writing the port.
+// Decoded packets are passed to the main thread in rx_queue, frame batches to send are passed from the
+// ROS spinner thread in tx_queue. Since we only have one spinner thread, all ROS callbacks are the single producer.
 serial::Serial serial_port;
-uint8_t out_buf[1000];
-ros::Time last_cmd_vel(0.0);
+std::thread serial_thread;
+SpscQueue<ll_packet, 64> rx_queue;
+// The frames of one control tick and the stamps to trace it until it was written
+struct ll_tx_tick {
+    ll_frame_batch batch;
+    // When the duty cycles of the tick were applied
+    uint64_t applied_ns;
+    // roscpp receipt of the cmd_vel applied with this tick, 0 if there was no new one
+    uint64_t cmd_receipt_ns;
+};
+SpscQueue<ll_tx_tick, 16> tx_queue;
+// Used to wake up the main thread when rx_queue is not empty anymore
+std::mutex rx_queue_mutex;
+std::condition_variable rx_queue_cv;
+
+// The latest high level state, it is sent with the next control tick. Only used by the spinner thread.
+struct ll_high_level_state pending_hl_state;
+bool hl_state_pending = false;
+
+LinkStats link_stats;
+ActuationStats actuation_stats;
+
+// The latest cmd_vel which no control tick applied yet. Only used by the spinner thread.
+ActuationTrace pending_cmd_trace;
+
+// Receive time of the packet currently being dispatched. Only used by the main thread.
+uint64_t current_packet_rx_time_ns = 0;
+
+// Reconstructs the IMU sample times from dt_millis. Only used by the main thread, the stats are copied for the publisher.
+ImuClockSync imu_clock_sync;
+std::mutex imu_clock_stats_mutex;
+ImuClockSync::Stats imu_clock_stats;
+
+// Gyro bias from the samples where the mower stands still. Only used by the main thread, the estimate is copied for the service.
+GyroBiasEstimator gyro_bias_estimator;
+std::mutex gyro_bias_mutex;
+GyroBiasEstimator::Estimate gyro_bias_estimate;
+// Last cmd_vel which wasn't zero. The mower counts as moving for a while after it.
+std::atomic<uint64_t> last_motion_command_ns{0};
+const double motion_settle_s = 1.0;
+// Optional tilt and lift detection on the IMU samples. Only used by the main thread, the stats are copied for the publisher.
+bool hazard_detection = false;
+HazardDetector hazard_detector;
+std::mutex hazard_stats_mutex;
+HazardDetector::Stats hazard_stats;
+// Drive tacho at the last IMU sample, to see if the wheels turn. Only used by the main thread.
+int32_t last_imu_tacho_l = 0, last_imu_tacho_r = 0;
+
+// Protocol version used with the LL board. Starts at 1 on every connect, set to 2 by the capabilities answer.
+std::atomic<uint8_t> ll_protocol_version{1};
+// Requested IMU rate for protocol v2, 0 for the firmware default
+uint16_t imu_rate_hz = 0;
+// Hellos sent since the last connect. Only used by the spinner thread.
+const double hello_period_s = 1.0;
+const int max_hello_attempts = 5;
+int hello_attempts = 0;
+uint64_t hello_connects = 0;
+ros::Time last_hello(0.0);
+// Sequence number and last sample time of the last IMU batch. Only valid, if there was one since the capabilities.
+// Only used by the main thread.
+bool have_imu_batch = false;
+uint8_t last_imu_batch_seq = 0;
+uint32_t last_imu_batch_time_micros = 0;
 
-boost::crc_ccitt_type crc;
+ros::Time last_cmd_vel(0.0);
 
 mower_msgs::HighLevelStatus last_high_level_status;
 
-xesc_driver::XescDriver *mow_xesc_interface;
-xesc_driver::XescDriver *left_xesc_interface;
-xesc_driver::XescDriver *right_xesc_interface;
+EscBackend *mow_xesc_interface;
+EscBackend *left_xesc_interface;
+EscBackend *right_xesc_interface;
+
+// Latest ESC states, written by the ESC poller thread. Reading them never blocks and never takes a driver mutex.
+SeqLock<EscSnapshot> mow_esc_snapshot, left_esc_snapshot, right_esc_snapshot;
+static_assert(sizeof(SeqLock<EscSnapshot>) == 64, "An ESC snapshot should fit into one cache line");
+std::thread esc_poller_thread;
+// The ESCs send their state at 100Hz, so we poll twice as fast
+const double esc_poll_period_s = 0.005;
+
+// mower/status is published with every LL status. If there was none for this long, it is published
+// anyway, so the ESC values stay fresh while the LL board is silent.
+const double status_keepalive_s = 0.1;
+std::atomic<uint64_t> last_status_publish_ns{0};
+
+// Serializes the duty cycle updates from the control tick and the emergency fast path
+std::mutex esc_mutex;
 
 std::mutex ll_status_mutex;
 struct ll_status last_ll_status = {0};
 
 sensor_msgs::MagneticField sensor_mag_msg;
 sensor_msgs::Imu sensor_imu_msg;
+// Messages for the samples of a v2 IMU batch, allocated once
+std::array<sensor_msgs::Imu, LL_IMU_BATCH_SAMPLES> sensor_imu_batch_msgs;
 
 ros::ServiceClient highLevelClient;
 
@@ -91,17 +243,62 @@ bool is_emergency() {
     return emergency_high_level || emergency_low_level;
 }
 
-void publishActuators() {
-// emergency or timeout -> send 0 speeds
-    if (is_emergency()) {
-        speed_l = 0;
-        speed_r = 0;
-        speed_mow = 0;
+/**
+ * Queue all frames of a control tick for the serial thread, which writes them with a single call.
+ * Must only be called from the ROS spinner thread.
+ */
+void sendBatch(const ll_frame_batch &batch, uint64_t applied_ns, uint64_t cmd_receipt_ns) {
+    if (!allow_send || batch.size == 0) {
+        return;
     }
+
+    // Check the bytes for this tick against what the link can transfer in one tick.
+    static const size_t tick_budget = static_cast<size_t>(ll_bytes_per_second * control_tick_s);
+    if (batch.size > tick_budget) {
+        link_stats.tx_budget_exceeded.add();
+        ROS_WARN_STREAM_THROTTLE(10, "Low level TX batch of " << batch.size << " bytes exceeds the budget of "
+                                                              << tick_budget << " bytes per tick");
+    }
+    link_stats.recordTxBatch(batch.size);
+
+    if (!tx_queue.push(ll_tx_tick{batch, applied_ns, cmd_receipt_ns})) {
+        link_stats.tx_queue_drops.add();
+    }
+}
+
+/**
+ * True, if a hello should be sent with this control tick. Starts over after every connect
+ * and gives up after a few attempts, then we stay on protocol v1. Spinner thread only.
+ */
+bool needsHello() {
+    uint64_t connects = link_stats.connects.get();
+    if (connects != hello_connects) {
+        hello_connects = connects;
+        hello_attempts = 0;
+        last_hello = ros::Time(0.0);
+    }
+    if (link_state != LINK_CONNECTED || ll_protocol_version >= LL_PROTOCOL_VERSION ||
+        hello_attempts >= max_hello_attempts) {
+        return false;
+    }
+    ros::Time now = ros::Time::now();
+    if (now - last_hello < ros::Duration(hello_period_s)) {
+        return false;
+    }
+    last_hello = now;
+    if (++hello_attempts == max_hello_attempts) {
+        ROS_WARN_STREAM("Low level board didn't answer the hello, using protocol v1");
+    }
+    return true;
+}
+
+void publishActuators() {
+// timeout -> send 0 speeds
     if (ros::Time::now() - last_cmd_vel > ros::Duration(1.0)) {
         speed_l = 0;
         speed_r = 0;
-
+        target_speed_l = 0;
+        target_speed_r = 0;
     }
     if (ros::Time::now() - last_cmd_vel > ros::Duration(25.0)) {
         speed_l = 0;
@@ -109,12 +306,42 @@ void publishActuators() {
         speed_mow = 0;
     }
 
-    if(mow_xesc_interface) {
-        mow_xesc_interface->setDutyCycle(speed_mow);
+    if (speed_control) {
+        // The ESC state is stamped when it is received, so the controller only sees new tacho values.
+        EscSnapshot left_status = left_esc_snapshot.load();
+        EscSnapshot right_status = right_esc_snapshot.load();
+        // The right motor runs in the "wrong" direction, see below
+        left_speed_controller.updateMeasurement(left_status.tacho, left_status.stamp_ns * 1e-9, wheel_ticks_per_m);
+        right_speed_controller.updateMeasurement(-right_status.tacho, right_status.stamp_ns * 1e-9, wheel_ticks_per_m);
+        bool stop = is_emergency();
+        speed_l = left_speed_controller.update(stop ? 0.0 : target_speed_l, control_tick_s);
+        speed_r = right_speed_controller.update(stop ? 0.0 : target_speed_r, control_tick_s);
+    }
+
+    uint64_t apply_start_ns = monotonicNanos();
+    {
+        // emergency -> send 0 speeds. Checked under the lock, so we never overwrite the emergency fast path.
+        std::unique_lock<std::mutex> lk(esc_mutex);
+        if (is_emergency()) {
+            speed_l = 0;
+            speed_r = 0;
+            speed_mow = 0;
+        }
+        if (mow_xesc_interface) {
+            mow_xesc_interface->setDutyCycle(speed_mow);
+        }
+        // We need to invert the speed, because the ESC has the same config as the left one, so the motor is running in the "wrong" direction
+        left_xesc_interface->setDutyCycle(speed_l);
+        right_xesc_interface->setDutyCycle(-speed_r);
+    }
+    uint64_t applied_ns = monotonicNanos();
+    actuation_stats.duty_apply.record(applied_ns - apply_start_ns);
+
+    uint64_t cmd_receipt_ns = pending_cmd_trace.receipt_ns;
+    if (pending_cmd_trace.callback_ns != 0) {
+        actuation_stats.callback_to_applied.record(applied_ns - pending_cmd_trace.callback_ns);
+        pending_cmd_trace = ActuationTrace();
     }
-    // We need to invert the speed, because the ESC has the same config as the left one, so the motor is running in the "wrong" direction
-    left_xesc_interface->setDutyCycle(speed_l);
-    right_xesc_interface->setDutyCycle(-speed_r);
 
     struct ll_heartbeat heartbeat = {
             .type = PACKET_ID_LL_HEARTBEAT,
@@ -123,49 +350,139 @@ void publishActuators() {
             .emergency_release_requested = ll_clear_emergency
     };
 
-
-    crc.reset();
-    crc.process_bytes(&heartbeat, sizeof(struct ll_heartbeat) - 2);
-    heartbeat.crc = crc.checksum();
-
-    size_t encoded_size = cobs.encode((uint8_t *) &heartbeat, sizeof(struct ll_heartbeat), out_buf);
-    out_buf[encoded_size] = 0;
-    encoded_size++;
-
-    if (serial_port.isOpen() && allow_send) {
-        try {
-            serial_port.write(out_buf, encoded_size);
-        } catch (std::exception &e) {
-            ROS_ERROR_STREAM("Error writing to serial port");
-        }
+    ll_frame_batch batch;
+    batch.add(heartbeat);
+    if (hl_state_pending) {
+        batch.add(pending_hl_state);
+        hl_state_pending = false;
+    }
+    if (needsHello()) {
+        struct ll_hello hello = {
+                .type = PACKET_ID_LL_HELLO,
+                .protocol_version = LL_PROTOCOL_VERSION,
+                .imu_rate_hz = imu_rate_hz
+        };
+        batch.add(hello);
     }
+    sendBatch(batch, applied_ns, cmd_receipt_ns);
 }
 
 
-void convertStatus(xesc_msgs::XescStateStamped &vesc_status, mower_msgs::ESCStatus &ros_esc_status) {
-    if (vesc_status.state.connection_state != xesc_msgs::XescState::XESC_CONNECTION_STATE_CONNECTED &&
-            vesc_status.state.connection_state != xesc_msgs::XescState::XESC_CONNECTION_STATE_CONNECTED_INCOMPATIBLE_FW) {
+bool isConnected(const EscSnapshot &status) {
+    return status.connection_state == xesc_msgs::XescState::XESC_CONNECTION_STATE_CONNECTED ||
+           status.connection_state == xesc_msgs::XescState::XESC_CONNECTION_STATE_CONNECTED_INCOMPATIBLE_FW;
+}
+
+void convertStatus(const EscSnapshot &vesc_status, mower_msgs::ESCStatus &ros_esc_status) {
+    if (!isConnected(vesc_status)) {
         // ESC is disconnected
         ros_esc_status.status = mower_msgs::ESCStatus::ESC_STATUS_DISCONNECTED;
-    } else if(vesc_status.state.fault_code) {
-        ROS_ERROR_STREAM_THROTTLE(1, "Motor controller fault code: " << vesc_status.state.fault_code);
+    } else if(vesc_status.fault_code) {
+        ROS_ERROR_STREAM_THROTTLE(1, "Motor controller fault code: " << vesc_status.fault_code);
         // ESC has a fault
         ros_esc_status.status = mower_msgs::ESCStatus::ESC_STATUS_ERROR;
     } else {
         // ESC is OK but standing still
         ros_esc_status.status = mower_msgs::ESCStatus::ESC_STATUS_OK;
     }
-    ros_esc_status.tacho = vesc_status.state.tacho;
-    ros_esc_status.current = vesc_status.state.current_input;
-    ros_esc_status.temperature_motor = vesc_status.state.temperature_motor;
-    ros_esc_status.temperature_pcb = vesc_status.state.temperature_pcb;
+    ros_esc_status.tacho = vesc_status.tacho;
+    ros_esc_status.current = vesc_status.current_input;
+    ros_esc_status.temperature_motor = vesc_status.temperature_motor;
+    ros_esc_status.temperature_pcb = vesc_status.temperature_pcb;
+}
+
+/**
+ * Publish the wheel ticks, if one of the drive ESCs sent a new state. The messages are stamped with
+ * the time of the ESC state, not the time we got around to publishing it. ESC poller thread only.
+ *
+ * mower/drive_ticks has a stamp per wheel and goes out for every new state. mower/wheel_ticks has only one
+ * stamp and is differentiated by xbot_positioning, so it waits until both wheels have a new state.
+ */
+void publishWheelTicks(const EscSnapshot &left_status, const EscSnapshot &right_status) {
+    // The right motor runs in the "wrong" direction, see publishActuators()
+    bool left_new = isConnected(left_status) && left_tick_filter.add(left_status.tacho, left_status.stamp_ns);
+    bool right_new = isConnected(right_status) && right_tick_filter.add(-right_status.tacho, right_status.stamp_ns);
+    if (!left_new && !right_new) {
+        return;
+    }
+    ros::Time stamp;
+    stamp.fromNSec(std::max(left_tick_filter.stamp(), right_tick_filter.stamp()));
+
+    drive_ticks_msg.header.stamp = stamp;
+    drive_ticks_msg.header.seq++;
+    drive_ticks_msg.header.frame_id = "base_link";
+    drive_ticks_msg.stamp_left.fromNSec(left_tick_filter.stamp());
+    drive_ticks_msg.stamp_right.fromNSec(right_tick_filter.stamp());
+    drive_ticks_msg.ticks_left = left_tick_filter.ticks();
+    drive_ticks_msg.ticks_right = right_tick_filter.ticks();
+    drive_ticks_msg.ticks_per_m = wheel_ticks_per_m;
+    drive_ticks_msg.velocity_left = wheel_ticks_per_m > 0.0 ? left_tick_filter.velocity() / wheel_ticks_per_m : 0.0;
+    drive_ticks_msg.velocity_right = wheel_ticks_per_m > 0.0 ? right_tick_filter.velocity() / wheel_ticks_per_m : 0.0;
+    drive_ticks_pub.publish(drive_ticks_msg);
+
+    left_wheel_tick_pending |= left_new;
+    right_wheel_tick_pending |= right_new;
+    if (!left_wheel_tick_pending || !right_wheel_tick_pending) {
+        return;
+    }
+    left_wheel_tick_pending = false;
+    right_wheel_tick_pending = false;
+
+    xbot_msgs::WheelTick wheel_tick_msg;
+    wheel_tick_msg.wheel_tick_factor = static_cast<unsigned int>(wheel_ticks_per_m);
+    wheel_tick_msg.stamp = stamp;
+    wheel_tick_msg.wheel_ticks_rl = left_status.tacho_absolute;
+    wheel_tick_msg.wheel_direction_rl = left_status.direction && std::fabs(left_status.duty_cycle) > 0;
+    wheel_tick_msg.wheel_ticks_rr = right_status.tacho_absolute;
+    wheel_tick_msg.wheel_direction_rr = !right_status.direction && std::fabs(right_status.duty_cycle) > 0;
+    wheel_tick_pub.publish(wheel_tick_msg);
+}
+
+/**
+ * Copy the ESC states from the drivers into the snapshots, so nobody else has to call getStatus().
+ */
+void runEscPollerThread() {
+    xesc_msgs::XescStateStamped state;
+    auto period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(esc_poll_period_s));
+    auto next = std::chrono::steady_clock::now();
+    while (ros::ok()) {
+        if (mow_xesc_interface) {
+            mow_xesc_interface->getStatus(state);
+            mow_esc_snapshot.store(makeEscSnapshot(state));
+        }
+        left_xesc_interface->getStatus(state);
+        EscSnapshot left_status = makeEscSnapshot(state);
+        left_esc_snapshot.store(left_status);
+        right_xesc_interface->getStatus(state);
+        EscSnapshot right_status = makeEscSnapshot(state);
+        right_esc_snapshot.store(right_status);
+
+        publishWheelTicks(left_status, right_status);
+
+        next += period;
+        std::this_thread::sleep_until(next);
+    }
 }
 
-void publishStatus() {
+/**
+ * Stop all motors right away, without waiting for the next control tick.
+ * Called from the main thread, when the LL board reports an emergency.
+ */
+void stopMotors() {
+    std::unique_lock<std::mutex> lk(esc_mutex);
+    if (mow_xesc_interface) {
+        mow_xesc_interface->setDutyCycle(0);
+    }
+    left_xesc_interface->setDutyCycle(0);
+    right_xesc_interface->setDutyCycle(0);
+}
+
+void publishStatus(const struct ll_status &ll_state) {
     mower_msgs::Status status_msg;
     status_msg.stamp = ros::Time::now();
 
-    if (last_ll_status.status_bitmask & 1) {
+    if (ll_state.status_bitmask & 1) {
         // LL OK, fill the message
         status_msg.mower_status = mower_msgs::Status::MOWER_STATUS_OK;
     } else {
@@ -173,64 +490,84 @@ void publishStatus() {
         status_msg.mower_status = mower_msgs::Status::MOWER_STATUS_INITIALIZING;
     }
 
-    status_msg.raspberry_pi_power = (last_ll_status.status_bitmask & 0b00000010) != 0;
-    status_msg.gps_power = (last_ll_status.status_bitmask & 0b00000100) != 0;
-    status_msg.esc_power = (last_ll_status.status_bitmask & 0b00001000) != 0;
-    status_msg.rain_detected = (last_ll_status.status_bitmask & 0b00010000) != 0;
-    status_msg.sound_module_available = (last_ll_status.status_bitmask & 0b00100000) != 0;
-    status_msg.sound_module_busy = (last_ll_status.status_bitmask & 0b01000000) != 0;
-    status_msg.ui_board_available = (last_ll_status.status_bitmask & 0b10000000) != 0;
+    status_msg.raspberry_pi_power = (ll_state.status_bitmask & 0b00000010) != 0;
+    status_msg.gps_power = (ll_state.status_bitmask & 0b00000100) != 0;
+    status_msg.esc_power = (ll_state.status_bitmask & 0b00001000) != 0;
+    status_msg.rain_detected = (ll_state.status_bitmask & 0b00010000) != 0;
+    status_msg.sound_module_available = (ll_state.status_bitmask & 0b00100000) != 0;
+    status_msg.sound_module_busy = (ll_state.status_bitmask & 0b01000000) != 0;
+    status_msg.ui_board_available = (ll_state.status_bitmask & 0b10000000) != 0;
 
     for (uint8_t i = 0; i < 5; i++) {
-        status_msg.ultrasonic_ranges[i] = last_ll_status.uss_ranges_m[i];
-    }
-
-    // overwrite emergency with the LL value.
-    emergency_low_level = last_ll_status.emergency_bitmask > 0;
-    if (!emergency_low_level) {
-        // it obviously worked, reset the request
-        ll_clear_emergency = false;
-    } else {
-        ROS_ERROR_STREAM_THROTTLE(1, "Low Level Emergency. Bitmask was: " << (int)last_ll_status.emergency_bitmask);
+        status_msg.ultrasonic_ranges[i] = ll_state.uss_ranges_m[i];
     }
 
     // True, if high or low level emergency condition is present
     status_msg.emergency = is_emergency();
 
-    status_msg.v_battery = last_ll_status.v_system;
-    status_msg.v_charge = last_ll_status.v_charge;
-    status_msg.charge_current = last_ll_status.charging_current;
+    status_msg.v_battery = ll_state.v_system;
+    status_msg.v_charge = ll_state.v_charge;
+    status_msg.charge_current = ll_state.charging_current;
 
 
-    xesc_msgs::XescStateStamped mow_status, left_status, right_status;
-    if(mow_xesc_interface) {
-        mow_xesc_interface->getStatus(mow_status);
-    } else {
-        mow_status.state.connection_state = xesc_msgs::XescState::XESC_CONNECTION_STATE_DISCONNECTED;
-    }
-    left_xesc_interface->getStatus(left_status);
-    right_xesc_interface->getStatus(right_status);
-
-    convertStatus(mow_status, status_msg.mow_esc_status);
-    convertStatus(left_status, status_msg.left_esc_status);
-    convertStatus(right_status, status_msg.right_esc_status);
+    convertStatus(mow_esc_snapshot.load(), status_msg.mow_esc_status);
+    convertStatus(left_esc_snapshot.load(), status_msg.left_esc_status);
+    convertStatus(right_esc_snapshot.load(), status_msg.right_esc_status);
 
     status_pub.publish(status_msg);
-
-    xbot_msgs::WheelTick wheel_tick_msg;
-    wheel_tick_msg.wheel_tick_factor = static_cast<unsigned int>(wheel_ticks_per_m);
-    wheel_tick_msg.stamp = status_msg.stamp;
-    wheel_tick_msg.wheel_ticks_rl = left_status.state.tacho_absolute;
-    wheel_tick_msg.wheel_direction_rl = left_status.state.direction && abs(left_status.state.duty_cycle) > 0;
-    wheel_tick_msg.wheel_ticks_rr = right_status.state.tacho_absolute;
-    wheel_tick_msg.wheel_direction_rr = !right_status.state.direction && abs(right_status.state.duty_cycle) > 0;
-
-    wheel_tick_pub.publish(wheel_tick_msg);
+    last_status_publish_ns = monotonicNanos();
 }
 
 void publishActuatorsTimerTask(const ros::TimerEvent &timer_event) {
     publishActuators();
-    publishStatus();
+}
+
+/**
+ * Publish the status, if the LL board didn't send one for a while. The emergency state is
+ * evaluated when the LL status arrives, see handleLowLevelStatus().
+ */
+void publishEscStatusTimerTask(const ros::TimerEvent &timer_event) {
+    if (monotonicNanos() - last_status_publish_ns < static_cast<uint64_t>(status_keepalive_s * 1e9)) {
+        return;
+    }
+    struct ll_status ll_state;
+    {
+        std::unique_lock<std::mutex> lk(ll_status_mutex);
+        ll_state = last_ll_status;
+    }
+    publishStatus(ll_state);
+}
+
+bool getGyroBias(mower_msgs::GetGyroBiasSrvRequest &req, mower_msgs::GetGyroBiasSrvResponse &res) {
+    GyroBiasEstimator::Estimate estimate;
+    {
+        std::unique_lock<std::mutex> lk(gyro_bias_mutex);
+        estimate = gyro_bias_estimate;
+    }
+    res.bias_x = estimate.bias[0];
+    res.bias_y = estimate.bias[1];
+    res.bias_z = estimate.bias[2];
+    res.stddev = estimate.stddev;
+    res.converged = estimate.converged;
+    res.since_stationary_s = estimate.stationary_blocks > 0 ?
+                             (ros::Time::now().toSec() - estimate.last_stationary_s) : -1.0;
+    return true;
+}
+
+bool dumpLatency(mower_msgs::DumpLatencySrvRequest &req, mower_msgs::DumpLatencySrvResponse &res) {
+    for (size_t i = 0; i < LatencyHistogram::BUCKETS; i++) {
+        res.bucket_limits_ms.push_back((1ULL << i) / 1000.0);
+    }
+    ActuationStats::Stage stages[ActuationStats::STAGES];
+    actuation_stats.stages(stages);
+    for (const auto &stage: stages) {
+        auto snapshot = stage.histogram->snapshot();
+        res.stages.push_back(stage.name);
+        res.counts.insert(res.counts.end(), snapshot.counts, snapshot.counts + LatencyHistogram::BUCKETS);
+        res.dump += describeHistogram(stage.name, snapshot) + "\n";
+    }
+    res.dump += "superseded: " + std::to_string(actuation_stats.superseded.get()) + "\n";
+    return true;
 }
 
 bool setMowEnabled(mower_msgs::MowerControlSrvRequest &req, mower_msgs::MowerControlSrvResponse &res) {
@@ -257,33 +594,49 @@ bool setEmergencyStop(mower_msgs::EmergencyStopSrvRequest &req, mower_msgs::Emer
 }
 
 void highLevelStatusReceived(const mower_msgs::HighLevelStatus::ConstPtr &msg) {
-    struct ll_high_level_state hl_state = {
+    // Sent with the next heartbeat
+    pending_hl_state = {
             .type = PACKET_ID_LL_HIGH_LEVEL_STATE,
             .current_mode = msg->state,
             .gps_quality = static_cast<uint8_t>(msg->gps_quality_percent*100.0)
     };
+    hl_state_pending = true;
+}
 
-
-    crc.reset();
-    crc.process_bytes(&hl_state, sizeof(struct ll_high_level_state) - 2);
-    hl_state.crc = crc.checksum();
-
-    size_t encoded_size = cobs.encode((uint8_t *) &hl_state, sizeof(struct ll_high_level_state), out_buf);
-    out_buf[encoded_size] = 0;
-    encoded_size++;
-
-    if (serial_port.isOpen() && allow_send) {
-        try {
-            serial_port.write(out_buf, encoded_size);
-        } catch (std::exception &e) {
-            ROS_ERROR_STREAM("Error writing to serial port");
-        }
+/**
+ * Start the latency trace of a cmd_vel. Twist has no header, so the trace starts when roscpp received the
+ * message. The receipt time is ROS time, it is moved to the monotonic clock by its age.
+ */
+void traceCmdVel(const ros::Time &receipt_time) {
+    uint64_t callback_ns = monotonicNanos();
+    int64_t age_ns = (ros::Time::now() - receipt_time).toNSec();
+    if (pending_cmd_trace.callback_ns != 0) {
+        actuation_stats.superseded.add();
+    }
+    pending_cmd_trace.callback_ns = callback_ns;
+    // With sim time or a clock jump the age is meaningless, then we only trace from the callback on.
+    if (age_ns >= 0 && age_ns < 1000000000LL) {
+        pending_cmd_trace.receipt_ns = callback_ns - age_ns;
+        actuation_stats.receipt_to_callback.record(age_ns);
+    } else {
+        pending_cmd_trace.receipt_ns = 0;
     }
 }
 
-void velReceived(const geometry_msgs::Twist::ConstPtr &msg) {
-    // TODO: update this to rad/s values and implement xESC speed control
+void velReceived(const ros::MessageEvent<geometry_msgs::Twist const> &event) {
+    traceCmdVel(event.getReceiptTime());
+    const geometry_msgs::Twist::ConstPtr &msg = event.getMessage();
     last_cmd_vel = ros::Time::now();
+    if (msg->linear.x != 0.0 || msg->angular.z != 0.0) {
+        last_motion_command_ns = monotonicNanos();
+    }
+    if (speed_control) {
+        // Wheel speeds in m/s, the duty cycle is calculated with the next control tick
+        target_speed_r = msg->linear.x + 0.5*wheel_distance_m*msg->angular.z;
+        target_speed_l = msg->linear.x - 0.5*wheel_distance_m*msg->angular.z;
+        return;
+    }
+
     speed_r = msg->linear.x + 0.5*wheel_distance_m*msg->angular.z;
     speed_l = msg->linear.x - 0.5*wheel_distance_m*msg->angular.z;
 
@@ -299,7 +652,7 @@ void velReceived(const geometry_msgs::Twist::ConstPtr &msg) {
     }
 }
 
-void handleLowLevelUIEvent(struct ll_ui_event *ui_event) {
+void handleLowLevelUIEvent(const struct ll_ui_event *ui_event) {
     ROS_INFO_STREAM("Got UI button with code:" << +ui_event->button_id << " and duration: " << +ui_event->press_duration);
 
     mower_msgs::HighLevelControlSrv srv;
@@ -343,46 +696,710 @@ void handleLowLevelUIEvent(struct ll_ui_event *ui_event) {
 
 }
 
-void handleLowLevelStatus(struct ll_status *status) {
-    std::unique_lock<std::mutex> lk(ll_status_mutex);
-    last_ll_status = *status;
+void handleLowLevelStatus(const struct ll_status *status) {
+    {
+        std::unique_lock<std::mutex> lk(ll_status_mutex);
+        last_ll_status = *status;
+    }
+
+    // overwrite emergency with the LL value.
+    bool was_emergency = is_emergency();
+    emergency_low_level = status->emergency_bitmask > 0;
+    if (emergency_low_level && !was_emergency) {
+        // Fast path: stop the motors now, the control tick keeps them stopped from now on.
+        stopMotors();
+    }
+    if (!emergency_low_level) {
+        // it obviously worked, reset the request
+        ll_clear_emergency = false;
+    } else {
+        ROS_ERROR_STREAM_THROTTLE(1, "Low Level Emergency. Bitmask was: " << (int)status->emergency_bitmask);
+    }
+
+    // Publish right away instead of waiting for the next tick
+    publishStatus(*status);
+    link_stats.status_latency.record(monotonicNanos() - current_packet_rx_time_ns);
 }
 
-void handleLowLevelIMU(struct ll_imu *imu) {
-    mower_msgs::ImuRaw imu_msg;
-    imu_msg.dt = imu->dt_millis;
-    imu_msg.ax = imu->acceleration_mss[0];
-    imu_msg.ay = imu->acceleration_mss[1];
-    imu_msg.az = imu->acceleration_mss[2];
-    imu_msg.gx = imu->gyro_rads[0];
-    imu_msg.gy = imu->gyro_rads[1];
-    imu_msg.gz = imu->gyro_rads[2];
-    imu_msg.mx = imu->mag_uT[0];
-    imu_msg.my = imu->mag_uT[1];
-    imu_msg.mz = imu->mag_uT[2];
+/**
+ * Map the estimated monotonic sample time of the last sample to ROS time.
+ */
+ros::Time imuSampleTime(uint64_t sample_time_ns) {
+    int64_t sample_age_ns = static_cast<int64_t>(monotonicNanos() - sample_time_ns);
+    {
+        std::unique_lock<std::mutex> lk(imu_clock_stats_mutex);
+        imu_clock_stats = imu_clock_sync.getStats();
+    }
+    return ros::Time::now() - ros::Duration(std::max<int64_t>(sample_age_ns, 0) * 1e-9);
+}
 
+// The packets are packed, so their members are passed by value instead of taking (unaligned) pointers.
+void fillImuMsg(sensor_msgs::Imu &msg, const ros::Time &stamp, const struct ll_imu_sample &sample) {
+    msg.header.stamp = stamp;
+    msg.header.seq = ++sensor_imu_msg.header.seq;
+    msg.header.frame_id = "base_link";
+    msg.linear_acceleration.x = sample.acceleration_mss[0];
+    msg.linear_acceleration.y = sample.acceleration_mss[1];
+    msg.linear_acceleration.z = sample.acceleration_mss[2];
+    msg.angular_velocity.x = sample.gyro_rads[0];
+    msg.angular_velocity.y = sample.gyro_rads[1];
+    msg.angular_velocity.z = sample.gyro_rads[2];
+}
 
-    sensor_mag_msg.header.stamp = ros::Time::now();
+void publishMag(const ros::Time &stamp, float mx, float my, float mz) {
+    sensor_mag_msg.header.stamp = stamp;
     sensor_mag_msg.header.seq++;
     sensor_mag_msg.header.frame_id = "base_link";
-    sensor_mag_msg.magnetic_field.x = imu_msg.mx/1000.0;
-    sensor_mag_msg.magnetic_field.y = imu_msg.my/1000.0;
-    sensor_mag_msg.magnetic_field.z = imu_msg.mz/1000.0;
-
-    sensor_imu_msg.header.stamp = ros::Time::now();
-    sensor_imu_msg.header.seq++;
-    sensor_imu_msg.header.frame_id = "base_link";
-    sensor_imu_msg.linear_acceleration.x = imu_msg.ax;
-    sensor_imu_msg.linear_acceleration.y = imu_msg.ay;
-    sensor_imu_msg.linear_acceleration.z = imu_msg.az;
-    sensor_imu_msg.angular_velocity.x = imu_msg.gx;
-    sensor_imu_msg.angular_velocity.y = imu_msg.gy;
-    sensor_imu_msg.angular_velocity.z = imu_msg.gz;
- 
-    sensor_imu_pub.publish(sensor_imu_msg);
+    sensor_mag_msg.magnetic_field.x = mx/1000.0;
+    sensor_mag_msg.magnetic_field.y = my/1000.0;
+    sensor_mag_msg.magnetic_field.z = mz/1000.0;
     sensor_mag_pub.publish(sensor_mag_msg);
 }
 
+/**
+ * True, if the mower was told to move recently or the wheels turned since the last sample.
+ */
+bool isMoving() {
+    int32_t tacho_l = left_esc_snapshot.load().tacho;
+    int32_t tacho_r = right_esc_snapshot.load().tacho;
+    bool wheels_turning = tacho_l != last_imu_tacho_l || tacho_r != last_imu_tacho_r;
+    last_imu_tacho_l = tacho_l;
+    last_imu_tacho_r = tacho_r;
+    return wheels_turning ||
+           monotonicNanos() - last_motion_command_ns < static_cast<uint64_t>(motion_settle_s * 1e9);
+}
+
+/**
+ * Check an IMU sample for tilt and lift. A hazard takes the same path as a high level emergency:
+ * the motors are stopped right away and the next heartbeat requests the emergency from the LL board.
+ */
+void checkHazards(const double acceleration[3], const ros::Time &stamp, uint64_t sample_time_ns) {
+    HazardDetector::Hazard hazard = hazard_detector.update(stamp.toSec(), acceleration);
+    if (hazard != HazardDetector::NONE) {
+        bool was_emergency = is_emergency();
+        emergency_high_level = true;
+        ll_clear_emergency = false;
+        if (!was_emergency) {
+            stopMotors();
+        }
+        link_stats.hazard_latency.record(monotonicNanos() - sample_time_ns);
+        ROS_ERROR_STREAM("Setting emergency, the mower was " << (hazard == HazardDetector::TILT ? "tilted" : "lifted")
+                                                             << ". Tilt: " << hazard_detector.getStats().tilt_deg << " deg");
+    }
+    std::unique_lock<std::mutex> lk(hazard_stats_mutex);
+    hazard_stats = hazard_detector.getStats();
+}
+
+/**
+ * Publish an IMU sample as it is and without the gyro bias.
+ * @param sample_time_ns Estimated monotonic time of the sample
+ */
+void publishImu(sensor_msgs::Imu &msg, uint64_t sample_time_ns) {
+    double acceleration[3] = {msg.linear_acceleration.x, msg.linear_acceleration.y, msg.linear_acceleration.z};
+    if (hazard_detection) {
+        checkHazards(acceleration, msg.header.stamp, sample_time_ns);
+    }
+
+    sensor_imu_pub.publish(msg);
+
+    double gyro[3] = {msg.angular_velocity.x, msg.angular_velocity.y, msg.angular_velocity.z};
+    if (gyro_bias_estimator.update(msg.header.stamp.toSec(), acceleration, gyro, isMoving())) {
+        std::unique_lock<std::mutex> lk(gyro_bias_mutex);
+        gyro_bias_estimate = gyro_bias_estimator.getEstimate();
+    }
+    gyro_bias_estimator.correct(gyro);
+    msg.angular_velocity.x = gyro[0];
+    msg.angular_velocity.y = gyro[1];
+    msg.angular_velocity.z = gyro[2];
+    sensor_imu_corrected_pub.publish(msg);
+}
+
+void handleLowLevelIMU(const struct ll_imu *imu) {
+    if (ll_protocol_version > 1) {
+        // Board rebooted without us noticing, it starts with v1 again.
+        ROS_WARN_STREAM("Low level board is back on protocol v1");
+        ll_protocol_version = 1;
+    }
+    uint64_t sample_time_ns = imu_clock_sync.update(imu->dt_millis, current_packet_rx_time_ns);
+    ros::Time sample_time = imuSampleTime(sample_time_ns);
+
+    struct ll_imu_sample sample = {
+            {imu->acceleration_mss[0], imu->acceleration_mss[1], imu->acceleration_mss[2]},
+            {imu->gyro_rads[0], imu->gyro_rads[1], imu->gyro_rads[2]}
+    };
+    fillImuMsg(sensor_imu_msg, sample_time, sample);
+    publishImu(sensor_imu_msg, sample_time_ns);
+    publishMag(sample_time, imu->mag_uT[0], imu->mag_uT[1], imu->mag_uT[2]);
+}
+
+void handleLowLevelCapabilities(const struct ll_capabilities *capabilities) {
+    ROS_INFO_STREAM("Low level board uses protocol v" << (int) capabilities->protocol_version << ", IMU at "
+                                                      << capabilities->imu_rate_hz << " Hz");
+    have_imu_batch = false;
+    ll_protocol_version = std::min<uint8_t>(capabilities->protocol_version, LL_PROTOCOL_VERSION);
+}
+
+void handleLowLevelIMUBatch(const struct ll_imu_batch *batch) {
+    if (have_imu_batch) {
+        uint8_t gap = batch->seq - last_imu_batch_seq;
+        // A repeated or older batch would move the IMU clock back, so it is dropped and the sequence stays where it was
+        if (gap == 0 || gap > 128) {
+            link_stats.imu_batches_out_of_order.add();
+            return;
+        }
+        link_stats.imu_batches_lost.add(gap - 1);
+    }
+
+    // The clock sync gets the last sample of each batch, the others are stamped from the sample period.
+    uint32_t last_sample_micros = batch->base_time_micros +
+                                  (LL_IMU_BATCH_SAMPLES - 1) * batch->sample_period_micros;
+    uint32_t dt_micros = have_imu_batch ? last_sample_micros - last_imu_batch_time_micros
+                                        : LL_IMU_BATCH_SAMPLES * batch->sample_period_micros;
+    have_imu_batch = true;
+    last_imu_batch_seq = batch->seq;
+    last_imu_batch_time_micros = last_sample_micros;
+    uint64_t last_sample_time_ns = imu_clock_sync.update(dt_micros * 1e-6, current_packet_rx_time_ns);
+    ros::Time last_sample_time = imuSampleTime(last_sample_time_ns);
+
+    for (size_t i = 0; i < LL_IMU_BATCH_SAMPLES; i++) {
+        uint64_t age_ns = (LL_IMU_BATCH_SAMPLES - 1 - i) * batch->sample_period_micros * 1000ull;
+        fillImuMsg(sensor_imu_batch_msgs[i], last_sample_time - ros::Duration(age_ns * 1e-9), batch->samples[i]);
+        publishImu(sensor_imu_batch_msgs[i], last_sample_time_ns - age_ns);
+    }
+    publishMag(last_sample_time, batch->mag_uT[0], batch->mag_uT[1], batch->mag_uT[2]);
+}
+
+
+// Handlers for all packets we can receive from the low level board
+constexpr ll::DispatchTable ll_dispatch_table = ll::makeDispatchTable<
+        ll::On<ll_status, handleLowLevelStatus>,
+        ll::On<ll_imu, handleLowLevelIMU>,
+        ll::On<ll_ui_event, handleLowLevelUIEvent>,
+        ll::On<ll_capabilities, handleLowLevelCapabilities>,
+        ll::On<ll_imu_batch, handleLowLevelIMUBatch>
+>();
+
+void handleLowLevelPacket(const ll_packet &packet) {
+    current_packet_rx_time_ns = packet.rx_time_ns;
+    switch (ll::dispatch(ll_dispatch_table, packet.data, packet.size)) {
+        case ll::Result::OK:
+            link_stats.recordPacket(packet.data[0], packet.rx_time_ns);
+            break;
+        case ll::Result::WRONG_SIZE:
+            link_stats.wrong_size.add();
+            break;
+        default:
+            link_stats.unknown_type.add();
+            break;
+    }
+}
+
+/**
+ * Decode a received frame, check the CRC and pass it to the main thread.
+ * Called from the serial thread.
+ * @return the packet type, 0 if the frame was invalid
+ */
+uint8_t receiveLowLevelFrame(const uint8_t *frame, size_t size, uint64_t rx_time_ns) {
+    ll_packet packet;
+    size_t data_size = 0;
+    link_stats.rx_frames.add();
+    switch (ll::decodeFrame(frame, size, packet.data, data_size)) {
+        case ll::Result::OK:
+            break;
+        case ll::Result::EMPTY:
+            link_stats.empty_frames.add();
+            return 0;
+        case ll::Result::CRC_ERROR:
+            link_stats.crc_errors.add();
+            return 0;
+        case ll::Result::TOO_LARGE:
+            link_stats.oversized_frames.add();
+            return 0;
+        default:
+            // Broken COBS data or not even type + crc (3 bytes)
+            link_stats.decode_errors.add();
+            return 0;
+    }
+
+    packet.rx_time_ns = rx_time_ns;
+    packet.size = data_size;
+    if (!rx_queue.push(packet)) {
+        link_stats.rx_queue_drops.add();
+        return 0;
+    }
+    {
+        // Take the lock, so that the notification can't get lost between the main thread's check and wait.
+        std::lock_guard<std::mutex> lk(rx_queue_mutex);
+    }
+    rx_queue_cv.notify_one();
+    return packet.data[0];
+}
+
+/**
+ * The serial thread owns the low level serial port. It (re)connects, reads and decodes frames
+ * and writes all frames queued by the ROS callbacks.
+ *
+ * @param port_name the serial port to use
+ * @param cpu pin the thread to this cpu, -1 to let the scheduler decide
+ * @param priority SCHED_FIFO priority for the thread, 0 to keep the default scheduling
+ * @param capture_file if not empty, all raw bytes are recorded to this file (see ll_replay)
+ * @param watch_device if true, reconnect as soon as the device node shows up instead of waiting for the next retry
+ */
+void runSerialThread(const std::string &port_name, int cpu, int priority, const std::string &capture_file,
+                     bool watch_device) {
+    if (cpu >= 0) {
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        CPU_SET(cpu, &cpu_set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) != 0) {
+            ROS_WARN_STREAM("Could not pin serial thread to CPU " << cpu);
+        }
+    }
+    if (priority > 0) {
+        sched_param param = {};
+        param.sched_priority = priority;
+        if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0) {
+            ROS_WARN_STREAM("Could not set serial thread priority to " << priority);
+        }
+    }
+
+    // Receive buffer for the low level connection
+    FrameBuffer<1000> rx_buffer;
+
+    ll_capture::Writer capture;
+    if (!capture_file.empty()) {
+        if (capture.open(capture_file)) {
+            ROS_INFO_STREAM("Capturing low level link to " << capture_file);
+        } else {
+            ROS_ERROR_STREAM("Could not open capture file " << capture_file);
+        }
+    }
+    Backoff backoff(reconnect_delay_min_s, reconnect_delay_max_s);
+    DeviceWatcher device_watcher;
+    if (watch_device && !device_watcher.watch(port_name)) {
+        ROS_WARN_STREAM("Could not watch " << port_name << ", reconnecting with retries only");
+    }
+    // When we lost the link (or started) and when the port was opened
+    uint64_t link_lost_ns = monotonicNanos();
+    uint64_t port_opened_ns = 0;
+
+    auto disconnect = [&]() {
+        allow_send = false;
+        link_state = LINK_DISCONNECTED;
+        // The board might have been replaced or reflashed, negotiate again.
+        ll_protocol_version = 1;
+        serial_port.close();
+        link_lost_ns = monotonicNanos();
+    };
+    auto board_ready = [&]() {
+        uint64_t now = monotonicNanos();
+        link_stats.connects.add();
+        link_stats.connect_time.record(now - link_lost_ns);
+        ROS_INFO_STREAM("Low level board ready after " << (now - link_lost_ns) / 1000000 << " ms");
+        backoff.reset();
+        link_state = LINK_CONNECTED;
+        allow_send = true;
+    };
+
+    while (ros::ok()) {
+        if (!serial_port.isOpen()) {
+            ROS_INFO_STREAM("connecting serial interface: " << port_name);
+            allow_send = false;
+            try {
+                serial_port.setPort(port_name);
+                serial_port.setBaudrate(ll_baudrate);
+                // Short timeout, we also need to check tx_queue regularly.
+                auto to = serial::Timeout::simpleTimeout(5);
+                serial_port.setTimeout(to);
+                serial_port.open();
+            } catch (std::exception &e) {
+                double delay = backoff.next();
+                ROS_ERROR_STREAM("Error during reconnect, retrying in " << delay << " s: " << e.what());
+                device_watcher.wait(delay);
+                continue;
+            }
+            // Opening the port may reset the board, so we wait for its first status before sending.
+            port_opened_ns = monotonicNanos();
+            link_state = LINK_WAITING_FOR_BOARD;
+        }
+
+        if (link_state == LINK_WAITING_FOR_BOARD &&
+            monotonicNanos() - port_opened_ns > static_cast<uint64_t>(board_ready_timeout_s * 1e9)) {
+            ROS_WARN_STREAM("No status from the low level board after " << board_ready_timeout_s << " s, sending anyway");
+            link_stats.ready_timeouts.add();
+            board_ready();
+        }
+
+        // Read everything which is available in one go instead of a single byte per call.
+        size_t overflows = rx_buffer.getOverflowCount();
+        uint8_t *write_ptr = rx_buffer.writePtr();
+        if (rx_buffer.getOverflowCount() != overflows) {
+            link_stats.overflows.add();
+        }
+        size_t bytes_read = 0;
+        try {
+            if (serial_port.waitReadable()) {
+                size_t to_read = std::min(std::max<size_t>(serial_port.available(), 1), rx_buffer.writeSpace());
+                bytes_read = serial_port.read(write_ptr, to_read);
+            }
+        } catch (std::exception &e) {
+            double delay = backoff.next();
+            ROS_ERROR_STREAM("Error reading serial_port. Closing Connection, reconnecting in " << delay << " s.");
+            disconnect();
+            device_watcher.wait(delay);
+            continue;
+        }
+        uint64_t rx_time_ns = monotonicNanos();
+        capture.append(ll_capture::RX, rx_time_ns, write_ptr, bytes_read);
+        rx_buffer.commit(bytes_read);
+        link_stats.rx_bytes.add(bytes_read);
+
+        const uint8_t *frame;
+        size_t frame_size;
+        while (rx_buffer.nextFrame(frame, frame_size)) {
+            uint8_t type = receiveLowLevelFrame(frame, frame_size, rx_time_ns);
+            if (type == PACKET_ID_LL_STATUS && link_state == LINK_WAITING_FOR_BOARD) {
+                board_ready();
+            }
+        }
+
+        ll_tx_tick tx_tick;
+        while (tx_queue.pop(tx_tick)) {
+            if (!allow_send) {
+                // Drop everything which was queued while we were disconnected.
+                continue;
+            }
+            const ll_frame_batch &tx_batch = tx_tick.batch;
+            try {
+                serial_port.write(tx_batch.data, tx_batch.size);
+                uint64_t written_ns = monotonicNanos();
+                actuation_stats.applied_to_written.record(written_ns - tx_tick.applied_ns);
+                if (tx_tick.cmd_receipt_ns != 0) {
+                    actuation_stats.receipt_to_written.record(written_ns - tx_tick.cmd_receipt_ns);
+                }
+                capture.append(ll_capture::TX, written_ns, tx_batch.data, tx_batch.size);
+                link_stats.tx_batches.add();
+                link_stats.tx_bytes.add(tx_batch.size);
+            } catch (std::exception &e) {
+                link_stats.tx_errors.add();
+            }
+        }
+    }
+}
+
+
+/**
+ * Add a value to a diagnostic status.
+ */
+static void addValue(diagnostic_msgs::DiagnosticStatus &status, const std::string &key, double value) {
+    diagnostic_msgs::KeyValue kv;
+    kv.key = key;
+    kv.value = std::to_string(value);
+    status.values.push_back(kv);
+}
+
+/**
+ * Tracking statistics of the wheel speed controllers since the last call. Spinner thread only.
+ */
+diagnostic_msgs::DiagnosticStatus getSpeedControlStatus() {
+    static WheelSpeedController::Stats last_stats[2];
+
+    diagnostic_msgs::DiagnosticStatus status;
+    status.name = "mower_comms: Wheel speed control";
+    status.hardware_id = "xesc";
+    status.level = diagnostic_msgs::DiagnosticStatus::OK;
+    status.message = "OK";
+
+    WheelSpeedController *controllers[2] = {&left_speed_controller, &right_speed_controller};
+    const char *names[2] = {"Left", "Right"};
+    for (int i = 0; i < 2; i++) {
+        const auto &stats = controllers[i]->getStats();
+        uint64_t updates = stats.updates - last_stats[i].updates;
+        double rms_error = updates > 0 ? std::sqrt((stats.error_sq_sum - last_stats[i].error_sq_sum) / updates) : 0.0;
+        std::string prefix = std::string(names[i]) + " ";
+        addValue(status, prefix + "target [m/s]", stats.target);
+        addValue(status, prefix + "speed [m/s]", stats.speed);
+        addValue(status, prefix + "duty cycle", stats.duty);
+        addValue(status, prefix + "tracking error RMS [m/s]", rms_error);
+        addValue(status, prefix + "tracking error max [m/s]", stats.max_error);
+        addValue(status, prefix + "saturated ticks", stats.saturated - last_stats[i].saturated);
+        if (stats.saturated != last_stats[i].saturated) {
+            status.level = diagnostic_msgs::DiagnosticStatus::WARN;
+            status.message = "Duty cycle saturated";
+        }
+        last_stats[i] = stats;
+        controllers[i]->resetMaxError();
+    }
+    return status;
+}
+
+/**
+ * State of the IMU sample time reconstruction.
+ */
+diagnostic_msgs::DiagnosticStatus getClockSyncStatus() {
+    ImuClockSync::Stats clock_stats;
+    {
+        std::unique_lock<std::mutex> lk(imu_clock_stats_mutex);
+        clock_stats = imu_clock_stats;
+    }
+    diagnostic_msgs::DiagnosticStatus status;
+    status.name = "mower_comms: IMU clock sync";
+    status.hardware_id = "ll_board";
+    addValue(status, "Offset [s]", clock_stats.offset_s);
+    addValue(status, "Skew [ppm]", clock_stats.skew_ppm);
+    addValue(status, "Jitter [ms]", clock_stats.jitter_ms);
+    addValue(status, "Removed delay [ms]", clock_stats.delay_ms);
+    addValue(status, "Sample period [ms]", clock_stats.period_ms);
+    addValue(status, "Samples", clock_stats.samples);
+    addValue(status, "Dropped samples", clock_stats.dropped);
+    addValue(status, "Resets", clock_stats.resets);
+    if (clock_stats.synced) {
+        status.level = diagnostic_msgs::DiagnosticStatus::OK;
+        status.message = "OK";
+    } else {
+        status.level = diagnostic_msgs::DiagnosticStatus::WARN;
+        status.message = "Not synced, using receive time";
+    }
+    return status;
+}
+
+/**
+ * The gyro bias estimated while standing still.
+ */
+diagnostic_msgs::DiagnosticStatus getGyroBiasStatus() {
+    GyroBiasEstimator::Estimate bias_estimate;
+    {
+        std::unique_lock<std::mutex> lk(gyro_bias_mutex);
+        bias_estimate = gyro_bias_estimate;
+    }
+    diagnostic_msgs::DiagnosticStatus status;
+    status.name = "mower_comms: Gyro bias";
+    status.hardware_id = "ll_board";
+    addValue(status, "Bias x [rad/s]", bias_estimate.bias[0]);
+    addValue(status, "Bias y [rad/s]", bias_estimate.bias[1]);
+    addValue(status, "Bias z [rad/s]", bias_estimate.bias[2]);
+    addValue(status, "Stddev [rad/s]", bias_estimate.stddev);
+    addValue(status, "Stationary blocks", bias_estimate.stationary_blocks);
+    addValue(status, "Blocks", bias_estimate.blocks);
+    status.level = diagnostic_msgs::DiagnosticStatus::OK;
+    status.message = bias_estimate.converged ? "Converged" : "Waiting for the mower to stand still";
+    return status;
+}
+
+/**
+ * Tilt, jerk and the time from an IMU sample to the stopped motors. Spinner thread only.
+ */
+diagnostic_msgs::DiagnosticStatus getHazardStatus() {
+    static LatencyHistogram::Snapshot last_latency;
+    HazardDetector::Stats stats;
+    {
+        std::unique_lock<std::mutex> lk(hazard_stats_mutex);
+        stats = hazard_stats;
+    }
+    diagnostic_msgs::DiagnosticStatus status;
+    status.name = "mower_comms: Hazard detection";
+    status.hardware_id = "imu";
+    auto latency = link_stats.hazard_latency.snapshot();
+    addValue(status, "Tilt [deg]", stats.tilt_deg);
+    addValue(status, "Max tilt [deg]", stats.max_tilt_deg);
+    addValue(status, "Max jerk [m/s^3]", stats.max_jerk);
+    addValue(status, "Tilt triggers", stats.tilt_triggers);
+    addValue(status, "Jerk triggers", stats.jerk_triggers);
+    addValue(status, "Detection latency p50 [ms]", latency.percentileMs(0.5));
+    addValue(status, "Detection latency max [ms]", latency.percentileMs(1.0));
+    if (latency.total() != last_latency.total()) {
+        status.level = diagnostic_msgs::DiagnosticStatus::ERROR;
+        status.message = "Hazard detected";
+    } else {
+        status.level = diagnostic_msgs::DiagnosticStatus::OK;
+        status.message = "OK";
+    }
+    last_latency = latency;
+    return status;
+}
+
+/**
+ * Latency of the cmd_vel trace stages since the last call.
+ */
+diagnostic_msgs::DiagnosticStatus getActuationStatus() {
+    static LatencyHistogram::Snapshot last_snapshots[ActuationStats::STAGES];
+    static uint64_t last_superseded = 0;
+
+    diagnostic_msgs::DiagnosticStatus status;
+    status.name = "mower_comms: Actuation latency";
+    status.hardware_id = "esc";
+
+    ActuationStats::Stage stages[ActuationStats::STAGES];
+    actuation_stats.stages(stages);
+    double end_to_end_p99_ms = 0.0;
+    for (size_t i = 0; i < ActuationStats::STAGES; i++) {
+        auto snapshot = stages[i].histogram->snapshot();
+        auto interval = snapshot - last_snapshots[i];
+        std::string prefix = std::string(stages[i].name) + " ";
+        addValue(status, prefix + "p50 [ms]", interval.percentileMs(0.5));
+        addValue(status, prefix + "p99 [ms]", interval.percentileMs(0.99));
+        addValue(status, prefix + "max [ms]", interval.percentileMs(1.0));
+        last_snapshots[i] = snapshot;
+        if (stages[i].histogram == &actuation_stats.receipt_to_written) {
+            end_to_end_p99_ms = interval.percentileMs(0.99);
+        }
+    }
+    uint64_t superseded = actuation_stats.superseded.get();
+    addValue(status, "Superseded commands", superseded - last_superseded);
+    last_superseded = superseded;
+
+    // A command should reach the serial port with the next control tick, allow for the coarse buckets
+    if (end_to_end_p99_ms > 2.0 * control_tick_s * 1000.0) {
+        status.level = diagnostic_msgs::DiagnosticStatus::WARN;
+        status.message = "cmd_vel takes " + std::to_string(end_to_end_p99_ms) + " ms to the serial port";
+    } else {
+        status.level = diagnostic_msgs::DiagnosticStatus::OK;
+        status.message = "OK";
+    }
+    return status;
+}
+
+/**
+ * Publish the low level link statistics as diagnostics and xbot_monitoring sensors.
+ * Rates are calculated from the difference to the last call.
+ */
+void publishLinkStats(const ros::TimerEvent &timer_event) {
+    static ros::Time last_time = ros::Time::now();
+    static uint64_t last_rx_bytes = 0, last_tx_bytes = 0, last_errors = 0, last_packets = 0;
+    static uint64_t last_type_counts[256] = {0};
+    static LatencyHistogram::Snapshot last_inter_arrival[256];
+    static LatencyHistogram::Snapshot last_status_latency;
+
+    ros::Time now = ros::Time::now();
+    double dt = (now - last_time).toSec();
+    last_time = now;
+    if (dt <= 0.0) {
+        return;
+    }
+
+    uint64_t rx_bytes = link_stats.rx_bytes.get();
+    uint64_t tx_bytes = link_stats.tx_bytes.get();
+    uint64_t errors = link_stats.errorCount();
+
+    diagnostic_msgs::DiagnosticStatus status;
+    status.name = "mower_comms: Low Level Link";
+    status.hardware_id = "ll_board";
+
+    addValue(status, "RX bytes/s", (rx_bytes - last_rx_bytes) / dt);
+    addValue(status, "TX bytes/s", (tx_bytes - last_tx_bytes) / dt);
+    addValue(status, "RX frames", link_stats.rx_frames.get());
+    addValue(status, "TX writes", link_stats.tx_batches.get());
+    addValue(status, "TX bytes per tick max", link_stats.tx_batch_max_bytes.get());
+    addValue(status, "TX tick budget exceeded", link_stats.tx_budget_exceeded.get());
+    addValue(status, "Empty frames", link_stats.empty_frames.get());
+    addValue(status, "COBS decode errors", link_stats.decode_errors.get());
+    addValue(status, "CRC errors", link_stats.crc_errors.get());
+    addValue(status, "Oversized frames", link_stats.oversized_frames.get());
+    addValue(status, "Size mismatches", link_stats.wrong_size.get());
+    addValue(status, "Unknown types", link_stats.unknown_type.get());
+    addValue(status, "Buffer overflow resets", link_stats.overflows.get());
+    addValue(status, "RX queue drops", link_stats.rx_queue_drops.get());
+    addValue(status, "TX queue drops", link_stats.tx_queue_drops.get());
+    addValue(status, "TX write errors", link_stats.tx_errors.get());
+    addValue(status, "Connects", link_stats.connects.get());
+    addValue(status, "Board ready timeouts", link_stats.ready_timeouts.get());
+    addValue(status, "Protocol version", ll_protocol_version);
+    addValue(status, "Lost IMU batches", link_stats.imu_batches_lost.get());
+    addValue(status, "Repeated or late IMU batches", link_stats.imu_batches_out_of_order.get());
+    auto connect_time = link_stats.connect_time.snapshot();
+    addValue(status, "Connect time p50 [ms]", connect_time.percentileMs(0.5));
+    addValue(status, "Connect time max [ms]", connect_time.percentileMs(1.0));
+
+    auto status_latency = link_stats.status_latency.snapshot();
+    auto status_interval = status_latency - last_status_latency;
+    addValue(status, "Status publish latency p50 [ms]", status_interval.percentileMs(0.5));
+    addValue(status, "Status publish latency p99 [ms]", status_interval.percentileMs(0.99));
+    addValue(status, "Status publish latency max [ms]", status_interval.percentileMs(1.0));
+    last_status_latency = status_latency;
+
+    uint64_t packets = 0;
+    for (int type = 0; type < 256; type++) {
+        const auto &type_stats = link_stats.packet_types[type];
+        uint64_t count = type_stats.count.get();
+        packets += count;
+        if (count == 0) {
+            continue;
+        }
+        auto inter_arrival = type_stats.inter_arrival.snapshot();
+        auto interval = inter_arrival - last_inter_arrival[type];
+        std::string prefix = "Type " + std::to_string(type) + " ";
+        addValue(status, prefix + "rate [Hz]", (count - last_type_counts[type]) / dt);
+        addValue(status, prefix + "inter-arrival p50 [ms]", interval.percentileMs(0.5));
+        addValue(status, prefix + "inter-arrival p99 [ms]", interval.percentileMs(0.99));
+        addValue(status, prefix + "inter-arrival max [ms]", interval.percentileMs(1.0));
+        last_type_counts[type] = count;
+        last_inter_arrival[type] = inter_arrival;
+    }
+
+    if (link_state != LINK_CONNECTED) {
+        status.level = diagnostic_msgs::DiagnosticStatus::ERROR;
+        status.message = link_state == LINK_DISCONNECTED ? "Disconnected" : "Waiting for the board";
+    } else if (errors != last_errors) {
+        status.level = diagnostic_msgs::DiagnosticStatus::WARN;
+        status.message = std::to_string(errors - last_errors) + " errors on the link";
+        ROS_WARN_STREAM_THROTTLE(10, "Low level link: " << status.message);
+    } else if (packets == last_packets) {
+        status.level = diagnostic_msgs::DiagnosticStatus::ERROR;
+        status.message = "No packets received";
+    } else {
+        status.level = diagnostic_msgs::DiagnosticStatus::OK;
+        status.message = "OK";
+    }
+
+    diagnostic_msgs::DiagnosticArray diagnostics;
+    diagnostics.header.stamp = now;
+    diagnostics.status.push_back(status);
+    diagnostics.status.push_back(getClockSyncStatus());
+    diagnostics.status.push_back(getGyroBiasStatus());
+    diagnostics.status.push_back(getActuationStatus());
+    if (hazard_detection) {
+        diagnostics.status.push_back(getHazardStatus());
+    }
+    if (speed_control) {
+        diagnostics.status.push_back(getSpeedControlStatus());
+    }
+    diagnostics_pub.publish(diagnostics);
+
+    xbot_msgs::SensorDataDouble sensor_data;
+    sensor_data.stamp = now;
+    sensor_data.data = (packets - last_packets) / dt;
+    ll_rx_rate_data_pub.publish(sensor_data);
+    sensor_data.data = (errors - last_errors) / dt;
+    ll_error_rate_data_pub.publish(sensor_data);
+
+    last_rx_bytes = rx_bytes;
+    last_tx_bytes = tx_bytes;
+    last_errors = errors;
+    last_packets = packets;
+}
+
+void registerLinkSensors(ros::NodeHandle &n) {
+    xbot_msgs::SensorInfo si_ll_rx_rate;
+    si_ll_rx_rate.sensor_id = "om_ll_rx_rate";
+    si_ll_rx_rate.sensor_name = "LL Packet Rate";
+    si_ll_rx_rate.value_type = xbot_msgs::SensorInfo::TYPE_DOUBLE;
+    si_ll_rx_rate.value_description = xbot_msgs::SensorInfo::VALUE_DESCRIPTION_UNKNOWN;
+    si_ll_rx_rate.unit = "1/s";
+    si_ll_rx_rate_pub = n.advertise<xbot_msgs::SensorInfo>("xbot_monitoring/sensors/" + si_ll_rx_rate.sensor_id + "/info", 1, true);
+    ll_rx_rate_data_pub = n.advertise<xbot_msgs::SensorDataDouble>("xbot_monitoring/sensors/" + si_ll_rx_rate.sensor_id + "/data", 10);
+    si_ll_rx_rate_pub.publish(si_ll_rx_rate);
+
+    xbot_msgs::SensorInfo si_ll_error_rate;
+    si_ll_error_rate.sensor_id = "om_ll_error_rate";
+    si_ll_error_rate.sensor_name = "LL Error Rate";
+    si_ll_error_rate.value_type = xbot_msgs::SensorInfo::TYPE_DOUBLE;
+    si_ll_error_rate.value_description = xbot_msgs::SensorInfo::VALUE_DESCRIPTION_UNKNOWN;
+    si_ll_error_rate.unit = "1/s";
+    si_ll_error_rate_pub = n.advertise<xbot_msgs::SensorInfo>("xbot_monitoring/sensors/" + si_ll_error_rate.sensor_id + "/info", 1, true);
+    ll_error_rate_data_pub = n.advertise<xbot_msgs::SensorDataDouble>("xbot_monitoring/sensors/" + si_ll_error_rate.sensor_id + "/data", 10);
+    si_ll_error_rate_pub.publish(si_ll_error_rate);
+}
+
 
 int main(int argc, char **argv) {
     ros::init(argc, argv, "mower_comms");
@@ -411,138 +1428,135 @@ int main(int argc, char **argv) {
     paramNh.getParam("wheel_ticks_per_m",wheel_ticks_per_m);
     paramNh.getParam("wheel_distance_m",wheel_distance_m);
 
+    paramNh.param("speed_control", speed_control, false);
+    if (speed_control) {
+        WheelSpeedController::Gains gains;
+        paramNh.param("speed_control_feed_forward", gains.feed_forward, gains.feed_forward);
+        paramNh.param("speed_control_kp", gains.kp, gains.kp);
+        paramNh.param("speed_control_ki", gains.ki, gains.ki);
+        left_speed_controller.setGains(gains);
+        right_speed_controller.setGains(gains);
+        ROS_INFO_STREAM("Using closed loop wheel speed control. FF: " << gains.feed_forward << ", P: " << gains.kp
+                                                                      << ", I: " << gains.ki);
+        if (wheel_ticks_per_m <= 0.0) {
+            ROS_ERROR_STREAM("Speed control needs wheel_ticks_per_m. Quitting.");
+            return 1;
+        }
+    }
+
+    int imu_rate = 0;
+    paramNh.param("imu_rate_hz", imu_rate, 0);
+    imu_rate_hz = static_cast<uint16_t>(std::max(0, std::min(imu_rate, 1000)));
+
+    GyroBiasEstimator::Config gyro_bias_config;
+    paramNh.param("gyro_bias_max_accel_std", gyro_bias_config.max_accel_std, gyro_bias_config.max_accel_std);
+    paramNh.param("gyro_bias_max_gyro_std", gyro_bias_config.max_gyro_std, gyro_bias_config.max_gyro_std);
+    paramNh.param("gyro_bias_drift", gyro_bias_config.bias_drift, gyro_bias_config.bias_drift);
+    gyro_bias_estimator.setConfig(gyro_bias_config);
+
+    paramNh.param("hazard_detection", hazard_detection, false);
+    if (hazard_detection) {
+        HazardDetector::Config hazard_config;
+        paramNh.param("hazard_tilt_trigger_deg", hazard_config.tilt_trigger_deg, hazard_config.tilt_trigger_deg);
+        paramNh.param("hazard_tilt_release_deg", hazard_config.tilt_release_deg, hazard_config.tilt_release_deg);
+        paramNh.param("hazard_jerk_trigger", hazard_config.jerk_trigger, hazard_config.jerk_trigger);
+        paramNh.param("hazard_jerk_release", hazard_config.jerk_release, hazard_config.jerk_release);
+        hazard_detector.setConfig(hazard_config);
+        ROS_INFO_STREAM("Using IMU hazard detection. Tilt: " << hazard_config.tilt_trigger_deg << " deg, jerk: "
+                                                             << hazard_config.jerk_trigger << " m/s^3");
+    }
+    gyro_bias_estimate = gyro_bias_estimator.getEstimate();
+
     ROS_INFO_STREAM("Wheel ticks [1/m]: " << wheel_ticks_per_m);
     ROS_INFO_STREAM("Wheel distance [m]: " << wheel_distance_m);
 
     speed_l = speed_r = speed_mow = 0;
 
 
-    // Setup XESC interfaces
-    if(mowerParamNh.hasParam("xesc_type")) {
-        mow_xesc_interface = new xesc_driver::XescDriver(n, mowerParamNh);
+    // Setup XESC interfaces. The mock backend simulates them, so we can run without hardware.
+    std::string esc_backend;
+    paramNh.param("esc_backend", esc_backend, std::string("xesc"));
+    if (esc_backend == "mock") {
+        double mock_max_speed = 0.5;
+        paramNh.param("mock_esc_max_speed", mock_max_speed, mock_max_speed);
+        double ticks_per_second = mock_max_speed * (wheel_ticks_per_m > 0.0 ? wheel_ticks_per_m : 1000.0);
+        ROS_WARN_STREAM("Using mock ESCs with " << ticks_per_second << " ticks/s at full duty cycle");
+        mow_xesc_interface = new MockEscBackend(ticks_per_second);
+        left_xesc_interface = new MockEscBackend(ticks_per_second);
+        right_xesc_interface = new MockEscBackend(ticks_per_second);
+    } else if (esc_backend == "xesc") {
+        if(mowerParamNh.hasParam("xesc_type")) {
+            mow_xesc_interface = new XescBackend(n, mowerParamNh);
+        } else {
+            mow_xesc_interface = nullptr;
+        }
+
+        left_xesc_interface = new XescBackend(n, leftParamNh);
+        right_xesc_interface = new XescBackend(n, rightParamNh);
     } else {
-        mow_xesc_interface = nullptr;
+        ROS_ERROR_STREAM("Unknown esc_backend " << esc_backend << ", use xesc or mock. Quitting.");
+        return 1;
     }
 
-    left_xesc_interface = new xesc_driver::XescDriver(n, leftParamNh);
-    right_xesc_interface = new xesc_driver::XescDriver(n, rightParamNh);
+    if (!mow_xesc_interface) {
+        EscSnapshot disconnected = {};
+        disconnected.connection_state = xesc_msgs::XescState::XESC_CONNECTION_STATE_DISCONNECTED;
+        mow_esc_snapshot.store(disconnected);
+    }
 
 
     status_pub = n.advertise<mower_msgs::Status>("mower/status", 1);
-    wheel_tick_pub = n.advertise<xbot_msgs::WheelTick>("mower/wheel_ticks", 1);
-
-    sensor_imu_pub = n.advertise<sensor_msgs::Imu>("imu/data_raw", 1);
+    // The ticks come at the ESC rate, give slow subscribers some room
+    wheel_tick_pub = n.advertise<xbot_msgs::WheelTick>("mower/wheel_ticks", 10);
+    drive_ticks_pub = n.advertise<mower_msgs::WheelTicks>("mower/drive_ticks", 10);
+    esc_poller_thread = std::thread(runEscPollerThread);
+
+    // A v2 batch publishes several samples at once, don't let the queue drop them
+    sensor_imu_pub = n.advertise<sensor_msgs::Imu>("imu/data_raw", LL_IMU_BATCH_SAMPLES);
+    sensor_imu_corrected_pub = n.advertise<sensor_msgs::Imu>("imu/data_corrected", LL_IMU_BATCH_SAMPLES);
     sensor_mag_pub = n.advertise<sensor_msgs::MagneticField>("imu/mag", 1);
     ros::ServiceServer mow_service = n.advertiseService("mower_service/mow_enabled", setMowEnabled);
     ros::ServiceServer emergency_service = n.advertiseService("mower_service/emergency", setEmergencyStop);
+    ros::ServiceServer gyro_bias_service = n.advertiseService("mower_service/get_gyro_bias", getGyroBias);
+    ros::ServiceServer latency_service = n.advertiseService("mower_service/dump_actuation_latency", dumpLatency);
     ros::Subscriber cmd_vel_sub = n.subscribe("cmd_vel", 0, velReceived, ros::TransportHints().tcpNoDelay(true));
     ros::Subscriber high_level_status_sub = n.subscribe("/mower_logic/current_state", 0, highLevelStatusReceived);
-    ros::Timer publish_timer = n.createTimer(ros::Duration(0.02), publishActuatorsTimerTask);
+    ros::Timer publish_timer = n.createTimer(ros::Duration(control_tick_s), publishActuatorsTimerTask);
+    ros::Timer esc_status_timer = n.createTimer(ros::Duration(status_keepalive_s), publishEscStatusTimerTask);
 
+    diagnostics_pub = n.advertise<diagnostic_msgs::DiagnosticArray>("/diagnostics", 1);
+    registerLinkSensors(n);
+    ros::Timer link_stats_timer = n.createTimer(ros::Duration(1.0), publishLinkStats);
 
-    size_t buflen = 1000;
-    uint8_t buffer[buflen];
-    uint8_t buffer_decoded[buflen];
-    size_t read = 0;
-    // don't change, we need to wait for arduino to boot before actually sending stuff
-    ros::Duration retryDelay(5, 0);
-    ros::AsyncSpinner spinner(1);
-    spinner.start();
-    while (ros::ok()) {
-        if (!serial_port.isOpen()) {
-            ROS_INFO_STREAM("connecting serial interface: " << ll_serial_port_name);
-            allow_send = false;
-            try {
-                serial_port.setPort(ll_serial_port_name);
-                serial_port.setBaudrate(115200);
-                auto to = serial::Timeout::simpleTimeout(100);
-                serial_port.setTimeout(to);
-                serial_port.open();
 
-                // wait for controller to boot
-                retryDelay.sleep();
-                // this will only be set if no error was set
+    int serial_thread_cpu = -1;
+    int serial_thread_priority = 0;
+    std::string capture_file;
+    bool serial_watch_device = false;
+    paramNh.getParam("serial_thread_cpu", serial_thread_cpu);
+    paramNh.getParam("serial_thread_priority", serial_thread_priority);
+    paramNh.getParam("capture_file", capture_file);
+    paramNh.getParam("serial_watch_device", serial_watch_device);
 
-                allow_send = true;
-            } catch (std::exception &e) {
-                retryDelay.sleep();
-                ROS_ERROR_STREAM("Error during reconnect.");
-            }
-        }
-        size_t bytes_read = 0;
-        try {
-            bytes_read = serial_port.read(buffer + read, 1);
-        } catch (std::exception &e) {
-            ROS_ERROR_STREAM("Error reading serial_port. Closing Connection.");
-            serial_port.close();
-            retryDelay.sleep();
-        }
-        if (read + bytes_read >= buflen) {
-            read = 0;
-            bytes_read = 0;
-            ROS_ERROR_STREAM("Prevented buffer overflow. There is a problem with the serial comms.");
-        }
-        if (bytes_read) {
-            if (buffer[read] == 0) {
-                // end of packet found
-                size_t data_size = cobs.decode(buffer, read, buffer_decoded);
-
-                // first, check the CRC
-                if (data_size < 3) {
-                    // We don't even have one byte of data
-                    // (type + crc = 3 bytes already)
-                    ROS_INFO_STREAM("Got empty packet from Low Level Board");
-                } else {
-                    // We have at least 1 byte of data, check the CRC
-                    crc.reset();
-                    // We start at the second byte (ignore the type) and process (data_size- byte for type - 2 bytes for CRC) bytes.
-                    crc.process_bytes(buffer_decoded, data_size - 2);
-                    uint16_t checksum = crc.checksum();
-                    uint16_t received_checksum = *(uint16_t *) (buffer_decoded + data_size - 2);
-                    if (checksum == received_checksum) {
-                        // Packet checksum is OK, process it
-                        switch (buffer_decoded[0]) {
-                            case PACKET_ID_LL_STATUS:
-                                if (data_size == sizeof(struct ll_status)) {
-                                    handleLowLevelStatus((struct ll_status *) buffer_decoded);
-                                } else {
-                                    ROS_INFO_STREAM(
-                                            "Low Level Board sent a valid packet with the wrong size. Type was STATUS");
-                                }
-                                break;
-                            case PACKET_ID_LL_IMU:
-                                if (data_size == sizeof(struct ll_imu)) {
-                                    handleLowLevelIMU((struct ll_imu *) buffer_decoded);
-                                } else {
-                                    ROS_INFO_STREAM(
-                                            "Low Level Board sent a valid packet with the wrong size. Type was IMU");
-                                }
-                                break;
-                            case PACKET_ID_LL_UI_EVENT:
-                                if(data_size == sizeof(struct ll_ui_event)) {
-                                    handleLowLevelUIEvent((struct ll_ui_event*) buffer_decoded);
-                                } else {
-                                    ROS_INFO_STREAM(
-                                            "Low Level Board sent a valid packet with the wrong size. Type was UI_EVENT");
-                                }
-                                break;
-                            default:
-                                ROS_INFO_STREAM("Got unknown packet from Low Level Board");
-                                break;
-                        }
-                    } else {
-                        ROS_INFO_STREAM("Got invalid checksum from Low Level Board");
-                    }
+    ros::AsyncSpinner spinner(1);
+    spinner.start();
 
-                }
+    serial_thread = std::thread(runSerialThread, ll_serial_port_name, serial_thread_cpu, serial_thread_priority,
+                                capture_file, serial_watch_device);
 
-                read = 0;
-            } else {
-                read += bytes_read;
-            }
+    // The main thread handles all packets received by the serial thread.
+    ll_packet packet;
+    while (ros::ok()) {
+        if (rx_queue.pop(packet)) {
+            handleLowLevelPacket(packet);
+            continue;
         }
+        std::unique_lock<std::mutex> lk(rx_queue_mutex);
+        rx_queue_cv.wait_for(lk, std::chrono::milliseconds(100), [] { return !rx_queue.empty(); });
     }
 
+    serial_thread.join();
+    esc_poller_thread.join();
     spinner.stop();
 
     if(mow_xesc_interface) {
@@ -0,0 +1,160 @@
+// Copyright (c) 2022 Clemens Elflein. All rights reserved.
+//
+// This work is licensed under a Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//
+// Feel free to use the design in your private/educational projects, but don't try to sell the design or products based on it without getting my consent first.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//
+
+// Benchmark for reading the ESC states in mower_comms. Compares what a status tick did before, copying
+// XescStateStamped from three drivers under their mutexes, with loading three SeqLock<EscSnapshot>.
+// A writer thread updates both at the ESC poll rate while the reader runs.
+//
+// Afterwards, a stress test stores into a SeqLock as fast as possible while a reader checks every
+// value it loads for torn reads.
+//
+// Usage: seqlock_bench [ticks] [stress stores]
+//   Defaults: 2000000 ticks, 3000000 stores
+//
+
+#include <atomic>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+
+#include "EscBackend.h"
+#include "SeqLock.h"
+
+typedef std::chrono::steady_clock Clock;
+
+/// \brief Stands in for xesc_driver, which copies its state under a mutex in getStatus().
+struct LockedEsc {
+    std::mutex mutex;
+    xesc_msgs::XescStateStamped state;
+
+    void getStatus(xesc_msgs::XescStateStamped &out) {
+        std::unique_lock<std::mutex> lk(mutex);
+        out = state;
+    }
+};
+
+/// \brief The fields of mower/status that come from one ESC.
+struct EscStatus {
+    uint8_t status;
+    uint32_t tacho;
+    float current;
+    float temperature_motor;
+    float temperature_pcb;
+};
+
+volatile float sink;
+
+template<typename Load>
+double benchmarkTicks(uint64_t ticks, Load load) {
+    EscStatus status[3];
+    auto start = Clock::now();
+    for (uint64_t k = 0; k < ticks; k++) {
+        for (int i = 0; i < 3; i++) {
+            load(i, status[i]);
+        }
+        sink = status[0].current + status[1].tacho + status[2].temperature_motor;
+    }
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / ticks;
+}
+
+/// \returns The number of torn reads.
+uint64_t stressTest(uint64_t stores, uint64_t &reads) {
+    struct Value {
+        uint64_t a, b, c, d, e;
+    };
+    SeqLock<Value> lock;
+    std::atomic<bool> running{true};
+    std::thread writer([&] {
+        for (uint64_t i = 1; i <= stores; i++) {
+            lock.store(Value{i, i, i, i, i});
+        }
+        running = false;
+    });
+    uint64_t torn = 0;
+    reads = 0;
+    while (running) {
+        Value v = lock.load();
+        reads++;
+        if (v.a != v.b || v.a != v.c || v.a != v.d || v.a != v.e) {
+            torn++;
+        }
+    }
+    writer.join();
+    return torn;
+}
+
+int main(int argc, char **argv) {
+    uint64_t ticks = argc > 1 ? strtoull(argv[1], nullptr, 10) : 2000000;
+    uint64_t stores = argc > 2 ? strtoull(argv[2], nullptr, 10) : 3000000;
+
+    LockedEsc drivers[3];
+    SeqLock<EscSnapshot> snapshots[3];
+    for (auto &driver: drivers) {
+        driver.state.header.frame_id = "xesc_base_link_frame";
+        driver.state.state.connection_state = xesc_msgs::XescState::XESC_CONNECTION_STATE_CONNECTED;
+    }
+
+    // Like the ESC poller thread in mower_comms
+    std::atomic<bool> running{true};
+    std::thread writer([&] {
+        xesc_msgs::XescStateStamped state;
+        while (running) {
+            for (int i = 0; i < 3; i++) {
+                drivers[i].getStatus(state);
+                state.state.tacho++;
+                {
+                    std::unique_lock<std::mutex> lk(drivers[i].mutex);
+                    drivers[i].state.state.tacho = state.state.tacho;
+                }
+                snapshots[i].store(makeEscSnapshot(state));
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+    });
+
+    double locked_ns = benchmarkTicks(ticks, [&](int i, EscStatus &out) {
+        xesc_msgs::XescStateStamped state;
+        drivers[i].getStatus(state);
+        out.status = state.state.connection_state != xesc_msgs::XescState::XESC_CONNECTION_STATE_CONNECTED ? 0 :
+                     (state.state.fault_code ? 2 : 1);
+        out.tacho = state.state.tacho;
+        out.current = state.state.current_input;
+        out.temperature_motor = state.state.temperature_motor;
+        out.temperature_pcb = state.state.temperature_pcb;
+    });
+    double seqlock_ns = benchmarkTicks(ticks, [&](int i, EscStatus &out) {
+        EscSnapshot snapshot = snapshots[i].load();
+        out.status = snapshot.connection_state != xesc_msgs::XescState::XESC_CONNECTION_STATE_CONNECTED ? 0 :
+                     (snapshot.fault_code ? 2 : 1);
+        out.tacho = snapshot.tacho;
+        out.current = snapshot.current_input;
+        out.temperature_motor = snapshot.temperature_motor;
+        out.temperature_pcb = snapshot.temperature_pcb;
+    });
+    running = false;
+    writer.join();
+
+    printf("3x getStatus + convert: %6.1f ns per tick\n", locked_ns);
+    printf("3x SeqLock + convert:   %6.1f ns per tick\n", seqlock_ns);
+
+    uint64_t reads;
+    uint64_t torn = stressTest(stores, reads);
+    printf("Stress test: %" PRIu64 " stores, %" PRIu64 " reads, %" PRIu64 " torn\n", stores, reads, torn);
+    return torn == 0 ? 0 : 1;
+}
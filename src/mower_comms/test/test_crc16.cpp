@@ -0,0 +1,70 @@
+// Copyright (c) 2022 Clemens Elflein. All rights reserved.
+//
+// This work is licensed under a Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//
+// Feel free to use the design in your private/educational projects, but don't try to sell the design or products based on it without getting my consent first.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include <boost/crc.hpp>
+#include <gtest/gtest.h>
+
+#include "../src/CRC16.h"
+
+
+static uint16_t boostCrc(const std::vector<uint8_t> &data) {
+    boost::crc_ccitt_type crc;
+    crc.process_bytes(data.data(), data.size());
+    return crc.checksum();
+}
+
+TEST(CRC16, MatchesBoostForAllLengths) {
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int> byte(0, 255);
+    for (size_t length = 0; length <= 300; length++) {
+        for (int round = 0; round < 10; round++) {
+            std::vector<uint8_t> data(length);
+            for (auto &b: data) {
+                b = byte(rng);
+            }
+            ASSERT_EQ(boostCrc(data), crc16::checksum(data.data(), data.size())) << "length " << length;
+        }
+    }
+}
+
+TEST(CRC16, UpdateInPieces) {
+    std::mt19937 rng(7);
+    std::uniform_int_distribution<int> byte(0, 255);
+    std::vector<uint8_t> data(300);
+    for (auto &b: data) {
+        b = byte(rng);
+    }
+    uint16_t expected = boostCrc(data);
+    for (size_t split = 0; split <= data.size(); split++) {
+        uint16_t crc = crc16::update(0xFFFF, data.data(), split);
+        crc = crc16::update(crc, data.data() + split, data.size() - split);
+        ASSERT_EQ(expected, crc) << "split at " << split;
+    }
+}
+
+TEST(CRC16, CheckValue) {
+    // CRC-16/CCITT-FALSE check value
+    EXPECT_EQ(0x29B1, crc16::checksum("123456789", 9));
+}
+
+int main(int argc, char **argv) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -35,6 +35,7 @@
 #include "actionlib/client/simple_client_goal_state.h"
 #include "mower_msgs/MowerControlSrv.h"
 #include "mower_msgs/EmergencyStopSrv.h"
+#include "mower_msgs/GetGyroBiasSrv.h"
 #include "ftc_local_planner/PlannerGetProgress.h"
 #include <dynamic_reconfigure/server.h>
 #include "mower_logic/MowerLogicConfig.h"
@@ -53,11 +54,14 @@
 #include "xbot_positioning/CalibrateGyroSrv.h"
 #include "xbot_msgs/RegisterActionsSrv.h"
 #include "sensor_msgs/Range.h"
+#include <algorithm>
+#include <cmath>
 #include <mutex>
 #include <atomic>
 
 ros::ServiceClient pathClient, mapClient, dockingPointClient, gpsClient, gpsFloatRtkClient, calibrateGyroClient, mowClient;
 ros::ServiceClient emergencyClient, pathProgressClient, setNavPointClient, clearNavPointClient, clearMapClient, positioningClient, actionRegistrationClient;
+ros::ServiceClient gyroBiasClient;
 
 ros::NodeHandle *n;
 ros::NodeHandle *paramNh;
@@ -294,9 +298,39 @@ bool setGPSRtkFloat(bool enabled) {
     return success;
 }
 
+// True, if xbot_positioning was calibrated while mower_comms already removed a converged gyro bias
+bool gyro_calibrated_with_bias = false;
+// The bias mower_comms reported at that calibration [rad/s]
+double gyro_calibration_bias[3] = {0, 0, 0};
+
 bool calibrateGyro() {
+    // mower_comms follows the bias whenever the mower stands still. xbot_positioning keeps the offset it measured
+    // at its last calibration, which is the residual of the bias estimate at that time. As long as the estimate
+    // didn't move by more than its stddev since then, that offset is still right and calibrating only costs time.
+    mower_msgs::GetGyroBiasSrv bias_srv;
+    bool converged = gyroBiasClient.call(bias_srv) && bias_srv.response.converged;
+    double bias[3] = {bias_srv.response.bias_x, bias_srv.response.bias_y, bias_srv.response.bias_z};
+    double bias_change = 0.0;
+    for (int i = 0; i < 3; i++) {
+        bias_change = std::max(bias_change, std::fabs(bias[i] - gyro_calibration_bias[i]));
+    }
+    if (converged && gyro_calibrated_with_bias && bias_change <= bias_srv.response.stddev) {
+        ROS_INFO_STREAM("Gyro bias is tracked by mower_comms (changed by " << bias_change << " rad/s, stddev "
+                        << bias_srv.response.stddev << " rad/s), skipping the calibration");
+        return true;
+    }
+    if (converged && gyro_calibrated_with_bias) {
+        ROS_INFO_STREAM("Gyro bias changed by " << bias_change << " rad/s since the last calibration (stddev "
+                        << bias_srv.response.stddev << " rad/s), calibrating again");
+    }
+
     xbot_positioning::CalibrateGyroSrv calibrate_srv;
-    calibrateGyroClient.call(calibrate_srv);
+    bool success = calibrateGyroClient.call(calibrate_srv);
+    gyro_calibrated_with_bias = success && converged;
+    if (gyro_calibrated_with_bias) {
+        std::copy(bias, bias + 3, gyro_calibration_bias);
+    }
+    return success;
 }
 
 
@@ -708,6 +742,8 @@ int main(int argc, char **argv) {
             "mower_service/mow_enabled");
     emergencyClient = n->serviceClient<mower_msgs::EmergencyStopSrv>(
             "mower_service/emergency");
+    gyroBiasClient = n->serviceClient<mower_msgs::GetGyroBiasSrv>(
+            "mower_service/get_gyro_bias");
 
     dockingPointClient = n->serviceClient<mower_map::GetDockingPointSrv>(
             "mower_map_service/get_docking_point");
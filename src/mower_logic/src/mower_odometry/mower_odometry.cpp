@@ -17,7 +17,7 @@
 
 #include "ros/ros.h"
 
-#include <mower_msgs/Status.h>
+#include <mower_msgs/WheelTicks.h>
 #include <sensor_msgs/Imu.h>
 #include <nav_msgs/Odometry.h>
 #include <tf2_ros/transform_broadcaster.h>
@@ -56,17 +56,19 @@ bool hasImuMessage = false;
 
 // Odometry
 bool firstData = true;
-mower_msgs::Status last_status;
+mower_msgs::WheelTicks last_ticks;
 
 // inputs here
 double d_wheel_r, d_wheel_l, dt = 1.0;
+// Filtered speed of the robot from mower_comms [m/s]
+double v_wheels = 0.0;
 
 // outputs here
 double x = 0, y = 0, vx = 0.0, r = 0.0, vy = 0.0, vr = 0.0;
 geometry_msgs::Quaternion orientation_result;
 
 
-// (ticks / revolution) / (m / revolution)
+// (ticks / revolution) / (m / revolution), if mower_comms doesn't know the wheel_ticks_per_m
 #define TICKS_PER_M (993.0 / (0.19*M_PI))
 
 
@@ -332,7 +334,7 @@ void gpsPositionReceivedF9R(const xbot_msgs::AbsolutePose::ConstPtr &msg) {
 }
 
 
-bool statusReceivedOrientation(const mower_msgs::Status::ConstPtr &msg) {
+bool ticksReceivedOrientation(const mower_msgs::WheelTicks::ConstPtr &msg) {
 
     if (!hasImuMessage) {
         ROS_INFO_THROTTLE(1, "odometry is waiting for imu message");
@@ -372,7 +374,7 @@ bool statusReceivedOrientation(const mower_msgs::Status::ConstPtr &msg) {
     y += d_ticks * sin(r);
 
     vy = 0;
-    vx = d_ticks / dt;
+    vx = v_wheels;
     vr = lastImu.angular_velocity.z;
 
 
@@ -380,7 +382,7 @@ bool statusReceivedOrientation(const mower_msgs::Status::ConstPtr &msg) {
 }
 
 
-bool statusReceivedGyro(const mower_msgs::Status::ConstPtr &msg) {
+bool ticksReceivedGyro(const mower_msgs::WheelTicks::ConstPtr &msg) {
 
     if (!hasImuMessage) {
         ROS_INFO_THROTTLE(1, "odometry is waiting for imu message");
@@ -411,7 +413,7 @@ bool statusReceivedGyro(const mower_msgs::Status::ConstPtr &msg) {
     y += d_ticks * sin(r);
 
     vy = 0;
-    vx = d_ticks / dt;
+    vx = v_wheels;
     vr = lastImu.angular_velocity.z;
 
 
@@ -419,34 +421,39 @@ bool statusReceivedGyro(const mower_msgs::Status::ConstPtr &msg) {
 }
 
 
-void statusReceived(const mower_msgs::Status::ConstPtr &msg) {
+void ticksReceived(const mower_msgs::WheelTicks::ConstPtr &msg) {
 
     // we need the differences, so initialize in the first run
     if (firstData) {
 
-        last_status = *msg;
+        last_ticks = *msg;
         firstData = false;
 
         return;
     }
 
-    dt = (msg->stamp - last_status.stamp).toSec();
-
+    dt = (msg->header.stamp - last_ticks.header.stamp).toSec();
+    if (dt <= 0.0) {
+        return;
+    }
 
-    d_wheel_l = (int32_t) (msg->left_esc_status.tacho - last_status.left_esc_status.tacho) / TICKS_PER_M;
-    d_wheel_r = -(int32_t) (msg->right_esc_status.tacho - last_status.right_esc_status.tacho) / TICKS_PER_M;
+    // The ticks are already signed, so that forward is positive for both wheels. They wrap like an int32.
+    double ticks_per_m = msg->ticks_per_m > 0.0 ? msg->ticks_per_m : TICKS_PER_M;
+    d_wheel_l = static_cast<int32_t>(static_cast<uint32_t>(msg->ticks_left) - static_cast<uint32_t>(last_ticks.ticks_left)) / ticks_per_m;
+    d_wheel_r = static_cast<int32_t>(static_cast<uint32_t>(msg->ticks_right) - static_cast<uint32_t>(last_ticks.ticks_right)) / ticks_per_m;
+    v_wheels = (msg->velocity_left + msg->velocity_right) / 2.0;
 
 
 //    ROS_INFO_STREAM("d_wheel_l = " << d_wheel_l << ", d_wheel_r = " << d_wheel_r);
 
     bool success;
     if (!use_f9r_sensor_fusion) {
-        success = statusReceivedOrientation(msg);
+        success = ticksReceivedOrientation(msg);
     } else {
-        success = statusReceivedGyro(msg);
+        success = ticksReceivedGyro(msg);
     }
 
-    last_status = *msg;
+    last_ticks = *msg;
 
     if (success) {
         publishOdometry();
@@ -488,7 +495,7 @@ int main(int argc, char **argv) {
     gps_outlier_count = 0;
     gpsOdometryValid = false;
 
-    ros::Subscriber status_sub;
+    ros::Subscriber ticks_sub;
     ros::Subscriber imu_sub;
 
     paramNh.param("use_f9r_sensor_fusion", use_f9r_sensor_fusion, false);
@@ -498,12 +505,12 @@ int main(int argc, char **argv) {
         ROS_INFO("Odometry is using F9R sensor fusion");
 
         gps_sub = n.subscribe("xbot_driver_gps/xb_pose", 100, gpsPositionReceivedF9R);
-        status_sub = n.subscribe("mower/status", 100, statusReceived);
+        ticks_sub = n.subscribe("mower/drive_ticks", 100, ticksReceived);
         imu_sub = n.subscribe("xbot_driver_gps/imu", 100, imuReceived);
     } else {
         ROS_INFO("Odometry is using relative positioning.");
         gps_sub = n.subscribe("xbot_driver_gps/xb_pose", 100, gpsPositionReceived);
-        status_sub = n.subscribe("mower/status", 100, statusReceived);
+        ticks_sub = n.subscribe("mower/drive_ticks", 100, ticksReceived);
         imu_sub = n.subscribe("imu/data", 100, imuReceived);
     }
 
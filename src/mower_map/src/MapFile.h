@@ -0,0 +1,406 @@
+// Copyright (c) 2022 Clemens Elflein. All rights reserved.
+//
+// This work is licensed under a Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//
+// Feel free to use the design in your private/educational projects, but don't try to sell the design or products based on it without getting my consent first.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//
+
+#ifndef SRC_MAPFILE_H
+#define SRC_MAPFILE_H
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "geometry_msgs/Pose.h"
+#include "mower_map/MapArea.h"
+
+
+/// Binary map file, replaces map.bag.
+///
+/// File layout: FileHeader, then area_count AreaRecords, polygon_count PolygonRecords, vertex_count Vertices
+/// and name_size bytes of area names. Every area owns a contiguous range of polygons, the first one is its
+/// outline and the rest are its obstacles. The checksum covers everything after the header.
+///
+/// Files are written to a temporary file, synced and renamed over the old one, so a crash leaves either the
+/// old or the new map. The reader maps the file and gives access to the vertices without copying them.
+namespace map_file {
+    constexpr char MAGIC[8] = {'O', 'M', 'M', 'A', 'P', 'B', 'I', 'N'};
+    constexpr uint32_t VERSION = 1;
+
+    enum AreaType : uint8_t {
+        NAVIGATION_AREA = 0,
+        MOWING_AREA = 1
+    };
+
+    enum Flags : uint32_t {
+        HAS_DOCKING_POINT = 1
+    };
+
+#pragma pack(push, 1)
+    struct FileHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t flags;
+        uint32_t area_count;
+        uint32_t polygon_count;
+        uint32_t vertex_count;
+        uint32_t name_size;
+        // Position x, y, z and orientation x, y, z, w
+        double docking_pose[7];
+        uint32_t checksum;
+        uint32_t reserved;
+    } __attribute__((packed));
+
+    struct AreaRecord {
+        uint8_t type;
+        uint8_t reserved[3];
+        uint32_t name_offset;
+        uint32_t name_size;
+        uint32_t first_polygon;
+        uint32_t polygon_count;
+    } __attribute__((packed));
+
+    struct PolygonRecord {
+        uint32_t first_vertex;
+        uint32_t vertex_count;
+    } __attribute__((packed));
+
+    struct Vertex {
+        float x, y, z;
+    } __attribute__((packed));
+#pragma pack(pop)
+
+    namespace detail {
+        struct Crc32Table {
+            uint32_t table[256];
+        };
+
+        constexpr Crc32Table makeCrc32Table() {
+            Crc32Table t{};
+            for (uint32_t b = 0; b < 256; b++) {
+                uint32_t crc = b;
+                for (int bit = 0; bit < 8; bit++) {
+                    crc = (crc & 1) ? (crc >> 1) ^ 0xEDB88320 : (crc >> 1);
+                }
+                t.table[b] = crc;
+            }
+            return t;
+        }
+
+        constexpr Crc32Table CRC32_TABLE = makeCrc32Table();
+    }
+
+    /// \brief CRC-32 (IEEE 802.3, same as zlib).
+    inline uint32_t crc32(const void *data, size_t size) {
+        const auto *bytes = static_cast<const uint8_t *>(data);
+        uint32_t crc = 0xFFFFFFFF;
+        while (size--) {
+            crc = (crc >> 8) ^ detail::CRC32_TABLE.table[(crc ^ *bytes++) & 0xFF];
+        }
+        return crc ^ 0xFFFFFFFF;
+    }
+
+    /// \returns true, if the file starts like a map file. Used to tell it apart from old map.bag files.
+    inline bool isMapFile(const std::string &filename) {
+        char magic[sizeof(MAGIC)];
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        bool result = ::read(fd, magic, sizeof(magic)) == sizeof(magic) && memcmp(magic, MAGIC, sizeof(MAGIC)) == 0;
+        ::close(fd);
+        return result;
+    }
+
+    /// \brief Serialize the map and atomically replace the file with it.
+    /// \param docking_point nullptr, if there is none.
+    /// \param error Set to the reason, if it failed.
+    /// \returns false, if the file could not be written. The old file is left as it was in that case, unless only
+    /// syncing the directory failed. Then the new file is in place, but the rename might not survive a power loss.
+    inline bool write(const std::string &filename, const std::vector<mower_map::MapArea> &navigation_areas,
+                      const std::vector<mower_map::MapArea> &mowing_areas, const geometry_msgs::Pose *docking_point,
+                      std::string &error) {
+        std::vector<AreaRecord> areas;
+        std::vector<PolygonRecord> polygons;
+        std::vector<Vertex> vertices;
+        std::string names;
+        auto addPolygon = [&](const geometry_msgs::Polygon &polygon) {
+            polygons.push_back({static_cast<uint32_t>(vertices.size()), static_cast<uint32_t>(polygon.points.size())});
+            for (const auto &point: polygon.points) {
+                vertices.push_back({point.x, point.y, point.z});
+            }
+        };
+        for (const auto *list: {&navigation_areas, &mowing_areas}) {
+            for (const auto &area: *list) {
+                AreaRecord record = {};
+                record.type = list == &navigation_areas ? NAVIGATION_AREA : MOWING_AREA;
+                record.name_offset = names.size();
+                record.name_size = area.name.size();
+                record.first_polygon = polygons.size();
+                record.polygon_count = 1 + area.obstacles.size();
+                areas.push_back(record);
+                names += area.name;
+                addPolygon(area.area);
+                for (const auto &obstacle: area.obstacles) {
+                    addPolygon(obstacle);
+                }
+            }
+        }
+
+        FileHeader header = {};
+        memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = VERSION;
+        header.area_count = areas.size();
+        header.polygon_count = polygons.size();
+        header.vertex_count = vertices.size();
+        header.name_size = names.size();
+        if (docking_point) {
+            header.flags |= HAS_DOCKING_POINT;
+            const auto &p = docking_point->position;
+            const auto &q = docking_point->orientation;
+            double pose[7] = {p.x, p.y, p.z, q.x, q.y, q.z, q.w};
+            memcpy(header.docking_pose, pose, sizeof(pose));
+        }
+
+        std::vector<uint8_t> data(sizeof(FileHeader) + areas.size() * sizeof(AreaRecord) +
+                                  polygons.size() * sizeof(PolygonRecord) + vertices.size() * sizeof(Vertex) +
+                                  names.size());
+        uint8_t *ptr = data.data() + sizeof(FileHeader);
+        auto append = [&ptr](const void *bytes, size_t size) {
+            if (size > 0) {
+                memcpy(ptr, bytes, size);
+                ptr += size;
+            }
+        };
+        append(areas.data(), areas.size() * sizeof(AreaRecord));
+        append(polygons.data(), polygons.size() * sizeof(PolygonRecord));
+        append(vertices.data(), vertices.size() * sizeof(Vertex));
+        append(names.data(), names.size());
+        header.checksum = crc32(data.data() + sizeof(FileHeader), data.size() - sizeof(FileHeader));
+        memcpy(data.data(), &header, sizeof(header));
+
+        std::string temp_filename = filename + ".tmp";
+        int fd = ::open(temp_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            error = "Error creating " + temp_filename + ": " + strerror(errno);
+            return false;
+        }
+        size_t written = 0;
+        while (written < data.size()) {
+            ssize_t result = ::write(fd, data.data() + written, data.size() - written);
+            if (result < 0 && errno == EINTR) {
+                continue;
+            }
+            if (result <= 0) {
+                error = "Error writing " + temp_filename + ": " + strerror(errno);
+                ::close(fd);
+                unlink(temp_filename.c_str());
+                return false;
+            }
+            written += result;
+        }
+        if (fsync(fd) != 0) {
+            error = "Error syncing " + temp_filename + ": " + strerror(errno);
+            ::close(fd);
+            unlink(temp_filename.c_str());
+            return false;
+        }
+        ::close(fd);
+        if (rename(temp_filename.c_str(), filename.c_str()) != 0) {
+            error = "Error replacing " + filename + ": " + strerror(errno);
+            unlink(temp_filename.c_str());
+            return false;
+        }
+
+        // Sync the directory as well, otherwise the rename itself could be lost
+        size_t slash = filename.find_last_of('/');
+        std::string directory = slash == std::string::npos ? "." : filename.substr(0, std::max<size_t>(slash, 1));
+        int dir_fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dir_fd < 0) {
+            error = "Error opening " + directory + " to sync it: " + strerror(errno);
+            return false;
+        }
+        if (fsync(dir_fd) != 0) {
+            error = "Error syncing " + directory + ": " + strerror(errno);
+            ::close(dir_fd);
+            return false;
+        }
+        ::close(dir_fd);
+        return true;
+    }
+
+    /// \brief Reads a map file through a read only mapping.
+    class Reader {
+    public:
+        Reader() = default;
+
+        Reader(const Reader &) = delete;
+
+        Reader &operator=(const Reader &) = delete;
+
+        ~Reader() {
+            if (data_) {
+                munmap(const_cast<uint8_t *>(data_), size_);
+            }
+        }
+
+        /// \param error Set to the reason, if it failed.
+        /// \returns false, if the file can't be read, is not a map file or is damaged.
+        bool open(const std::string &filename, std::string &error) {
+            int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0) {
+                error = "Error opening " + filename + ": " + strerror(errno);
+                return false;
+            }
+            struct stat st = {};
+            if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(FileHeader))) {
+                error = filename + " is too short";
+                ::close(fd);
+                return false;
+            }
+            void *mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if (mapped == MAP_FAILED) {
+                error = "Error mapping " + filename + ": " + strerror(errno);
+                return false;
+            }
+            data_ = static_cast<const uint8_t *>(mapped);
+            size_ = st.st_size;
+
+            memcpy(&header_, data_, sizeof(header_));
+            if (memcmp(header_.magic, MAGIC, sizeof(MAGIC)) != 0) {
+                error = filename + " is not a map file";
+                return false;
+            }
+            if (header_.version > VERSION) {
+                error = filename + " has version " + std::to_string(header_.version) + ", only " +
+                        std::to_string(VERSION) + " is supported";
+                return false;
+            }
+            uint64_t expected_size = sizeof(FileHeader) + uint64_t(header_.area_count) * sizeof(AreaRecord) +
+                                     uint64_t(header_.polygon_count) * sizeof(PolygonRecord) +
+                                     uint64_t(header_.vertex_count) * sizeof(Vertex) + header_.name_size;
+            if (expected_size != size_) {
+                error = filename + " has " + std::to_string(size_) + " bytes, expected " +
+                        std::to_string(expected_size);
+                return false;
+            }
+            if (crc32(data_ + sizeof(FileHeader), size_ - sizeof(FileHeader)) != header_.checksum) {
+                error = filename + " is damaged (checksum mismatch)";
+                return false;
+            }
+
+            areas_ = reinterpret_cast<const AreaRecord *>(data_ + sizeof(FileHeader));
+            polygons_ = reinterpret_cast<const PolygonRecord *>(areas_ + header_.area_count);
+            vertices_ = reinterpret_cast<const Vertex *>(polygons_ + header_.polygon_count);
+            names_ = reinterpret_cast<const char *>(vertices_ + header_.vertex_count);
+
+            // Check the ranges once, so the accessors don't need to
+            for (size_t i = 0; i < header_.area_count; i++) {
+                const AreaRecord &area = areas_[i];
+                if (uint64_t(area.name_offset) + area.name_size > header_.name_size ||
+                    area.polygon_count == 0 ||
+                    uint64_t(area.first_polygon) + area.polygon_count > header_.polygon_count) {
+                    error = filename + " has an invalid area " + std::to_string(i);
+                    return false;
+                }
+            }
+            for (size_t i = 0; i < header_.polygon_count; i++) {
+                const PolygonRecord &polygon = polygons_[i];
+                if (uint64_t(polygon.first_vertex) + polygon.vertex_count > header_.vertex_count) {
+                    error = filename + " has an invalid polygon " + std::to_string(i);
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        size_t areaCount() const {
+            return header_.area_count;
+        }
+
+        const AreaRecord &area(size_t index) const {
+            return areas_[index];
+        }
+
+        std::string areaName(size_t index) const {
+            return std::string(names_ + areas_[index].name_offset, areas_[index].name_size);
+        }
+
+        const PolygonRecord &polygon(size_t index) const {
+            return polygons_[index];
+        }
+
+        /// \brief The vertices of a polygon, they point into the mapped file.
+        const Vertex *vertices(const PolygonRecord &polygon) const {
+            return vertices_ + polygon.first_vertex;
+        }
+
+        bool hasDockingPoint() const {
+            return (header_.flags & HAS_DOCKING_POINT) != 0;
+        }
+
+        geometry_msgs::Pose dockingPoint() const {
+            double pose[7];
+            memcpy(pose, header_.docking_pose, sizeof(pose));
+            geometry_msgs::Pose result;
+            result.position.x = pose[0];
+            result.position.y = pose[1];
+            result.position.z = pose[2];
+            result.orientation.x = pose[3];
+            result.orientation.y = pose[4];
+            result.orientation.z = pose[5];
+            result.orientation.w = pose[6];
+            return result;
+        }
+
+        /// \brief Copy an area into a message.
+        mower_map::MapArea toMessage(size_t index) const {
+            const AreaRecord &record = areas_[index];
+            mower_map::MapArea area;
+            area.name = areaName(index);
+            for (uint32_t p = 0; p < record.polygon_count; p++) {
+                const PolygonRecord &polygon = polygons_[record.first_polygon + p];
+                geometry_msgs::Polygon &out = p == 0 ? area.area : *area.obstacles.emplace(area.obstacles.end());
+                out.points.resize(polygon.vertex_count);
+                const Vertex *vertex = vertices(polygon);
+                for (uint32_t v = 0; v < polygon.vertex_count; v++, vertex++) {
+                    out.points[v].x = vertex->x;
+                    out.points[v].y = vertex->y;
+                    out.points[v].z = vertex->z;
+                }
+            }
+            return area;
+        }
+
+    private:
+        const uint8_t *data_ = nullptr;
+        size_t size_ = 0;
+        FileHeader header_ = {};
+        const AreaRecord *areas_ = nullptr;
+        const PolygonRecord *polygons_ = nullptr;
+        const Vertex *vertices_ = nullptr;
+        const char *names_ = nullptr;
+    };
+}
+
+
+#endif //SRC_MAPFILE_H
@@ -0,0 +1,526 @@
+// Copyright (c) 2022 Clemens Elflein. All rights reserved.
+//
+// This work is licensed under a Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//
+// Feel free to use the design in your private/educational projects, but don't try to sell the design or products based on it without getting my consent first.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//
+
+#ifndef SRC_MAPINDEX_H
+#define SRC_MAPINDEX_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <queue>
+#include <vector>
+
+#include <Eigen/Core>
+
+#include "mower_map/MapArea.h"
+#include "MapRaster.h"
+
+
+/// \brief Bounding volume hierarchy over boxes, packed with Sort-Tile-Recursive.
+///
+/// Items are sorted into tiles by x, then by y within each tile, and groups of FANOUT consecutive items become the
+/// leaves. The leaves are packed the same way into the next level, until one root is left. Every node covers a
+/// contiguous range of the level below, so the tree is just an array of nodes and a permutation of the items.
+class PackedBvh {
+public:
+    // An enumerator, so std::min() can take it by reference without a definition outside the class
+    enum : uint32_t { FANOUT = 8 };
+
+    PackedBvh() = default;
+
+    explicit PackedBvh(const std::vector<Bounds> &items) {
+        build(items);
+    }
+
+    bool empty() const {
+        return nodes_.empty();
+    }
+
+    const Bounds &bounds() const {
+        static const Bounds none;
+        return nodes_.empty() ? none : nodes_.back().bounds;
+    }
+
+    /// \brief Depth first search.
+    /// \param descend Called with the bounds of each node and item, only those returning true are visited.
+    /// \param visit Called with the index of each item that passed descend().
+    template<typename Descend, typename Visit>
+    void visit(Descend descend, Visit visit) const {
+        if (nodes_.empty()) {
+            return;
+        }
+        uint32_t stack[64];
+        size_t stack_size = 0;
+        stack[stack_size++] = nodes_.size() - 1;
+        while (stack_size > 0) {
+            const Node &node = nodes_[stack[--stack_size]];
+            if (!descend(node.bounds)) {
+                continue;
+            }
+            for (uint32_t i = node.first; i < node.first + node.count; i++) {
+                if (node.leaf) {
+                    if (descend(item_bounds_[i])) {
+                        visit(items_[i]);
+                    }
+                } else {
+                    stack[stack_size++] = i;
+                }
+            }
+        }
+    }
+
+    /// \brief Best first search for the item closest to a point.
+    /// \param best_d2 Squared distance of the best item found so far. Subtrees further away are skipped.
+    /// \param distance Called as distance(item, best_d2) for each item that could be closer. Lowers best_d2 if it is.
+    template<typename Distance>
+    void nearest(const Eigen::Vector2d &point, double &best_d2, Distance distance) const {
+        if (nodes_.empty()) {
+            return;
+        }
+        typedef std::pair<double, uint32_t> Entry;
+        std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> queue;
+        queue.emplace(squaredDistance(nodes_.back().bounds, point), nodes_.size() - 1);
+        while (!queue.empty()) {
+            Entry entry = queue.top();
+            queue.pop();
+            if (entry.first >= best_d2) {
+                break;
+            }
+            const Node &node = nodes_[entry.second];
+            for (uint32_t i = node.first; i < node.first + node.count; i++) {
+                if (node.leaf) {
+                    if (squaredDistance(item_bounds_[i], point) < best_d2) {
+                        distance(items_[i], best_d2);
+                    }
+                } else {
+                    double d2 = squaredDistance(nodes_[i].bounds, point);
+                    if (d2 < best_d2) {
+                        queue.emplace(d2, i);
+                    }
+                }
+            }
+        }
+    }
+
+    static double squaredDistance(const Bounds &bounds, const Eigen::Vector2d &point) {
+        double dx = std::max(0.0, std::max(bounds.min_x - point.x(), point.x() - bounds.max_x));
+        double dy = std::max(0.0, std::max(bounds.min_y - point.y(), point.y() - bounds.max_y));
+        return dx * dx + dy * dy;
+    }
+
+    static bool overlaps(const Bounds &a, const Bounds &b) {
+        return a.min_x <= b.max_x && b.min_x <= a.max_x && a.min_y <= b.max_y && b.min_y <= a.max_y;
+    }
+
+private:
+    struct Node {
+        Bounds bounds;
+        uint32_t first;
+        uint32_t count;
+        bool leaf;
+    };
+
+    // Sort into vertical tiles by x, then each tile by y
+    template<typename Center>
+    static void sortTiles(std::vector<uint32_t> &order, Center center) {
+        size_t groups = (order.size() + FANOUT - 1) / FANOUT;
+        size_t tiles = static_cast<size_t>(std::ceil(std::sqrt(static_cast<double>(groups))));
+        size_t tile_size = tiles * FANOUT;
+        std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+            return center(a).x() < center(b).x();
+        });
+        for (size_t start = 0; start < order.size(); start += tile_size) {
+            auto end = order.begin() + std::min(order.size(), start + tile_size);
+            std::sort(order.begin() + start, end, [&](uint32_t a, uint32_t b) {
+                return center(a).y() < center(b).y();
+            });
+        }
+    }
+
+    static Eigen::Vector2d centerOf(const Bounds &bounds) {
+        return Eigen::Vector2d((bounds.min_x + bounds.max_x) / 2.0, (bounds.min_y + bounds.max_y) / 2.0);
+    }
+
+    void build(const std::vector<Bounds> &items) {
+        nodes_.clear();
+        items_.clear();
+        item_bounds_.clear();
+        for (uint32_t i = 0; i < items.size(); i++) {
+            if (!items[i].empty()) {
+                items_.push_back(i);
+            }
+        }
+        if (items_.empty()) {
+            return;
+        }
+        sortTiles(items_, [&items](uint32_t i) { return centerOf(items[i]); });
+        for (uint32_t i: items_) {
+            item_bounds_.push_back(items[i]);
+        }
+
+        // Leaves
+        size_t level_start = 0;
+        for (uint32_t first = 0; first < items_.size(); first += FANOUT) {
+            Node node = {};
+            node.first = first;
+            node.count = std::min<uint32_t>(FANOUT, items_.size() - first);
+            node.leaf = true;
+            for (uint32_t i = first; i < first + node.count; i++) {
+                node.bounds.add(item_bounds_[i]);
+            }
+            nodes_.push_back(node);
+        }
+
+        // Inner levels. The nodes of a level are reordered before their parents are created.
+        while (nodes_.size() - level_start > 1) {
+            std::vector<uint32_t> order(nodes_.size() - level_start);
+            for (uint32_t i = 0; i < order.size(); i++) {
+                order[i] = level_start + i;
+            }
+            std::vector<Node> level(nodes_.begin() + level_start, nodes_.end());
+            sortTiles(order, [this](uint32_t i) { return centerOf(nodes_[i].bounds); });
+            for (uint32_t i = 0; i < order.size(); i++) {
+                level[i] = nodes_[order[i]];
+            }
+            std::copy(level.begin(), level.end(), nodes_.begin() + level_start);
+
+            size_t level_end = nodes_.size();
+            for (uint32_t first = level_start; first < level_end; first += FANOUT) {
+                Node node = {};
+                node.first = first;
+                node.count = std::min<uint32_t>(FANOUT, level_end - first);
+                node.leaf = false;
+                for (uint32_t i = first; i < first + node.count; i++) {
+                    node.bounds.add(nodes_[i].bounds);
+                }
+                nodes_.push_back(node);
+            }
+            level_start = level_end;
+        }
+    }
+
+    // Levels from the leaves up, the root is the last node
+    std::vector<Node> nodes_;
+    // Item indices in tree order, and their bounds
+    std::vector<uint32_t> items_;
+    std::vector<Bounds> item_bounds_;
+};
+
+/// \brief Which part of the map an edge belongs to.
+struct MapFeature {
+    enum AreaType : uint8_t {
+        NAVIGATION_AREA = 0,
+        MOWING_AREA = 1
+    };
+
+    AreaType type;
+    // Index in navigation_areas or mowing_areas
+    int32_t area_index;
+    // -1 for the outline of the area
+    int32_t obstacle_index;
+};
+
+/// \brief Closest point on an edge of the map.
+struct NearestEdge {
+    bool found = false;
+    double distance = std::numeric_limits<double>::infinity();
+    Eigen::Vector2d point;
+    MapFeature feature = {};
+};
+
+/// \brief First point where a segment crosses an edge of the map.
+struct SegmentHit {
+    bool found = false;
+    // Position along the segment, 0 at the start and 1 at the end
+    double t = std::numeric_limits<double>::infinity();
+    Eigen::Vector2d point;
+    MapFeature feature = {};
+};
+
+/// \brief The edges of one area (outline and obstacles) in a PackedBvh.
+///
+/// Built once per area and never changed, editing the map only creates or drops whole AreaIndex objects.
+class AreaIndex {
+public:
+    explicit AreaIndex(const mower_map::MapArea &area) {
+        addPolygon(area.area, -1);
+        for (size_t i = 0; i < area.obstacles.size(); i++) {
+            addPolygon(area.obstacles[i], static_cast<int32_t>(i));
+        }
+        polygon_count_ = 1 + area.obstacles.size();
+
+        std::vector<Bounds> edge_bounds(edges_.size());
+        for (size_t i = 0; i < edges_.size(); i++) {
+            edge_bounds[i].add(edges_[i].a.x(), edges_[i].a.y());
+            edge_bounds[i].add(edges_[i].b.x(), edges_[i].b.y());
+        }
+        bvh_ = PackedBvh(edge_bounds);
+    }
+
+    const Bounds &bounds() const {
+        return bvh_.bounds();
+    }
+
+    /// \returns true, if the point is inside the outline and outside of all obstacles.
+    /// Uses the same even-odd rule as grid_map::Polygon::isInside.
+    bool contains(const Eigen::Vector2d &point) const {
+        if (PackedBvh::squaredDistance(bounds(), point) > 0.0) {
+            return false;
+        }
+        // Crossings of a ray from the point towards +x, per polygon
+        std::vector<uint8_t> inside(polygon_count_, 0);
+        bvh_.visit([&point](const Bounds &b) {
+            return b.min_y <= point.y() && point.y() <= b.max_y && point.x() <= b.max_x;
+        }, [&](uint32_t i) {
+            const Edge &edge = edges_[i];
+            if ((edge.a.y() > point.y()) != (edge.b.y() > point.y()) &&
+                point.x() < (edge.b.x() - edge.a.x()) * (point.y() - edge.a.y()) / (edge.b.y() - edge.a.y()) +
+                            edge.a.x()) {
+                inside[edge.obstacle_index + 1] ^= 1;
+            }
+        });
+        return inside[0] && std::find(inside.begin() + 1, inside.end(), 1) == inside.end();
+    }
+
+    /// \brief Update result, if an edge of this area is closer than result.distance.
+    void nearestEdge(const Eigen::Vector2d &point, double &best_d2, NearestEdge &result) const {
+        bvh_.nearest(point, best_d2, [&](uint32_t i, double &d2) {
+            const Edge &edge = edges_[i];
+            Eigen::Vector2d closest = closestPoint(edge.a, edge.b, point);
+            double distance2 = (closest - point).squaredNorm();
+            if (distance2 < d2) {
+                d2 = distance2;
+                result.found = true;
+                result.point = closest;
+                result.feature.obstacle_index = edge.obstacle_index;
+            }
+        });
+    }
+
+    /// \brief Update result, if the segment crosses an edge of this area before result.t.
+    /// \returns true, if result was updated.
+    bool intersect(const Eigen::Vector2d &start, const Eigen::Vector2d &end, SegmentHit &result) const {
+        Bounds segment;
+        segment.add(start.x(), start.y());
+        segment.add(end.x(), end.y());
+        bool updated = false;
+        bvh_.visit([&segment](const Bounds &b) {
+            return PackedBvh::overlaps(b, segment);
+        }, [&](uint32_t i) {
+            double t;
+            if (intersectSegments(start, end, edges_[i].a, edges_[i].b, t) && t < result.t) {
+                result.found = true;
+                result.t = t;
+                result.point = start + t * (end - start);
+                result.feature.obstacle_index = edges_[i].obstacle_index;
+                updated = true;
+            }
+        });
+        return updated;
+    }
+
+    static Eigen::Vector2d closestPoint(const Eigen::Vector2d &a, const Eigen::Vector2d &b,
+                                        const Eigen::Vector2d &point) {
+        Eigen::Vector2d ab = b - a;
+        double length2 = ab.squaredNorm();
+        if (length2 == 0.0) {
+            return a;
+        }
+        double t = std::max(0.0, std::min(1.0, (point - a).dot(ab) / length2));
+        return a + t * ab;
+    }
+
+    /// \brief Intersection of the segments p0-p1 and q0-q1.
+    /// \param t Set to the position of the first common point on p0-p1, 0 at p0 and 1 at p1.
+    static bool intersectSegments(const Eigen::Vector2d &p0, const Eigen::Vector2d &p1, const Eigen::Vector2d &q0,
+                                  const Eigen::Vector2d &q1, double &t) {
+        Eigen::Vector2d r = p1 - p0;
+        Eigen::Vector2d s = q1 - q0;
+        Eigen::Vector2d qp = q0 - p0;
+        double denominator = cross(r, s);
+        if (denominator != 0.0) {
+            double tp = cross(qp, s) / denominator;
+            double tq = cross(qp, r) / denominator;
+            if (tp < 0.0 || tp > 1.0 || tq < 0.0 || tq > 1.0) {
+                return false;
+            }
+            t = tp;
+            return true;
+        }
+        if (cross(qp, r) != 0.0) {
+            // Parallel
+            return false;
+        }
+        double r2 = r.squaredNorm();
+        if (r2 == 0.0) {
+            // p is a point on the line of q, it is only a hit if it's on the segment
+            if ((closestPoint(q0, q1, p0) - p0).squaredNorm() != 0.0) {
+                return false;
+            }
+            t = 0.0;
+            return true;
+        }
+        // Collinear, find where the projection of q overlaps [0, 1]
+        double t0 = qp.dot(r) / r2;
+        double t1 = t0 + s.dot(r) / r2;
+        double lo = std::min(t0, t1), hi = std::max(t0, t1);
+        if (hi < 0.0 || lo > 1.0) {
+            return false;
+        }
+        t = std::max(0.0, lo);
+        return true;
+    }
+
+private:
+    struct Edge {
+        Eigen::Vector2d a, b;
+        int32_t obstacle_index;
+    };
+
+    static double cross(const Eigen::Vector2d &a, const Eigen::Vector2d &b) {
+        return a.x() * b.y() - a.y() * b.x();
+    }
+
+    void addPolygon(const geometry_msgs::Polygon &polygon, int32_t obstacle_index) {
+        const auto &points = polygon.points;
+        for (size_t i = 0, j = points.size() - 1; i < points.size(); j = i++) {
+            edges_.push_back({Eigen::Vector2d(points[j].x, points[j].y), Eigen::Vector2d(points[i].x, points[i].y),
+                              obstacle_index});
+        }
+    }
+
+    std::vector<Edge> edges_;
+    size_t polygon_count_ = 0;
+    PackedBvh bvh_;
+};
+
+/// \brief Spatial index over all areas of the map.
+///
+/// Two levels: every area has its own AreaIndex over its edges, and a small PackedBvh over the area bounds sits on
+/// top. Edits only build the AreaIndex of the changed area and repack the top level, which has one item per area.
+/// Keep the lists in the same order as navigation_areas and mowing_areas.
+class MapIndex {
+public:
+    /// \brief Index all areas from scratch, e.g. after loading the map.
+    void rebuild(const std::vector<mower_map::MapArea> &navigation_areas,
+                 const std::vector<mower_map::MapArea> &mowing_areas) {
+        for (int type = 0; type < 2; type++) {
+            const auto &areas = type == MapFeature::NAVIGATION_AREA ? navigation_areas : mowing_areas;
+            areas_[type].clear();
+            for (const auto &area: areas) {
+                areas_[type].push_back(std::make_shared<const AreaIndex>(area));
+            }
+        }
+        repack();
+    }
+
+    void add(MapFeature::AreaType type, const mower_map::MapArea &area) {
+        areas_[type].push_back(std::make_shared<const AreaIndex>(area));
+        repack();
+    }
+
+    void erase(MapFeature::AreaType type, size_t index) {
+        areas_[type].erase(areas_[type].begin() + index);
+        repack();
+    }
+
+    /// \brief Move a mowing area to the end of the navigation areas, like convertToNavigationArea() does.
+    void convertToNavigationArea(size_t index) {
+        auto &mowing = areas_[MapFeature::MOWING_AREA];
+        areas_[MapFeature::NAVIGATION_AREA].push_back(mowing[index]);
+        mowing.erase(mowing.begin() + index);
+        repack();
+    }
+
+    void clear() {
+        areas_[MapFeature::NAVIGATION_AREA].clear();
+        areas_[MapFeature::MOWING_AREA].clear();
+        repack();
+    }
+
+    /// \brief Lowest index of an area of the given type containing the point, -1 if there is none.
+    int32_t containingArea(MapFeature::AreaType type, const Eigen::Vector2d &point) const {
+        int32_t result = -1;
+        top_.visit([&point](const Bounds &b) {
+            return PackedBvh::squaredDistance(b, point) == 0.0;
+        }, [&](uint32_t i) {
+            const MapFeature &feature = features_[i];
+            if (feature.type == type && (result < 0 || feature.area_index < result) &&
+                areas_[type][feature.area_index]->contains(point)) {
+                result = feature.area_index;
+            }
+        });
+        return result;
+    }
+
+    NearestEdge nearestEdge(const Eigen::Vector2d &point) const {
+        NearestEdge result;
+        double best_d2 = std::numeric_limits<double>::infinity();
+        top_.nearest(point, best_d2, [&](uint32_t i, double &d2) {
+            const MapFeature &feature = features_[i];
+            double before = d2;
+            areas_[feature.type][feature.area_index]->nearestEdge(point, d2, result);
+            if (d2 < before) {
+                result.feature.type = feature.type;
+                result.feature.area_index = feature.area_index;
+            }
+        });
+        result.distance = std::sqrt(best_d2);
+        return result;
+    }
+
+    /// \brief The first edge crossed when going from start to end.
+    SegmentHit intersect(const Eigen::Vector2d &start, const Eigen::Vector2d &end) const {
+        SegmentHit result;
+        Bounds segment;
+        segment.add(start.x(), start.y());
+        segment.add(end.x(), end.y());
+        top_.visit([&segment](const Bounds &b) {
+            return PackedBvh::overlaps(b, segment);
+        }, [&](uint32_t i) {
+            const MapFeature &feature = features_[i];
+            if (areas_[feature.type][feature.area_index]->intersect(start, end, result)) {
+                result.feature.type = feature.type;
+                result.feature.area_index = feature.area_index;
+            }
+        });
+        return result;
+    }
+
+private:
+    void repack() {
+        features_.clear();
+        std::vector<Bounds> bounds;
+        for (int type = 0; type < 2; type++) {
+            for (size_t i = 0; i < areas_[type].size(); i++) {
+                features_.push_back({static_cast<MapFeature::AreaType>(type), static_cast<int32_t>(i), -1});
+                bounds.push_back(areas_[type][i]->bounds());
+            }
+        }
+        top_ = PackedBvh(bounds);
+    }
+
+    // Indexed by MapFeature::AreaType
+    std::vector<std::shared_ptr<const AreaIndex>> areas_[2];
+    // Top level items
+    std::vector<MapFeature> features_;
+    PackedBvh top_;
+};
+
+
+#endif //SRC_MAPINDEX_H
@@ -0,0 +1,168 @@
+// Copyright (c) 2022 Clemens Elflein. All rights reserved.
+//
+// This work is licensed under a Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//
+// Feel free to use the design in your private/educational projects, but don't try to sell the design or products based on it without getting my consent first.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//
+
+#ifndef SRC_MAPPERSISTENCE_H
+#define SRC_MAPPERSISTENCE_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "geometry_msgs/Pose.h"
+#include "mower_map/MapArea.h"
+#include "MapFile.h"
+
+
+/// \brief Everything that is stored in the map file. Never changed after it was handed to MapPersistence.
+struct MapSnapshot {
+    std::vector<mower_map::MapArea> navigation_areas;
+    std::vector<mower_map::MapArea> mowing_areas;
+    bool has_docking_point = false;
+    geometry_msgs::Pose docking_point;
+    // Counts up with every change, see MapPersistence::save()
+    uint64_t version = 0;
+};
+
+/// \brief Outcome of one write, passed to the status callback.
+struct MapSaveResult {
+    // Version of the snapshot that was written
+    uint64_t version;
+    // Latest version handed to save() at the time the write finished
+    uint64_t latest_version;
+    bool success;
+    std::string error;
+    // Snapshots that were replaced by a newer one before they could be written
+    uint32_t coalesced;
+    double duration_ms;
+};
+
+/// \brief Writes map snapshots in a background thread, so the services don't wait for the SD card.
+///
+/// Only the latest snapshot is kept. If more changes come in while a write is running, the ones in between are
+/// never written, the next write stores the newest one. The status callback is called from the worker thread.
+class MapPersistence {
+public:
+    typedef std::function<void(const MapSaveResult &)> StatusCallback;
+
+    MapPersistence(std::string filename, StatusCallback callback)
+            : filename_(std::move(filename)), callback_(std::move(callback)),
+              worker_(&MapPersistence::workerLoop, this) {
+    }
+
+    /// \brief Writes everything still pending before it returns.
+    ~MapPersistence() {
+        {
+            std::unique_lock<std::mutex> lk(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        worker_.join();
+    }
+
+    MapPersistence(const MapPersistence &) = delete;
+
+    MapPersistence &operator=(const MapPersistence &) = delete;
+
+    /// \brief Queue a snapshot for writing and return immediately. Replaces a snapshot still waiting.
+    /// \returns The version assigned to the snapshot.
+    uint64_t save(std::shared_ptr<MapSnapshot> snapshot) {
+        std::unique_lock<std::mutex> lk(mutex_);
+        snapshot->version = ++latest_version_;
+        if (pending_) {
+            coalesced_++;
+        }
+        pending_ = std::move(snapshot);
+        lk.unlock();
+        cv_.notify_all();
+        return latest_version_;
+    }
+
+    /// \brief Wait until the pending snapshot was written.
+    /// \returns true, if the latest version is on disk.
+    bool flush() {
+        std::unique_lock<std::mutex> lk(mutex_);
+        cv_.wait(lk, [this] { return !pending_ && !writing_; });
+        return saved_version_ == latest_version_;
+    }
+
+private:
+    void workerLoop() {
+        std::unique_lock<std::mutex> lk(mutex_);
+        while (true) {
+            cv_.wait(lk, [this] { return pending_ || stop_; });
+            if (!pending_) {
+                // Only exit once nothing is pending
+                return;
+            }
+            std::shared_ptr<const MapSnapshot> snapshot = std::move(pending_);
+            pending_.reset();
+            writing_ = true;
+            uint32_t coalesced = coalesced_;
+            coalesced_ = 0;
+            lk.unlock();
+
+            MapSaveResult result = {};
+            result.version = snapshot->version;
+            result.coalesced = coalesced;
+            auto start = std::chrono::steady_clock::now();
+            result.success = map_file::write(filename_, snapshot->navigation_areas, snapshot->mowing_areas,
+                                             snapshot->has_docking_point ? &snapshot->docking_point : nullptr,
+                                             result.error);
+            result.duration_ms = std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - start).count();
+            snapshot.reset();
+
+            lk.lock();
+            if (result.success) {
+                saved_version_ = result.version;
+            }
+            result.latest_version = latest_version_;
+            lk.unlock();
+            if (callback_) {
+                callback_(result);
+            }
+
+            // flush() returns only after the result was reported
+            lk.lock();
+            writing_ = false;
+            cv_.notify_all();
+        }
+    }
+
+    const std::string filename_;
+    const StatusCallback callback_;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::shared_ptr<const MapSnapshot> pending_;
+    uint64_t latest_version_ = 0;
+    uint64_t saved_version_ = 0;
+    uint32_t coalesced_ = 0;
+    bool writing_ = false;
+    bool stop_ = false;
+
+    // Last member, so everything above is initialized before the thread starts
+    std::thread worker_;
+};
+
+
+#endif //SRC_MAPPERSISTENCE_H
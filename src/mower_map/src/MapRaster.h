@@ -0,0 +1,381 @@
+// Copyright (c) 2022 Clemens Elflein. All rights reserved.
+//
+// This work is licensed under a Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//
+// Feel free to use the design in your private/educational projects, but don't try to sell the design or products based on it without getting my consent first.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//
+
+#ifndef SRC_MAPRASTER_H
+#define SRC_MAPRASTER_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include <grid_map_core/GridMap.hpp>
+#include <grid_map_core/Polygon.hpp>
+
+#include "WorkStealingPool.h"
+
+
+/// \brief The map before blurring, 1 for occupied and 0 for free cells. Uses the indices of the grid map layers.
+typedef Eigen::Matrix<uint8_t, Eigen::Dynamic, Eigen::Dynamic> OccupancyMatrix;
+
+/// \brief Axis aligned box in map coordinates.
+struct Bounds {
+    double min_x = std::numeric_limits<double>::infinity();
+    double min_y = std::numeric_limits<double>::infinity();
+    double max_x = -std::numeric_limits<double>::infinity();
+    double max_y = -std::numeric_limits<double>::infinity();
+
+    bool empty() const {
+        return min_x > max_x || min_y > max_y;
+    }
+
+    void add(double x, double y) {
+        min_x = std::min(min_x, x);
+        min_y = std::min(min_y, y);
+        max_x = std::max(max_x, x);
+        max_y = std::max(max_y, y);
+    }
+
+    void add(const Bounds &other) {
+        if (!other.empty()) {
+            add(other.min_x, other.min_y);
+            add(other.max_x, other.max_y);
+        }
+    }
+
+    bool operator==(const Bounds &other) const {
+        return min_x == other.min_x && min_y == other.min_y && max_x == other.max_x && max_y == other.max_y;
+    }
+
+    bool operator!=(const Bounds &other) const {
+        return !(*this == other);
+    }
+};
+
+/// \brief A rectangle of cells in grid map indices, [start, end) in both dimensions.
+///
+/// The maps built here never move, so the buffer start index is always zero and indices don't wrap.
+struct CellRect {
+    grid_map::Index start = grid_map::Index::Zero();
+    grid_map::Index end = grid_map::Index::Zero();
+
+    bool empty() const {
+        return (end <= start).any();
+    }
+
+    grid_map::Size size() const {
+        return empty() ? grid_map::Size::Zero() : grid_map::Size(end - start);
+    }
+
+    /// \brief Grow by the given number of cells on every side, but stay inside a map of the given size.
+    CellRect expanded(int cells, const grid_map::Size &map_size) const {
+        CellRect result;
+        if (empty()) {
+            return result;
+        }
+        result.start = (start - cells).max(0);
+        result.end = (end + cells).min(map_size);
+        return result;
+    }
+
+    CellRect intersection(const CellRect &other) const {
+        CellRect result;
+        result.start = start.max(other.start);
+        result.end = end.min(other.end);
+        return result;
+    }
+
+    /// \brief The smallest rectangle containing both.
+    CellRect merged(const CellRect &other) const {
+        if (empty()) {
+            return other;
+        }
+        if (other.empty()) {
+            return *this;
+        }
+        CellRect result;
+        result.start = start.min(other.start);
+        result.end = end.max(other.end);
+        return result;
+    }
+
+    static CellRect all(const grid_map::Size &map_size) {
+        CellRect result;
+        result.end = map_size;
+        return result;
+    }
+};
+
+/// \brief The cells touched by a box, clipped to the map.
+inline CellRect cellsOf(const grid_map::GridMap &map, const Bounds &bounds) {
+    CellRect rect;
+    if (bounds.empty()) {
+        return rect;
+    }
+    // Index 0 counts cells from the max x edge of the map towards min x, index 1 from max y towards min y.
+    const grid_map::Position corner = map.getPosition() + 0.5 * map.getLength().matrix();
+    const double resolution = map.getResolution();
+    const grid_map::Size &size = map.getSize();
+    auto toIndex = [&](double distance, int limit) {
+        return static_cast<int>(std::max(0.0, std::min<double>(limit, std::floor(distance / resolution))));
+    };
+    rect.start(0) = toIndex(corner.x() - bounds.max_x, size(0));
+    rect.start(1) = toIndex(corner.y() - bounds.max_y, size(1));
+    rect.end(0) = toIndex(corner.x() - bounds.min_x + resolution, size(0));
+    rect.end(1) = toIndex(corner.y() - bounds.min_y + resolution, size(1));
+    return rect;
+}
+
+/// \brief Polygon fill with an edge table and a sorted list of active edges.
+///
+/// The map is filled one column of cells at a time, i.e. one scanline of constant y, which is contiguous in
+/// memory. The inside test gives the same result as grid_map::Polygon::isInside() on the cell centers,
+/// because the crossings are calculated with the same expression and the cell centers come from the grid map.
+class ScanlineFill {
+public:
+    explicit ScanlineFill(const grid_map::Polygon &polygon) {
+        const auto &vertices = polygon.getVertices();
+        for (size_t i = 0, j = vertices.size() - 1; i < vertices.size(); j = i++) {
+            const grid_map::Position &a = vertices[i];
+            const grid_map::Position &b = vertices[j];
+            // Horizontal edges never cross a scanline
+            if (a.y() == b.y() || std::isnan(a.y()) || std::isnan(b.y())) {
+                continue;
+            }
+            edges_.push_back({a.x(), a.y(), b.x(), b.y(), std::min(a.y(), b.y()), std::max(a.y(), b.y())});
+        }
+        std::sort(edges_.begin(), edges_.end(), [](const Edge &e1, const Edge &e2) {
+            return e1.y_min < e2.y_min;
+        });
+    }
+
+    /// \brief Set all cells in rect with their center inside the polygon to value. Can be called from several
+    /// threads at once.
+    void fill(const grid_map::GridMap &map, const CellRect &rect, uint8_t value, OccupancyMatrix &cells) const {
+        if (rect.empty() || edges_.empty()) {
+            return;
+        }
+
+        // Cell center x of every row in rect, decreasing with the index
+        std::vector<double> xs(rect.size()(0));
+        grid_map::Position position;
+        for (int i = rect.start(0); i < rect.end(0); i++) {
+            map.getPosition(grid_map::Index(i, rect.start(1)), position);
+            xs[i - rect.start(0)] = position.x();
+        }
+
+        std::vector<ActiveEdge> active;
+        size_t next_edge = 0;
+        // y increases with decreasing column index, so the edge table is walked from the last column
+        for (int j = rect.end(1) - 1; j >= rect.start(1); j--) {
+            map.getPosition(grid_map::Index(rect.start(0), j), position);
+            const double y = position.y();
+
+            // An edge crosses the scanline for y_min <= y < y_max, like in isInside()
+            while (next_edge < edges_.size() && edges_[next_edge].y_min <= y) {
+                active.push_back({&edges_[next_edge], 0.0});
+                next_edge++;
+            }
+            active.erase(std::remove_if(active.begin(), active.end(), [y](const ActiveEdge &edge) {
+                return edge.edge->y_max <= y;
+            }), active.end());
+
+            for (auto &edge: active) {
+                const Edge &e = *edge.edge;
+                edge.x = (e.xj - e.xi) * (y - e.yi) / (e.yj - e.yi) + e.xi;
+            }
+            // The order changes only where edges cross, so this is close to linear
+            for (size_t k = 1; k < active.size(); k++) {
+                ActiveEdge edge = active[k];
+                size_t l = k;
+                for (; l > 0 && active[l - 1].x > edge.x; l--) {
+                    active[l] = active[l - 1];
+                }
+                active[l] = edge;
+            }
+
+            // A cell center is inside, if an odd number of crossings is right of it (x < crossing).
+            // With the crossings sorted, these are the centers in [x_0, x_1), [x_2, x_3), ...
+            for (size_t k = 0; k + 1 < active.size(); k += 2) {
+                const double x_begin = active[k].x;
+                const double x_end = active[k + 1].x;
+                auto first = std::partition_point(xs.begin(), xs.end(), [x_end](double x) { return x >= x_end; });
+                auto last = std::partition_point(first, xs.end(), [x_begin](double x) { return x >= x_begin; });
+                if (last > first) {
+                    cells.col(j).segment(rect.start(0) + (first - xs.begin()), last - first).setConstant(value);
+                }
+            }
+        }
+    }
+
+private:
+    // Edge from vertex i to vertex j, named like in grid_map::Polygon::isInside()
+    struct Edge {
+        double xi, yi, xj, yj;
+        double y_min, y_max;
+    };
+
+    struct ActiveEdge {
+        const Edge *edge;
+        // Crossing with the current scanline
+        double x;
+    };
+
+    std::vector<Edge> edges_;
+};
+
+/// \brief A polygon which sets the cells with their center inside to a value. Later operations paint over earlier ones.
+struct PaintOp {
+    grid_map::Polygon polygon;
+    Bounds bounds;
+    uint8_t value;
+    ScanlineFill scanline_fill;
+
+    PaintOp(const grid_map::Polygon &polygon, uint8_t value) : polygon(polygon), value(value),
+                                                              scanline_fill(polygon) {
+        for (const auto &vertex: polygon.getVertices()) {
+            bounds.add(vertex.x(), vertex.y());
+        }
+    }
+};
+
+/// \brief Paint the cells of a rectangle from scratch: occupied first, then every operation in order.
+///
+/// The rectangle is split into square tiles, which are painted in parallel. The tiles are aligned to the map and
+/// every tile gets the operations touching it in their original order. The cells are the same as with
+/// grid_map::PolygonIterator, so painting the map in any number of rectangles and tiles gives the same result
+/// as painting it at once.
+inline void paintCellsParallel(const grid_map::GridMap &map, const std::vector<PaintOp> &ops, const CellRect &rect,
+                               OccupancyMatrix &cells, WorkStealingPool &pool, int tile_size) {
+    if (rect.empty()) {
+        return;
+    }
+    const grid_map::Index first_tile = rect.start / tile_size;
+    const grid_map::Index tile_count = (rect.end - 1) / tile_size - first_tile + 1;
+    auto tileRect = [&](int tile_x, int tile_y) {
+        CellRect tile;
+        tile.start = (first_tile + grid_map::Index(tile_x, tile_y)) * tile_size;
+        tile.end = tile.start + tile_size;
+        return tile.intersection(rect);
+    };
+
+    // Bin the operations to the tiles they touch
+    std::vector<CellRect> op_rects(ops.size());
+    std::vector<std::vector<size_t>> tile_ops(tile_count.prod());
+    for (size_t op = 0; op < ops.size(); op++) {
+        op_rects[op] = cellsOf(map, ops[op].bounds).expanded(1, map.getSize()).intersection(rect);
+        if (op_rects[op].empty()) {
+            continue;
+        }
+        grid_map::Index op_first = op_rects[op].start / tile_size - first_tile;
+        grid_map::Index op_last = (op_rects[op].end - 1) / tile_size - first_tile;
+        for (int tile_y = op_first(1); tile_y <= op_last(1); tile_y++) {
+            for (int tile_x = op_first(0); tile_x <= op_last(0); tile_x++) {
+                tile_ops[tile_x + tile_y * tile_count(0)].push_back(op);
+            }
+        }
+    }
+
+    pool.parallelFor(tile_ops.size(), [&](size_t tile_index) {
+        CellRect tile = tileRect(tile_index % tile_count(0), tile_index / tile_count(0));
+        cells.block(tile.start(0), tile.start(1), tile.size()(0), tile.size()(1)).setConstant(1);
+        for (size_t op: tile_ops[tile_index]) {
+            ops[op].scanline_fill.fill(map, op_rects[op].intersection(tile), ops[op].value, cells);
+        }
+    });
+}
+
+/// \brief Index of a cell outside the map mirrored back into it, without repeating the border cell
+/// (like cv::BORDER_REFLECT_101).
+inline int reflectIndex(int index, int size) {
+    if (size == 1) {
+        return 0;
+    }
+    while (index < 0 || index >= size) {
+        index = index < 0 ? -index : 2 * size - 2 - index;
+    }
+    return index;
+}
+
+/// \brief Box blur of a rectangle of cells into a grid map layer, tile by tile in parallel.
+///
+/// Every tile sums the kernel with running sums, first along index 0, where the cells are contiguous, and then
+/// across the columns. Each output cell is the mean of the kernel_size x kernel_size cells around it, so the
+/// result doesn't depend on the rectangle or the tiles. At the map border, the cells are mirrored like cv::blur does.
+///
+/// \param kernel_size Must be odd.
+inline void blurCells(const OccupancyMatrix &cells, const CellRect &rect, int kernel_size, grid_map::Matrix &layer,
+                      WorkStealingPool &pool, int tile_size) {
+    if (rect.empty()) {
+        return;
+    }
+    const int radius = kernel_size / 2;
+    const float kernel_area = static_cast<float>(kernel_size * kernel_size);
+    const int size_0 = static_cast<int>(cells.rows());
+    const int size_1 = static_cast<int>(cells.cols());
+    const grid_map::Index first_tile = rect.start / tile_size;
+    const grid_map::Index tile_count = (rect.end - 1) / tile_size - first_tile + 1;
+
+    pool.parallelFor(tile_count.prod(), [&](size_t tile_index) {
+        CellRect tile;
+        tile.start = (first_tile + grid_map::Index(tile_index % tile_count(0), tile_index / tile_count(0))) * tile_size;
+        tile.end = tile.start + tile_size;
+        tile = tile.intersection(rect);
+        const int rows = tile.size()(0);
+        const int cols = tile.size()(1);
+
+        // Sums along index 0 for the columns of the tile and the kernel radius on both sides
+        Eigen::MatrixXi column_sums(rows, cols + 2 * radius);
+        for (int c = 0; c < cols + 2 * radius; c++) {
+            const auto column = cells.col(reflectIndex(tile.start(1) - radius + c, size_1));
+            int sum = 0;
+            for (int i = tile.start(0) - radius; i <= tile.start(0) + radius; i++) {
+                sum += column(reflectIndex(i, size_0));
+            }
+            column_sums(0, c) = sum;
+            for (int i = tile.start(0) + 1; i < tile.end(0); i++) {
+                sum += column(reflectIndex(i + radius, size_0)) - column(reflectIndex(i - radius - 1, size_0));
+                column_sums(i - tile.start(0), c) = sum;
+            }
+        }
+
+        // Slide the kernel across the columns
+        Eigen::VectorXi sum = column_sums.leftCols(kernel_size).rowwise().sum();
+        layer.col(tile.start(1)).segment(tile.start(0), rows) = sum.cast<float>() / kernel_area;
+        for (int c = 1; c < cols; c++) {
+            sum += column_sums.col(c + 2 * radius) - column_sums.col(c - 1);
+            layer.col(tile.start(1) + c).segment(tile.start(0), rows) = sum.cast<float>() / kernel_area;
+        }
+    });
+}
+
+/// \brief Paint and blur again everything a change inside dirty can affect.
+/// \returns The cells of the layer which were written.
+inline CellRect updateCells(const grid_map::GridMap &map, const std::vector<PaintOp> &ops, const Bounds &dirty,
+                            int kernel_size, OccupancyMatrix &cells, grid_map::Matrix &layer, WorkStealingPool &pool,
+                            int tile_size) {
+    // One more cell, in case a polygon edge is on the border of a cell
+    CellRect painted = cellsOf(map, dirty).expanded(1, map.getSize());
+    // Blurring spreads the change by the kernel radius
+    CellRect blurred = painted.expanded(kernel_size / 2, map.getSize());
+    paintCellsParallel(map, ops, painted, cells, pool, tile_size);
+    blurCells(cells, blurred, kernel_size, layer, pool, tile_size);
+    return blurred;
+}
+
+
+#endif //SRC_MAPRASTER_H
@@ -0,0 +1,155 @@
+// Copyright (c) 2022 Clemens Elflein. All rights reserved.
+//
+// This work is licensed under a Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//
+// Feel free to use the design in your private/educational projects, but don't try to sell the design or products based on it without getting my consent first.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//
+
+#ifndef SRC_WORKSTEALINGPOOL_H
+#define SRC_WORKSTEALINGPOOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+/// \brief Small thread pool for splitting one job into independent tasks.
+///
+/// Every thread has its own queue of task indices. It takes tasks from the front of its own queue and, once that
+/// is empty, steals from the back of the others. The thread calling parallelFor() works on the first queue,
+/// so a pool with one thread runs everything on the caller.
+class WorkStealingPool {
+public:
+    explicit WorkStealingPool(size_t threads) : queues_(std::max<size_t>(threads, 1)) {
+        for (size_t i = 1; i < queues_.size(); i++) {
+            workers_.emplace_back(&WorkStealingPool::workerLoop, this, i);
+        }
+    }
+
+    ~WorkStealingPool() {
+        {
+            std::unique_lock<std::mutex> lk(mutex_);
+            stop_ = true;
+        }
+        start_cv_.notify_all();
+        for (auto &worker: workers_) {
+            worker.join();
+        }
+    }
+
+    size_t threadCount() const {
+        return queues_.size();
+    }
+
+    /// \brief Call task(i) for every i in [0, count) and return, when all calls are done.
+    /// The calls can run in any order and in parallel. Only one thread may use the pool at a time.
+    void parallelFor(size_t count, const std::function<void(size_t)> &task) {
+        if (count == 0) {
+            return;
+        }
+        {
+            std::unique_lock<std::mutex> lk(mutex_);
+            task_ = &task;
+            pending_ = count;
+            // Every queue gets a contiguous range, neighbouring tasks tend to touch neighbouring memory
+            for (size_t q = 0; q < queues_.size(); q++) {
+                std::unique_lock<std::mutex> queue_lk(queues_[q].mutex);
+                for (size_t i = q * count / queues_.size(); i < (q + 1) * count / queues_.size(); i++) {
+                    queues_[q].tasks.push_back(i);
+                }
+            }
+            generation_++;
+        }
+        start_cv_.notify_all();
+
+        work(0);
+
+        std::unique_lock<std::mutex> lk(mutex_);
+        done_cv_.wait(lk, [this] { return pending_ == 0; });
+        task_ = nullptr;
+    }
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<size_t> tasks;
+    };
+
+    bool nextTask(size_t self, size_t &task) {
+        {
+            Queue &own = queues_[self];
+            std::unique_lock<std::mutex> lk(own.mutex);
+            if (!own.tasks.empty()) {
+                task = own.tasks.front();
+                own.tasks.pop_front();
+                return true;
+            }
+        }
+        for (size_t offset = 1; offset < queues_.size(); offset++) {
+            Queue &victim = queues_[(self + offset) % queues_.size()];
+            std::unique_lock<std::mutex> lk(victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = victim.tasks.back();
+                victim.tasks.pop_back();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void work(size_t self) {
+        size_t task;
+        while (nextTask(self, task)) {
+            (*task_)(task);
+            if (pending_.fetch_sub(1) == 1) {
+                std::unique_lock<std::mutex> lk(mutex_);
+                done_cv_.notify_all();
+            }
+        }
+    }
+
+    void workerLoop(size_t self) {
+        uint64_t seen_generation = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lk(mutex_);
+                start_cv_.wait(lk, [&] { return stop_ || generation_ != seen_generation; });
+                if (stop_) {
+                    return;
+                }
+                seen_generation = generation_;
+            }
+            work(self);
+        }
+    }
+
+    std::vector<Queue> queues_;
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable start_cv_;
+    std::condition_variable done_cv_;
+    const std::function<void(size_t)> *task_ = nullptr;
+    std::atomic<size_t> pending_{0};
+    uint64_t generation_ = 0;
+    bool stop_ = false;
+};
+
+
+#endif //SRC_WORKSTEALINGPOOL_H
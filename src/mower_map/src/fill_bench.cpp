@@ -0,0 +1,190 @@
+// Copyright (c) 2022 Clemens Elflein. All rights reserved.
+//
+// This work is licensed under a Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//
+// Feel free to use the design in your private/educational projects, but don't try to sell the design or products based on it without getting my consent first.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//
+
+// Benchmark of the polygon fill used by mower_map_service against grid_map::PolygonIterator.
+// Both fill every polygon into its own map, the cells must be the same.
+//
+// Usage: fill_bench [map.bin | map.bag]
+//   Without a file, only synthetic polygons are used. With a file, all recorded areas and obstacles
+//   in it are benchmarked as well. Both the map file and the old bag files can be read.
+//
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <rosbag/bag.h>
+#include <rosbag/view.h>
+
+#include "grid_map_core/iterators/PolygonIterator.hpp"
+#include "mower_map/MapArea.h"
+#include "MapFile.h"
+#include "MapRaster.h"
+
+typedef std::chrono::steady_clock Clock;
+
+struct BenchPolygon {
+    std::string name;
+    grid_map::Polygon polygon;
+};
+
+/// \brief Star with alternating radii, concave at every second vertex.
+grid_map::Polygon star(int vertex_count, double outer_radius, double inner_radius) {
+    grid_map::Polygon polygon;
+    for (int i = 0; i < vertex_count; i++) {
+        double angle = 2.0 * M_PI * i / vertex_count;
+        double radius = i % 2 == 0 ? outer_radius : inner_radius;
+        polygon.addVertex(grid_map::Position(radius * std::cos(angle), radius * std::sin(angle)));
+    }
+    return polygon;
+}
+
+/// \brief A wavy outline with a vertex every 0.1m, like a recorded boundary.
+grid_map::Polygon outline(double radius) {
+    grid_map::Polygon polygon;
+    int vertex_count = static_cast<int>(2.0 * M_PI * radius / 0.1);
+    for (int i = 0; i < vertex_count; i++) {
+        double angle = 2.0 * M_PI * i / vertex_count;
+        double r = radius * (1.0 + 0.25 * std::sin(7.0 * angle) + 0.05 * std::sin(61.0 * angle));
+        polygon.addVertex(grid_map::Position(r * std::cos(angle), r * std::sin(angle)));
+    }
+    return polygon;
+}
+
+/// \brief Comb with long teeth, a worst case for concave outlines.
+grid_map::Polygon comb(int teeth, double tooth_length) {
+    grid_map::Polygon polygon;
+    const double width = 0.5;
+    for (int i = 0; i < teeth; i++) {
+        double x = i * 2.0 * width;
+        polygon.addVertex(grid_map::Position(x, 0.0));
+        polygon.addVertex(grid_map::Position(x, tooth_length));
+        polygon.addVertex(grid_map::Position(x + width, tooth_length));
+        polygon.addVertex(grid_map::Position(x + width, 0.0));
+    }
+    polygon.addVertex(grid_map::Position(teeth * 2.0 * width, -1.0));
+    polygon.addVertex(grid_map::Position(0.0, -1.0));
+    return polygon;
+}
+
+/// \brief Add the outline and the obstacles of an area, named after the list it is in.
+void addArea(const std::string &list, const mower_map::MapArea &area, std::vector<BenchPolygon> &polygons) {
+    std::vector<const geometry_msgs::Polygon *> outlines = {&area.area};
+    for (const auto &obstacle: area.obstacles) {
+        outlines.push_back(&obstacle);
+    }
+    for (const auto *outline: outlines) {
+        BenchPolygon polygon;
+        polygon.name = list + "/" + area.name;
+        for (const auto &point: outline->points) {
+            polygon.polygon.addVertex(grid_map::Position(point.x, point.y));
+        }
+        polygons.push_back(polygon);
+    }
+}
+
+void addRecordedFromMapFile(const std::string &filename, std::vector<BenchPolygon> &polygons) {
+    map_file::Reader reader;
+    std::string error;
+    if (!reader.open(filename, error)) {
+        fprintf(stderr, "%s\n", error.c_str());
+        return;
+    }
+    for (size_t i = 0; i < reader.areaCount(); i++) {
+        addArea(reader.area(i).type == map_file::NAVIGATION_AREA ? "navigation_areas" : "mowing_areas",
+                reader.toMessage(i), polygons);
+    }
+}
+
+void addRecordedFromBag(const std::string &filename, std::vector<BenchPolygon> &polygons) {
+    try {
+        rosbag::Bag bag;
+        bag.open(filename);
+        for (const char *topic: {"mowing_areas", "navigation_areas"}) {
+            rosbag::View view(bag, rosbag::TopicQuery(topic));
+            for (rosbag::MessageInstance const m: view) {
+                addArea(topic, *m.instantiate<mower_map::MapArea>(), polygons);
+            }
+        }
+    } catch (rosbag::BagException &e) {
+        fprintf(stderr, "Error reading %s: %s\n", filename.c_str(), e.what());
+    }
+}
+
+void addRecorded(const std::string &filename, std::vector<BenchPolygon> &polygons) {
+    if (map_file::isMapFile(filename)) {
+        addRecordedFromMapFile(filename, polygons);
+    } else {
+        addRecordedFromBag(filename, polygons);
+    }
+}
+
+/// \brief A map around the polygon, with a border like the one mower_map_service adds.
+grid_map::GridMap mapFor(const grid_map::Polygon &polygon) {
+    Bounds bounds;
+    for (const auto &vertex: polygon.getVertices()) {
+        bounds.add(vertex.x(), vertex.y());
+    }
+    grid_map::GridMap map({"navigation_area"});
+    map.setGeometry(grid_map::Length(bounds.max_x - bounds.min_x + 2.0, bounds.max_y - bounds.min_y + 2.0), 0.05,
+                    grid_map::Position((bounds.max_x + bounds.min_x) / 2.0, (bounds.max_y + bounds.min_y) / 2.0));
+    return map;
+}
+
+int main(int argc, char **argv) {
+    std::vector<BenchPolygon> polygons = {
+            {"star 16", star(16, 10.0, 3.0)},
+            {"star 1000", star(1000, 20.0, 15.0)},
+            {"outline r=10m", outline(10.0)},
+            {"outline r=30m", outline(30.0)},
+            {"comb 40x20m", comb(40, 20.0)},
+    };
+    if (argc > 1) {
+        addRecorded(argv[1], polygons);
+    }
+
+    bool all_equal = true;
+    printf("%-32s %8s %10s %12s %12s %8s\n", "polygon", "vertices", "cells", "iterator [ms]", "scanline [ms]",
+           "speedup");
+    for (const auto &bench: polygons) {
+        grid_map::GridMap map = mapFor(bench.polygon);
+        const grid_map::Size &size = map.getSize();
+        OccupancyMatrix iterator_cells = OccupancyMatrix::Zero(size(0), size(1));
+        OccupancyMatrix scanline_cells = OccupancyMatrix::Zero(size(0), size(1));
+
+        auto start = Clock::now();
+        for (grid_map::PolygonIterator iterator(map, bench.polygon); !iterator.isPastEnd(); ++iterator) {
+            const grid_map::Index index(*iterator);
+            iterator_cells(index[0], index[1]) = 1;
+        }
+        double iterator_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+        start = Clock::now();
+        ScanlineFill fill(bench.polygon);
+        fill.fill(map, CellRect::all(size), 1, scanline_cells);
+        double scanline_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+        long different = (iterator_cells.array() != scanline_cells.array()).count();
+        printf("%-32s %8zu %10ld %12.3f %12.3f %7.1fx%s\n", bench.name.c_str(), bench.polygon.nVertices(),
+               static_cast<long>(iterator_cells.cast<long>().sum()), iterator_ms, scanline_ms,
+               scanline_ms > 0.0 ? iterator_ms / scanline_ms : 0.0,
+               different == 0 ? "" : (" DIFFERENT CELLS: " + std::to_string(different)).c_str());
+        all_equal &= different == 0;
+    }
+    return all_equal ? 0 : 1;
+}
@@ -18,13 +18,14 @@
 
 #include "grid_map_ros/PolygonRosConverter.hpp"
 #include "visualization_msgs/MarkerArray.h"
-#include "grid_map_cv/GridMapCvConverter.hpp"
 #include "grid_map_ros/GridMapRosConverter.hpp"
 
 
-// Rosbag for reading/writing the map to a file
+// Rosbag for importing maps saved by older versions
 #include <rosbag/bag.h>
 #include <rosbag/view.h>
+#include <cstdio>
+#include <unistd.h>
 
 
 // Include Messages
@@ -32,6 +33,7 @@
 #include "geometry_msgs/Point32.h"
 #include "mower_map/MapArea.h"
 #include "mower_map/MapAreas.h"
+#include "mower_map/MapSaveStatus.h"
 #include "geometry_msgs/PoseStamped.h"
 
 
@@ -46,12 +48,25 @@
 #include "mower_map/SetNavPointSrv.h"
 #include "mower_map/ClearNavPointSrv.h"
 #include "mower_map/ClearMapSrv.h"
+#include "mower_map/GetContainingAreasSrv.h"
+#include "mower_map/GetNearestEdgesSrv.h"
+#include "mower_map/IntersectSegmentsSrv.h"
 
 // Monitoring
 #include "xbot_msgs/Map.h"
 
 #include <tf2_geometry_msgs/tf2_geometry_msgs.h>
 
+#include "MapFile.h"
+#include "MapIndex.h"
+#include "MapPersistence.h"
+#include "MapRaster.h"
+
+
+// The map is stored here, see MapFile.h
+#define MAP_FILENAME "map.bin"
+// Maps saved by older versions, converted to MAP_FILENAME on startup
+#define LEGACY_MAP_FILENAME "map.bag"
 
 // Publishes the map as occupancy grid
 ros::Publisher map_pub, map_areas_pub;
@@ -62,6 +77,12 @@ ros::Publisher map_server_viz_array_pub;
 // Publishes map for monitoring
 ros::Publisher xbot_monitoring_map_pub;
 
+// Publishes the result of every write of the map file
+ros::Publisher map_save_status_pub;
+
+// Writes the map file in the background
+std::unique_ptr<MapPersistence> map_persistence;
+
 // We store navigation_areas (i.e. robot is allowed to move here) and
 // mowing_areas (i.e. grass needs to be cut here)
 std::vector<mower_map::MapArea> navigation_areas;
@@ -71,12 +92,29 @@ std::vector<mower_map::MapArea> mowing_areas;
 // I.e. the robot will drive to this pose and then drive forward
 geometry_msgs::Pose docking_point;
 bool has_docking_point = false;
+
+// Spatial index over the areas above, for the query services. Kept in sync with every edit.
+MapIndex map_index;
 bool show_fake_obstacle = false;
 geometry_msgs::Pose fake_obstacle_pose;
 
 // The grid map. This is built from the polygons loaded from the file.
 grid_map::GridMap map;
 
+// The map before blurring. Kept, so we only need to paint and blur the part of the map which changed.
+OccupancyMatrix map_cells;
+// The extents the map was built for. The map is only allocated again, if they change.
+Bounds map_extents;
+// Everything which changed since the map was last updated
+Bounds dirty_bounds;
+// The published occupancy grid, updated in place
+nav_msgs::OccupancyGrid map_msg;
+// Size of the blur in cells, see buildMap(). Must be odd.
+int blur_kernel_size = 5;
+// The map is painted in tiles of this many cells in both directions, which are spread over the threads of raster_pool
+int raster_tile_size = 256;
+std::unique_ptr<WorkStealingPool> raster_pool;
+
 
 /**
  * Convert a geometry_msgs::Polygon to a grid_map::Polygon.
@@ -85,9 +123,9 @@ grid_map::GridMap map;
  * @param poly input poly
  * @param out result
  */
-void fromMessage(geometry_msgs::Polygon &poly, grid_map::Polygon &out) {
+void fromMessage(const geometry_msgs::Polygon &poly, grid_map::Polygon &out) {
     out.removeVertices();
-    for (auto &point: poly.points) {
+    for (const auto &point: poly.points) {
         grid_map::Position pos;
         pos.x() = point.x;
         pos.y() = point.y;
@@ -224,16 +262,9 @@ void visualizeAreas() {
 }
 
 /**
- * Uses the polygons stored in navigation_areas and mowing_areas to build the final occupancy grid.
- *
- * First, the map is marked as completely occupied. Then navigation_areas and mowing_areas are marked as free.
- *
- * Then, all obstacles are marked as occupied.
- *
- * Finally, a blur is applied to the map so that it is expensive, but not completely forbidden to drive near boundaries.
+ * The extents of all areas and obstacles with a border of 1m, i.e. the area covered by the map.
  */
-void buildMap() {
-
+Bounds mapExtents() {
     // First, calculate the size of the map by finding the min and max values for x and y.
     float minX = FLT_MAX;
     float maxX = FLT_MIN;
@@ -289,165 +320,268 @@ void buildMap() {
         minY = -5.0;
     }
 
+    Bounds extents;
+    extents.add(minX, minY);
+    extents.add(maxX, maxY);
+    return extents;
+}
 
-    map = grid_map::GridMap({"navigation_area"});
-    map.setFrameId("map");
-    grid_map::Position origin;
-    origin.x() = (maxX + minX) / 2.0;
-    origin.y() = (maxY + minY) / 2.0;
+/**
+ * The obstacle shown in front of the nav point (see setNavPoint).
+ */
+grid_map::Polygon fakeObstaclePolygon() {
+    grid_map::Polygon poly;
+    tf2::Quaternion q;
+    tf2::fromMsg(fake_obstacle_pose.orientation, q);
 
-    ROS_INFO_STREAM("Map Position: x=" << origin.x() << ", y=" << origin.y());
-    ROS_INFO_STREAM("Map Size: x=" << (maxX - minX) << ", y=" << (maxY - minY));
+    tf2::Matrix3x3 m(q);
+    double unused1, unused2, yaw;
 
-    map.setGeometry(grid_map::Length(maxX - minX, maxY - minY), 0.05, origin);
-    map.setTimestamp(ros::Time::now().toNSec());
+    m.getRPY(unused1, unused2, yaw);
 
-    map.clearAll();
-    map["navigation_area"].setConstant(1.0);
+    Eigen::Vector2d front(cos(yaw),sin(yaw));
+    Eigen::Vector2d left(-sin(yaw),cos(yaw));
+    Eigen::Vector2d obstacle_pos(fake_obstacle_pose.position.x,fake_obstacle_pose.position.y);
 
-    grid_map::Matrix &data = map["navigation_area"];
-    for (auto mowingArea: navigation_areas) {
-        grid_map::Polygon poly;
-        fromMessage(mowingArea.area, poly);
+    {
+        grid_map::Position pos = obstacle_pos + 0.1*left + 0.25*front;
+        poly.addVertex(pos);
+    }
+    {
+        grid_map::Position pos = obstacle_pos + 0.2*left - 0.1*front;
+        poly.addVertex(pos);
+    }
+    {
+        grid_map::Position pos = obstacle_pos + 0.6*left - 0.1*front;
+        poly.addVertex(pos);
+    }
+    {
+        grid_map::Position pos = obstacle_pos + 0.6*left + 0.7*front;
+        poly.addVertex(pos);
+    }
 
-        for (grid_map::PolygonIterator iterator(map, poly); !iterator.isPastEnd(); ++iterator) {
-            const grid_map::Index index(*iterator);
-            data(index[0], index[1]) = 0.0;
-        }
-        for (auto obstacle: mowingArea.obstacles) {
-            fromMessage(obstacle, poly);
-            for (grid_map::PolygonIterator iterator(map, poly); !iterator.isPastEnd(); ++iterator) {
-                const grid_map::Index index(*iterator);
-                data(index[0], index[1]) = 1.0;
+    {
+        grid_map::Position pos = obstacle_pos - 0.6*left + 0.7*front;
+        poly.addVertex(pos);
+    }
+    {
+        grid_map::Position pos = obstacle_pos - 0.6*left - 0.1*front;
+        poly.addVertex(pos);
+    }
+    {
+        grid_map::Position pos = obstacle_pos - 0.2*left - 0.1*front;
+        poly.addVertex(pos);
+    }
+    {
+        grid_map::Position pos = obstacle_pos - 0.1*left + 0.25*front;
+        poly.addVertex(pos);
+    }
+    return poly;
+}
+
+/**
+ * All polygons of the map in the order they are painted.
+ *
+ * navigation_areas and mowing_areas are marked as free, each followed by its obstacles, which are marked as occupied.
+ * The fake obstacle comes last.
+ */
+std::vector<PaintOp> paintOps() {
+    std::vector<PaintOp> ops;
+    grid_map::Polygon poly;
+    for (const auto *areas: {&navigation_areas, &mowing_areas}) {
+        for (const auto &area: *areas) {
+            fromMessage(area.area, poly);
+            ops.emplace_back(poly, 0);
+            for (const auto &obstacle: area.obstacles) {
+                fromMessage(obstacle, poly);
+                ops.emplace_back(poly, 1);
             }
         }
     }
-    for (auto mowingArea: mowing_areas) {
-        grid_map::Polygon poly;
-        fromMessage(mowingArea.area, poly);
+    if (show_fake_obstacle) {
+        ops.emplace_back(fakeObstaclePolygon(), 1);
+    }
+    return ops;
+}
 
-        for (grid_map::PolygonIterator iterator(map, poly); !iterator.isPastEnd(); ++iterator) {
-            const grid_map::Index index(*iterator);
-            data(index[0], index[1]) = 0.0;
-        }
-        for (auto obstacle: mowingArea.obstacles) {
-            fromMessage(obstacle, poly);
-            for (grid_map::PolygonIterator iterator(map, poly); !iterator.isPastEnd(); ++iterator) {
-                const grid_map::Index index(*iterator);
-                data(index[0], index[1]) = 1.0;
-            }
+/**
+ * Mark the part of the map covered by a polygon as changed. Call this before and after changing a polygon,
+ * so the cells it used to cover and the ones it covers now are both updated.
+ */
+void invalidate(const grid_map::Polygon &poly) {
+    for (const auto &vertex: poly.getVertices()) {
+        dirty_bounds.add(vertex.x(), vertex.y());
+    }
+}
+
+void invalidate(const geometry_msgs::Polygon &poly) {
+    for (const auto &pt: poly.points) {
+        dirty_bounds.add(pt.x, pt.y);
+    }
+}
+
+void invalidate(const mower_map::MapArea &area) {
+    invalidate(area.area);
+    for (const auto &obstacle: area.obstacles) {
+        invalidate(obstacle);
+    }
+}
+
+/**
+ * Copy a rectangle of the navigation_area layer to map_msg. Same conversion as GridMapRosConverter::toOccupancyGrid.
+ */
+void updateOccupancyGrid(const CellRect &rect) {
+    const grid_map::Matrix &data = map["navigation_area"];
+    const size_t cell_count = map.getSize().prod();
+    const size_t size_x = map.getSize()(0);
+    for (int j = rect.start(1); j < rect.end(1); j++) {
+        for (int i = rect.start(0); i < rect.end(0); i++) {
+            float value = data(i, j);
+            // The occupancy grid starts at the min x, min y corner, the grid map at the max x, max y corner.
+            map_msg.data[cell_count - (i + j * size_x) - 1] =
+                    std::isnan(value) ? -1 : static_cast<int8_t>(std::min(std::max(0.0f, value), 1.0f) * 100.0f);
         }
     }
+}
 
-    if(show_fake_obstacle)
-    {
-        grid_map::Polygon poly;
-        tf2::Quaternion q;
-        tf2::fromMsg(fake_obstacle_pose.orientation, q);
+void publishOccupancyGrid() {
+    map_msg.header.stamp.fromNSec(map.getTimestamp());
+    map_msg.info.map_load_time = map_msg.header.stamp;
+    map_pub.publish(map_msg);
+}
 
-        tf2::Matrix3x3 m(q);
-        double unused1, unused2, yaw;
+/**
+ * Uses the polygons stored in navigation_areas and mowing_areas to build the final occupancy grid.
+ *
+ * First, the map is marked as completely occupied. Then navigation_areas and mowing_areas are marked as free.
+ *
+ * Then, all obstacles are marked as occupied.
+ *
+ * Finally, a blur is applied to the map so that it is expensive, but not completely forbidden to drive near boundaries.
+ */
+void buildMap() {
+    Bounds extents = mapExtents();
 
-        m.getRPY(unused1, unused2, yaw);
+    map = grid_map::GridMap({"navigation_area"});
+    map.setFrameId("map");
+    grid_map::Position origin;
+    origin.x() = (extents.max_x + extents.min_x) / 2.0;
+    origin.y() = (extents.max_y + extents.min_y) / 2.0;
 
-        Eigen::Vector2d front(cos(yaw),sin(yaw));
-        Eigen::Vector2d left(-sin(yaw),cos(yaw));
-        Eigen::Vector2d obstacle_pos(fake_obstacle_pose.position.x,fake_obstacle_pose.position.y);
+    ROS_INFO_STREAM("Map Position: x=" << origin.x() << ", y=" << origin.y());
+    ROS_INFO_STREAM("Map Size: x=" << (extents.max_x - extents.min_x) << ", y=" << (extents.max_y - extents.min_y));
 
-        {
-            grid_map::Position pos = obstacle_pos + 0.1*left + 0.25*front;
-            poly.addVertex(pos);
-        }
-        {
-            grid_map::Position pos = obstacle_pos + 0.2*left - 0.1*front;
-            poly.addVertex(pos);
-        }
-        {
-            grid_map::Position pos = obstacle_pos + 0.6*left - 0.1*front;
-            poly.addVertex(pos);
-        }
-        {
-            grid_map::Position pos = obstacle_pos + 0.6*left + 0.7*front;
-            poly.addVertex(pos);
-        }
+    map.setGeometry(grid_map::Length(extents.max_x - extents.min_x, extents.max_y - extents.min_y), 0.05, origin);
+    map.setTimestamp(ros::Time::now().toNSec());
+    map_extents = extents;
+    dirty_bounds = Bounds();
 
-        {
-            grid_map::Position pos = obstacle_pos - 0.6*left + 0.7*front;
-            poly.addVertex(pos);
-        }
-        {
-            grid_map::Position pos = obstacle_pos - 0.6*left - 0.1*front;
-            poly.addVertex(pos);
-        }
-        {
-            grid_map::Position pos = obstacle_pos - 0.2*left - 0.1*front;
-            poly.addVertex(pos);
-        }
-        {
-            grid_map::Position pos = obstacle_pos - 0.1*left + 0.25*front;
-            poly.addVertex(pos);
-        }
-        for (grid_map::PolygonIterator iterator(map, poly); !iterator.isPastEnd(); ++iterator) {
-            const grid_map::Index index(*iterator);
-            data(index[0], index[1]) = 1.0;
-        }
+    map.clearAll();
+    map_cells.resize(map.getSize()(0), map.getSize()(1));
 
-    }
+    CellRect all = CellRect::all(map.getSize());
+    paintCellsParallel(map, paintOps(), all, map_cells, *raster_pool, raster_tile_size);
+    blurCells(map_cells, all, blur_kernel_size, map["navigation_area"], *raster_pool, raster_tile_size);
 
-    cv::Mat cv_map;
-    grid_map::GridMapCvConverter::toImage<unsigned char, 1>(map, "navigation_area", CV_8UC1, cv_map);
+    grid_map::GridMapRosConverter::toOccupancyGrid(map, "navigation_area", 0.0, 1.0, map_msg);
+    map_pub.publish(map_msg);
 
-    cv::blur(cv_map, cv_map, cv::Size(5, 5));
+    publishMapMonitoring();
+    visualizeAreas();
+}
 
-    grid_map::GridMapCvConverter::addLayerFromImage<unsigned char, 1>(cv_map, "navigation_area", map);
+/**
+ * Bring the map up to date after a change. Only the changed part is painted and blurred again.
+ * If the extents of the map changed, it is built from scratch.
+ */
+void updateMap() {
+    if (mapExtents() != map_extents) {
+        buildMap();
+        return;
+    }
 
-    nav_msgs::OccupancyGrid msg;
-    grid_map::GridMapRosConverter::toOccupancyGrid(map, "navigation_area", 0.0, 1.0, msg);
-    map_pub.publish(msg);
+    if (!dirty_bounds.empty()) {
+        ros::WallTime start = ros::WallTime::now();
+        CellRect blurred = updateCells(map, paintOps(), dirty_bounds, blur_kernel_size, map_cells,
+                                       map["navigation_area"], *raster_pool, raster_tile_size);
+        dirty_bounds = Bounds();
+        updateOccupancyGrid(blurred);
+
+        map.setTimestamp(ros::Time::now().toNSec());
+        publishOccupancyGrid();
+        ROS_INFO_STREAM("Updated " << blurred.size().prod() << " cells of the map in "
+                                   << (ros::WallTime::now() - start).toSec() * 1000.0 << " ms");
+    }
 
     publishMapMonitoring();
     visualizeAreas();
 }
 
 /**
- * Saves the current polygons to a bag file.
+ * Queues the current polygons for saving to the map file and returns without waiting for the write.
  * We don't need to save the map, since we can easily build it again after loading.
  */
 void saveMapToFile() {
-    rosbag::Bag bag;
-    bag.open("map.bag", rosbag::bagmode::Write);
+    std::shared_ptr<MapSnapshot> snapshot = std::make_shared<MapSnapshot>();
+    snapshot->navigation_areas = navigation_areas;
+    snapshot->mowing_areas = mowing_areas;
+    snapshot->has_docking_point = has_docking_point;
+    snapshot->docking_point = docking_point;
+    map_persistence->save(std::move(snapshot));
+}
 
-    for (auto &area: mowing_areas) {
-        bag.write("mowing_areas", ros::Time::now(), area);
-    }
-    for (auto &area: navigation_areas) {
-        bag.write("navigation_areas", ros::Time::now(), area);
+/**
+ * Called by the persistence thread after every write.
+ */
+void mapSaved(const MapSaveResult &result) {
+    if (result.success) {
+        ROS_DEBUG_STREAM("Saved version " << result.version << " of the map in " << result.duration_ms << " ms, "
+                                          << result.coalesced << " older versions skipped");
+    } else {
+        ROS_ERROR_STREAM("Error saving version " << result.version << " of the map: " << result.error);
     }
 
-    if(has_docking_point) {
-        bag.write("docking_point", ros::Time::now(), docking_point);
+    // The publisher is gone after shutdown, the final flush happens after that
+    if (!ros::ok()) {
+        return;
     }
+    mower_map::MapSaveStatus status;
+    status.version = result.version;
+    status.latest_version = result.latest_version;
+    status.success = result.success;
+    status.error = result.error;
+    status.coalesced = result.coalesced;
+    status.duration_ms = result.duration_ms;
+    map_save_status_pub.publish(status);
+}
 
-    bag.close();
+/**
+ * Set the docking point from the loaded file, or reset it if the file has none.
+ */
+void setLoadedDockingPoint(const geometry_msgs::Pose *pose) {
+    if (pose) {
+        docking_point = *pose;
+        has_docking_point = true;
+    } else {
+        has_docking_point = false;
+        geometry_msgs::Pose empty;
+        empty.orientation.w = 1.0;
+        docking_point = empty;
+    }
 }
 
 /**
- * Load the polygons from the bag file and build a map.
+ * Load the polygons from a bag file, the format used before map.bin.
  *
- * @param filename The file to load.
- * @param append True to append the loaded map to the current one.
+ * @return false, if the file could not be opened.
  */
-void readMapFromFile(const std::string& filename, bool append = false) {
-    if (!append) {
-        mowing_areas.clear();
-        navigation_areas.clear();
-    }
+bool readMapFromBag(const std::string &filename) {
     rosbag::Bag bag;
     try {
         bag.open(filename);
-    } catch (rosbag::BagIOException &e) {
-        ROS_WARN("Error opening stored mowing areas.");
-        return;
+    } catch (rosbag::BagException &e) {
+        ROS_WARN_STREAM("Error opening stored mowing areas: " << e.what());
+        return false;
     }
 
     {
@@ -468,24 +602,65 @@ void readMapFromFile(const std::string& filename, bool append = false) {
     }
 
     {
-        has_docking_point = false;
         rosbag::View view(bag, rosbag::TopicQuery("docking_point"));
+        boost::shared_ptr<geometry_msgs::Pose> pt;
         for (rosbag::MessageInstance const m: view) {
-            auto pt = m.instantiate<geometry_msgs::Pose>();
-            docking_point = *pt;
-            has_docking_point = true;
+            pt = m.instantiate<geometry_msgs::Pose>();
             break;
         }
-        if (!has_docking_point) {
-            geometry_msgs::Pose empty;
-            empty.orientation.w = 1.0;
-            docking_point = empty;
-        }
+        setLoadedDockingPoint(pt.get());
     }
+    return true;
+}
+
+/**
+ * Load the polygons from a map file.
+ *
+ * @return false, if the file could not be read.
+ */
+bool readMapFromBinary(const std::string &filename) {
+    map_file::Reader reader;
+    std::string error;
+    if (!reader.open(filename, error)) {
+        ROS_WARN_STREAM("Error opening stored mowing areas: " << error);
+        return false;
+    }
+    for (size_t i = 0; i < reader.areaCount(); i++) {
+        auto &areas = reader.area(i).type == map_file::NAVIGATION_AREA ? navigation_areas : mowing_areas;
+        areas.push_back(reader.toMessage(i));
+    }
+    if (reader.hasDockingPoint()) {
+        geometry_msgs::Pose pose = reader.dockingPoint();
+        setLoadedDockingPoint(&pose);
+    } else {
+        setLoadedDockingPoint(nullptr);
+    }
+    return true;
+}
 
+/**
+ * Load the polygons from the map file and build a map.
+ * Both map.bin files and the old bag files can be read.
+ *
+ * @param filename The file to load.
+ * @param append True to append the loaded map to the current one.
+ * @return false, if the file could not be read.
+ */
+bool readMapFromFile(const std::string& filename, bool append = false) {
+    if (!append) {
+        mowing_areas.clear();
+        navigation_areas.clear();
+    }
+    auto start = ros::WallTime::now();
+    bool success = map_file::isMapFile(filename) ? readMapFromBinary(filename) : readMapFromBag(filename);
+    if (!success) {
+        return false;
+    }
 
     ROS_INFO_STREAM("Loaded " << mowing_areas.size() << " mowing areas and " << navigation_areas.size()
-                              << " navigation areas from file.");
+                              << " navigation areas from " << filename << " in "
+                              << (ros::WallTime::now() - start).toSec() * 1000.0 << " ms.");
+    return true;
 }
 
 bool addMowingArea(mower_map::AddMowingAreaSrvRequest &req, mower_map::AddMowingAreaSrvResponse &res) {
@@ -496,9 +671,11 @@ bool addMowingArea(mower_map::AddMowingAreaSrvRequest &req, mower_map::AddMowing
     } else {
         mowing_areas.push_back(req.area);
     }
+    invalidate(req.area);
+    map_index.add(req.isNavigationArea ? MapFeature::NAVIGATION_AREA : MapFeature::MOWING_AREA, req.area);
 
     saveMapToFile();
-    buildMap();
+    updateMap();
     return true;
 }
 
@@ -525,10 +702,12 @@ deleteMowingArea(mower_map::DeleteMowingAreaSrvRequest &req, mower_map::DeleteMo
         return false;
     }
 
+    invalidate(mowing_areas[req.index]);
     mowing_areas.erase(mowing_areas.begin() + req.index);
+    map_index.erase(MapFeature::MOWING_AREA, req.index);
 
     saveMapToFile();
-    buildMap();
+    updateMap();
 
     return true;
 }
@@ -547,8 +726,12 @@ convertToNavigationArea(mower_map::ConvertToNavigationAreaSrvRequest &req,
 
     mowing_areas.erase(mowing_areas.begin() + req.index);
 
+    // The area is painted at another position in the order now
+    invalidate(navigation_areas.back());
+    map_index.convertToNavigationArea(req.index);
+
     saveMapToFile();
-    buildMap();
+    updateMap();
 
     return true;
 }
@@ -557,10 +740,20 @@ bool appendMapFromFile(mower_map::AppendMapSrvRequest &req, mower_map::AppendMap
     ROS_INFO_STREAM("Appending maps from: " << req.bagfile);
 
 
+    size_t mowing_area_count = mowing_areas.size();
+    size_t navigation_area_count = navigation_areas.size();
     readMapFromFile(req.bagfile, true);
+    for (size_t i = mowing_area_count; i < mowing_areas.size(); i++) {
+        invalidate(mowing_areas[i]);
+        map_index.add(MapFeature::MOWING_AREA, mowing_areas[i]);
+    }
+    for (size_t i = navigation_area_count; i < navigation_areas.size(); i++) {
+        invalidate(navigation_areas[i]);
+        map_index.add(MapFeature::NAVIGATION_AREA, navigation_areas[i]);
+    }
 
     saveMapToFile();
-    buildMap();
+    updateMap();
 
     return true;
 }
@@ -572,7 +765,8 @@ bool setDockingPoint(mower_map::SetDockingPointSrvRequest &req, mower_map::SetDo
     has_docking_point = true;
 
     saveMapToFile();
-    buildMap();
+    // The docking point is not part of the grid, this only publishes it
+    updateMap();
 
     return true;
 }
@@ -585,14 +779,87 @@ bool getDockingPoint(mower_map::GetDockingPointSrvRequest &req, mower_map::GetDo
 
     return has_docking_point;
 }
+
+bool getContainingAreas(mower_map::GetContainingAreasSrvRequest &req,
+                        mower_map::GetContainingAreasSrvResponse &res) {
+    auto start = ros::WallTime::now();
+    res.mowing_area_index.resize(req.points.size());
+    res.navigation_area_index.resize(req.points.size());
+    for (size_t i = 0; i < req.points.size(); i++) {
+        Eigen::Vector2d point(req.points[i].x, req.points[i].y);
+        res.mowing_area_index[i] = map_index.containingArea(MapFeature::MOWING_AREA, point);
+        res.navigation_area_index[i] = map_index.containingArea(MapFeature::NAVIGATION_AREA, point);
+    }
+    ROS_DEBUG_STREAM("Looked up " << req.points.size() << " points in "
+                                  << (ros::WallTime::now() - start).toSec() * 1000.0 << " ms");
+    return true;
+}
+
+bool getNearestEdges(mower_map::GetNearestEdgesSrvRequest &req, mower_map::GetNearestEdgesSrvResponse &res) {
+    auto start = ros::WallTime::now();
+    size_t count = req.points.size();
+    res.distance.resize(count);
+    res.closest_point.resize(count);
+    res.area_type.resize(count);
+    res.area_index.resize(count);
+    res.obstacle_index.resize(count);
+    for (size_t i = 0; i < count; i++) {
+        NearestEdge nearest = map_index.nearestEdge(Eigen::Vector2d(req.points[i].x, req.points[i].y));
+        res.distance[i] = nearest.distance;
+        if (nearest.found) {
+            res.closest_point[i].x = nearest.point.x();
+            res.closest_point[i].y = nearest.point.y();
+        }
+        res.area_type[i] = nearest.feature.type;
+        res.area_index[i] = nearest.found ? nearest.feature.area_index : -1;
+        res.obstacle_index[i] = nearest.found ? nearest.feature.obstacle_index : -1;
+    }
+    ROS_DEBUG_STREAM("Found the nearest edges of " << count << " points in "
+                                                   << (ros::WallTime::now() - start).toSec() * 1000.0 << " ms");
+    return true;
+}
+
+bool intersectSegments(mower_map::IntersectSegmentsSrvRequest &req, mower_map::IntersectSegmentsSrvResponse &res) {
+    if (req.starts.size() != req.ends.size()) {
+        ROS_ERROR_STREAM("Got " << req.starts.size() << " segment starts but " << req.ends.size() << " ends");
+        return false;
+    }
+    auto start = ros::WallTime::now();
+    size_t count = req.starts.size();
+    res.intersects.resize(count);
+    res.first_intersection.resize(count);
+    res.area_type.resize(count);
+    res.area_index.resize(count);
+    res.obstacle_index.resize(count);
+    for (size_t i = 0; i < count; i++) {
+        SegmentHit hit = map_index.intersect(Eigen::Vector2d(req.starts[i].x, req.starts[i].y),
+                                             Eigen::Vector2d(req.ends[i].x, req.ends[i].y));
+        res.intersects[i] = hit.found;
+        if (hit.found) {
+            res.first_intersection[i].x = hit.point.x();
+            res.first_intersection[i].y = hit.point.y();
+        }
+        res.area_type[i] = hit.feature.type;
+        res.area_index[i] = hit.found ? hit.feature.area_index : -1;
+        res.obstacle_index[i] = hit.found ? hit.feature.obstacle_index : -1;
+    }
+    ROS_DEBUG_STREAM("Intersected " << count << " segments in "
+                                    << (ros::WallTime::now() - start).toSec() * 1000.0 << " ms");
+    return true;
+}
+
 bool setNavPoint(mower_map::SetNavPointSrvRequest &req, mower_map::SetNavPointSrvResponse &res) {
     ROS_INFO_STREAM("Setting Nav Point");
 
+    if (show_fake_obstacle) {
+        invalidate(fakeObstaclePolygon());
+    }
     fake_obstacle_pose = req.nav_pose;
 
     show_fake_obstacle = true;
+    invalidate(fakeObstaclePolygon());
 
-    buildMap();
+    updateMap();
 
     return true;
 }
@@ -601,9 +868,12 @@ bool setNavPoint(mower_map::SetNavPointSrvRequest &req, mower_map::SetNavPointSr
 bool clearNavPoint(mower_map::ClearNavPointSrvRequest &req, mower_map::ClearNavPointSrvResponse &res) {
     ROS_INFO_STREAM("Clearing Nav Point");
 
+    if (show_fake_obstacle) {
+        invalidate(fakeObstaclePolygon());
+    }
     show_fake_obstacle = false;
 
-    buildMap();
+    updateMap();
 
     return true;
 }
@@ -614,6 +884,7 @@ bool clearMap(mower_map::ClearMapSrvRequest &req, mower_map::ClearMapSrvResponse
     mowing_areas.clear();
     navigation_areas.clear();
     has_docking_point = false;
+    map_index.clear();
 
     saveMapToFile();
     return true;
@@ -624,14 +895,48 @@ int main(int argc, char **argv) {
     ros::init(argc, argv, "mower_map_service");
     has_docking_point = false;
     ros::NodeHandle n;
+    ros::NodeHandle paramNh("~");
+
+    int raster_threads = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+    paramNh.param("raster_threads", raster_threads, raster_threads);
+    paramNh.param("raster_tile_size", raster_tile_size, raster_tile_size);
+    raster_tile_size = std::max(16, raster_tile_size);
+    paramNh.param("blur_kernel_size", blur_kernel_size, blur_kernel_size);
+    if (blur_kernel_size < 1 || blur_kernel_size % 2 == 0) {
+        ROS_WARN_STREAM("blur_kernel_size must be odd and positive, using 5 instead of " << blur_kernel_size);
+        blur_kernel_size = 5;
+    }
+    raster_pool.reset(new WorkStealingPool(std::max(1, raster_threads)));
+    ROS_INFO_STREAM("Painting the map with " << raster_pool->threadCount() << " threads in tiles of "
+                                             << raster_tile_size << " cells");
     map_pub = n.advertise<nav_msgs::OccupancyGrid>("mower_map_service/map", 10, true);
     map_areas_pub = n.advertise<mower_map::MapAreas>("mower_map_service/map_areas", 10, true);
     map_server_viz_array_pub = n.advertise<visualization_msgs::MarkerArray>("mower_map_service/map_viz", 10, true);
     xbot_monitoring_map_pub = n.advertise<xbot_msgs::Map>("xbot_monitoring/map", 10, true);
+    map_save_status_pub = n.advertise<mower_map::MapSaveStatus>("mower_map_service/save_status", 10, true);
+    map_persistence.reset(new MapPersistence(MAP_FILENAME, mapSaved));
+
+    // Load the default map file. Maps saved by older versions are converted once, map.bag is kept as a backup.
+    bool map_loaded = false;
+    if (access(MAP_FILENAME, F_OK) == 0) {
+        // Without the magic it is not a bag either, but a damaged map file
+        map_loaded = map_file::isMapFile(MAP_FILENAME) && readMapFromFile(MAP_FILENAME);
+        if (!map_loaded) {
+            // Move the damaged file out of the way before the next save replaces it
+            if (rename(MAP_FILENAME, MAP_FILENAME ".corrupt") == 0) {
+                ROS_ERROR_STREAM("Could not load " << MAP_FILENAME << ", moved it to " << MAP_FILENAME ".corrupt");
+            } else {
+                ROS_ERROR_STREAM("Could not load " << MAP_FILENAME << " and could not move it out of the way: "
+                                                   << strerror(errno));
+            }
+        }
+    }
+    if (!map_loaded && access(LEGACY_MAP_FILENAME, F_OK) == 0 && readMapFromFile(LEGACY_MAP_FILENAME)) {
+        ROS_INFO_STREAM("Converting " << LEGACY_MAP_FILENAME << " to " << MAP_FILENAME);
+        saveMapToFile();
+    }
 
-    // Load the default map file
-    readMapFromFile("map.bag");
-
+    map_index.rebuild(navigation_areas, mowing_areas);
     buildMap();
 
 
@@ -651,9 +956,21 @@ int main(int argc, char **argv) {
                                                                   clearNavPoint);
     ros::ServiceServer clear_map_srv = n.advertiseService("mower_map_service/clear_map",
                                                                   clearMap);
+    ros::ServiceServer containing_areas_srv = n.advertiseService("mower_map_service/get_containing_areas",
+                                                                 getContainingAreas);
+    ros::ServiceServer nearest_edges_srv = n.advertiseService("mower_map_service/get_nearest_edges",
+                                                              getNearestEdges);
+    ros::ServiceServer intersect_segments_srv = n.advertiseService("mower_map_service/intersect_segments",
+                                                                   intersectSegments);
 
 
 
     ros::spin();
+
+    // Don't lose the last changes
+    if (!map_persistence->flush()) {
+        ROS_ERROR("The last changes to the map could not be saved");
+    }
+    map_persistence.reset();
     return 0;
 }
@@ -0,0 +1,294 @@
+// Copyright (c) 2022 Clemens Elflein. All rights reserved.
+//
+// This work is licensed under a Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//
+// Feel free to use the design in your private/educational projects, but don't try to sell the design or products based on it without getting my consent first.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//
+
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../src/MapFile.h"
+
+
+class MapFileTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        char pattern[] = "/tmp/test_map_file_XXXXXX";
+        ASSERT_NE(mkdtemp(pattern), nullptr);
+        directory = pattern;
+        filename = directory + "/map.bin";
+    }
+
+    void TearDown() override {
+        unlink(filename.c_str());
+        unlink((filename + ".tmp").c_str());
+        rmdir(directory.c_str());
+    }
+
+    static geometry_msgs::Point32 point(float x, float y) {
+        geometry_msgs::Point32 p;
+        p.x = x;
+        p.y = y;
+        p.z = 0.0f;
+        return p;
+    }
+
+    static mower_map::MapArea square(const std::string &name, float x, float y, float size) {
+        mower_map::MapArea area;
+        area.name = name;
+        area.area.points = {point(x, y), point(x + size, y), point(x + size, y + size), point(x, y + size)};
+        return area;
+    }
+
+    std::vector<uint8_t> readFile() const {
+        std::vector<uint8_t> data;
+        FILE *f = fopen(filename.c_str(), "rb");
+        if (!f) {
+            return data;
+        }
+        int c;
+        while ((c = fgetc(f)) != EOF) {
+            data.push_back(c);
+        }
+        fclose(f);
+        return data;
+    }
+
+    void writeFile(const std::vector<uint8_t> &data) const {
+        FILE *f = fopen(filename.c_str(), "wb");
+        ASSERT_NE(f, nullptr);
+        ASSERT_EQ(fwrite(data.data(), 1, data.size(), f), data.size());
+        fclose(f);
+    }
+
+    /// Writes the data back with a matching checksum, so only the range checks can catch the change.
+    void writeFileWithChecksum(std::vector<uint8_t> data) const {
+        map_file::FileHeader header;
+        memcpy(&header, data.data(), sizeof(header));
+        header.checksum = map_file::crc32(data.data() + sizeof(header), data.size() - sizeof(header));
+        memcpy(data.data(), &header, sizeof(header));
+        writeFile(data);
+    }
+
+    /// One navigation area and one mowing area with two obstacles, plus a docking point.
+    void writeTestMap() {
+        std::vector<mower_map::MapArea> navigation_areas = {square("nav", 0.0f, 0.0f, 10.0f)};
+        std::vector<mower_map::MapArea> mowing_areas = {square("lawn", 20.0f, 0.0f, 15.0f)};
+        mowing_areas[0].obstacles.push_back(square("", 22.0f, 2.0f, 1.0f).area);
+        mowing_areas[0].obstacles.push_back(square("", 25.5f, 4.25f, 2.0f).area);
+        mowing_areas[0].obstacles[1].points.push_back(point(26.0f, 7.0f));
+        geometry_msgs::Pose docking_point;
+        docking_point.position.x = 1.5;
+        docking_point.position.y = -2.25;
+        docking_point.orientation.z = 0.5;
+        docking_point.orientation.w = 0.75;
+        std::string error;
+        ASSERT_TRUE(map_file::write(filename, navigation_areas, mowing_areas, &docking_point, error)) << error;
+    }
+
+    std::string directory;
+    std::string filename;
+};
+
+TEST(MapFileCrc32, CheckValue) {
+    EXPECT_EQ(map_file::crc32("123456789", 9), 0xCBF43926u);
+    EXPECT_EQ(map_file::crc32("", 0), 0u);
+}
+
+TEST_F(MapFileTest, RoundTrip) {
+    writeTestMap();
+    EXPECT_TRUE(map_file::isMapFile(filename));
+    EXPECT_NE(access((filename + ".tmp").c_str(), F_OK), 0);
+
+    map_file::Reader reader;
+    std::string error;
+    ASSERT_TRUE(reader.open(filename, error)) << error;
+    ASSERT_EQ(reader.areaCount(), 2u);
+    EXPECT_EQ(reader.area(0).type, map_file::NAVIGATION_AREA);
+    EXPECT_EQ(reader.area(1).type, map_file::MOWING_AREA);
+    EXPECT_EQ(reader.areaName(0), "nav");
+    EXPECT_EQ(reader.areaName(1), "lawn");
+
+    mower_map::MapArea nav = reader.toMessage(0);
+    EXPECT_EQ(nav.name, "nav");
+    ASSERT_EQ(nav.area.points.size(), 4u);
+    EXPECT_EQ(nav.area.points[2].x, 10.0f);
+    EXPECT_EQ(nav.area.points[2].y, 10.0f);
+    EXPECT_TRUE(nav.obstacles.empty());
+
+    mower_map::MapArea lawn = reader.toMessage(1);
+    ASSERT_EQ(lawn.obstacles.size(), 2u);
+    EXPECT_EQ(lawn.obstacles[0].points.size(), 4u);
+    ASSERT_EQ(lawn.obstacles[1].points.size(), 5u);
+    EXPECT_EQ(lawn.obstacles[1].points[0].x, 25.5f);
+    EXPECT_EQ(lawn.obstacles[1].points[0].y, 4.25f);
+    EXPECT_EQ(lawn.obstacles[1].points[4].y, 7.0f);
+
+    ASSERT_TRUE(reader.hasDockingPoint());
+    geometry_msgs::Pose docking_point = reader.dockingPoint();
+    EXPECT_EQ(docking_point.position.x, 1.5);
+    EXPECT_EQ(docking_point.position.y, -2.25);
+    EXPECT_EQ(docking_point.orientation.z, 0.5);
+    EXPECT_EQ(docking_point.orientation.w, 0.75);
+}
+
+TEST_F(MapFileTest, EmptyMap) {
+    std::string error;
+    ASSERT_TRUE(map_file::write(filename, {}, {}, nullptr, error)) << error;
+    map_file::Reader reader;
+    ASSERT_TRUE(reader.open(filename, error)) << error;
+    EXPECT_EQ(reader.areaCount(), 0u);
+    EXPECT_FALSE(reader.hasDockingPoint());
+}
+
+TEST_F(MapFileTest, RejectsFlippedByte) {
+    writeTestMap();
+    std::vector<uint8_t> data = readFile();
+    data[data.size() - 3] ^= 0x20;
+    writeFile(data);
+
+    map_file::Reader reader;
+    std::string error;
+    EXPECT_FALSE(reader.open(filename, error));
+    EXPECT_NE(error.find("checksum"), std::string::npos) << error;
+}
+
+TEST_F(MapFileTest, RejectsTruncatedFile) {
+    writeTestMap();
+    std::vector<uint8_t> data = readFile();
+    std::string error;
+
+    data.pop_back();
+    writeFile(data);
+    map_file::Reader reader;
+    EXPECT_FALSE(reader.open(filename, error));
+    EXPECT_NE(error.find("expected"), std::string::npos) << error;
+
+    // Cut inside the header, the magic is still there
+    data.resize(sizeof(map_file::FileHeader) / 2);
+    writeFile(data);
+    EXPECT_TRUE(map_file::isMapFile(filename));
+    map_file::Reader short_reader;
+    EXPECT_FALSE(short_reader.open(filename, error));
+    EXPECT_NE(error.find("too short"), std::string::npos) << error;
+}
+
+TEST_F(MapFileTest, RejectsOtherFiles) {
+    writeFile({'#', 'R', 'O', 'S', 'B', 'A', 'G', ' ', 'V', '2', '.', '0', '\n'});
+    EXPECT_FALSE(map_file::isMapFile(filename));
+    EXPECT_FALSE(map_file::isMapFile(directory + "/missing.bin"));
+
+    map_file::Reader reader;
+    std::string error;
+    EXPECT_FALSE(reader.open(directory + "/missing.bin", error));
+    EXPECT_FALSE(error.empty());
+}
+
+TEST_F(MapFileTest, RejectsNewerVersion) {
+    writeTestMap();
+    std::vector<uint8_t> data = readFile();
+    map_file::FileHeader header;
+    memcpy(&header, data.data(), sizeof(header));
+    header.version = map_file::VERSION + 1;
+    memcpy(data.data(), &header, sizeof(header));
+    writeFile(data);
+
+    map_file::Reader reader;
+    std::string error;
+    EXPECT_FALSE(reader.open(filename, error));
+    EXPECT_NE(error.find("version"), std::string::npos) << error;
+}
+
+TEST_F(MapFileTest, RejectsInvalidAreaRange) {
+    writeTestMap();
+    const std::vector<uint8_t> original = readFile();
+    const size_t area_offset = sizeof(map_file::FileHeader) + sizeof(map_file::AreaRecord);
+
+    // Each change gets a valid checksum, so only the range checks can catch it
+    auto expectInvalid = [&](void (*change)(map_file::AreaRecord &)) {
+        std::vector<uint8_t> data = original;
+        map_file::AreaRecord area;
+        memcpy(&area, data.data() + area_offset, sizeof(area));
+        change(area);
+        memcpy(data.data() + area_offset, &area, sizeof(area));
+        writeFileWithChecksum(data);
+
+        map_file::Reader reader;
+        std::string error;
+        EXPECT_FALSE(reader.open(filename, error));
+        EXPECT_NE(error.find("invalid area 1"), std::string::npos) << error;
+    };
+    expectInvalid([](map_file::AreaRecord &area) { area.polygon_count++; });
+    expectInvalid([](map_file::AreaRecord &area) { area.polygon_count = 0; });
+    expectInvalid([](map_file::AreaRecord &area) { area.first_polygon = 0xFFFFFFFF; });
+    expectInvalid([](map_file::AreaRecord &area) { area.name_size++; });
+    expectInvalid([](map_file::AreaRecord &area) { area.name_offset = 0xFFFFFFFF; });
+}
+
+TEST_F(MapFileTest, RejectsInvalidPolygonRange) {
+    writeTestMap();
+    const std::vector<uint8_t> original = readFile();
+    map_file::FileHeader header;
+    memcpy(&header, original.data(), sizeof(header));
+    // The last polygon ends exactly at the last vertex
+    const size_t polygon_offset = sizeof(map_file::FileHeader) + header.area_count * sizeof(map_file::AreaRecord) +
+                                  (header.polygon_count - 1) * sizeof(map_file::PolygonRecord);
+
+    auto expectInvalid = [&](void (*change)(map_file::PolygonRecord &)) {
+        std::vector<uint8_t> data = original;
+        map_file::PolygonRecord polygon;
+        memcpy(&polygon, data.data() + polygon_offset, sizeof(polygon));
+        change(polygon);
+        memcpy(data.data() + polygon_offset, &polygon, sizeof(polygon));
+        writeFileWithChecksum(data);
+
+        map_file::Reader reader;
+        std::string error;
+        EXPECT_FALSE(reader.open(filename, error));
+        EXPECT_NE(error.find("invalid polygon"), std::string::npos) << error;
+    };
+    expectInvalid([](map_file::PolygonRecord &polygon) { polygon.vertex_count++; });
+    expectInvalid([](map_file::PolygonRecord &polygon) { polygon.first_vertex++; });
+    expectInvalid([](map_file::PolygonRecord &polygon) { polygon.first_vertex = 0xFFFFFFFF; });
+}
+
+TEST_F(MapFileTest, FailedWriteKeepsOldFile) {
+    writeTestMap();
+    const std::vector<uint8_t> original = readFile();
+
+    // The temporary file can't be created where a directory is in the way
+    ASSERT_EQ(mkdir((filename + ".tmp").c_str(), 0755), 0);
+    std::string error;
+    EXPECT_FALSE(map_file::write(filename, {}, {}, nullptr, error));
+    EXPECT_FALSE(error.empty());
+    rmdir((filename + ".tmp").c_str());
+    EXPECT_EQ(readFile(), original);
+
+    error.clear();
+    EXPECT_FALSE(map_file::write(directory + "/missing/map.bin", {}, {}, nullptr, error));
+    EXPECT_FALSE(error.empty());
+}
+
+int main(int argc, char **argv) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,418 @@
+// Copyright (c) 2022 Clemens Elflein. All rights reserved.
+//
+// This work is licensed under a Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//
+// Feel free to use the design in your private/educational projects, but don't try to sell the design or products based on it without getting my consent first.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//
+
+
+#include <cmath>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "../src/MapIndex.h"
+
+
+namespace {
+    geometry_msgs::Point32 point(double x, double y) {
+        geometry_msgs::Point32 p;
+        p.x = static_cast<float>(x);
+        p.y = static_cast<float>(y);
+        return p;
+    }
+
+    /// Same test as grid_map::Polygon::isInside().
+    bool isInside(const geometry_msgs::Polygon &polygon, const Eigen::Vector2d &p) {
+        const auto &v = polygon.points;
+        int crossings = 0;
+        for (size_t i = 0, j = v.size() - 1; i < v.size(); j = i++) {
+            if (((v[i].y > p.y()) != (v[j].y > p.y())) &&
+                (p.x() < (v[j].x - v[i].x) * (p.y() - v[i].y) / (v[j].y - v[i].y) + v[i].x)) {
+                crossings++;
+            }
+        }
+        return crossings % 2 == 1;
+    }
+
+    bool isInside(const mower_map::MapArea &area, const Eigen::Vector2d &p) {
+        if (!isInside(area.area, p)) {
+            return false;
+        }
+        for (const auto &obstacle: area.obstacles) {
+            if (isInside(obstacle, p)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /// Calls f(a, b) for every edge of the polygon, like AreaIndex stores them.
+    template<typename F>
+    void forEachEdge(const geometry_msgs::Polygon &polygon, F f) {
+        const auto &v = polygon.points;
+        for (size_t i = 0, j = v.size() - 1; i < v.size(); j = i++) {
+            f(Eigen::Vector2d(v[j].x, v[j].y), Eigen::Vector2d(v[i].x, v[i].y));
+        }
+    }
+
+    const geometry_msgs::Polygon &polygonOf(const mower_map::MapArea &area, int32_t obstacle_index) {
+        return obstacle_index < 0 ? area.area : area.obstacles.at(obstacle_index);
+    }
+
+    /// The map kept as plain lists and searched by looking at every edge, like the services did before MapIndex.
+    struct BruteForceMap {
+        std::vector<mower_map::MapArea> areas[2];
+
+        int32_t containingArea(MapFeature::AreaType type, const Eigen::Vector2d &p) const {
+            for (size_t i = 0; i < areas[type].size(); i++) {
+                if (isInside(areas[type][i], p)) {
+                    return static_cast<int32_t>(i);
+                }
+            }
+            return -1;
+        }
+
+        double nearestDistance(const Eigen::Vector2d &p) const {
+            double best = std::numeric_limits<double>::infinity();
+            forEachPolygon([&](const geometry_msgs::Polygon &polygon) {
+                forEachEdge(polygon, [&](const Eigen::Vector2d &a, const Eigen::Vector2d &b) {
+                    best = std::min(best, (AreaIndex::closestPoint(a, b, p) - p).norm());
+                });
+            });
+            return best;
+        }
+
+        double firstIntersection(const Eigen::Vector2d &start, const Eigen::Vector2d &end) const {
+            double best = std::numeric_limits<double>::infinity();
+            forEachPolygon([&](const geometry_msgs::Polygon &polygon) {
+                forEachEdge(polygon, [&](const Eigen::Vector2d &a, const Eigen::Vector2d &b) {
+                    double t;
+                    if (AreaIndex::intersectSegments(start, end, a, b, t)) {
+                        best = std::min(best, t);
+                    }
+                });
+            });
+            return best;
+        }
+
+        const mower_map::MapArea &area(const MapFeature &feature) const {
+            return areas[feature.type].at(feature.area_index);
+        }
+
+        template<typename F>
+        void forEachPolygon(F f) const {
+            for (const auto &list: areas) {
+                for (const auto &area: list) {
+                    f(area.area);
+                    for (const auto &obstacle: area.obstacles) {
+                        f(obstacle);
+                    }
+                }
+            }
+        }
+    };
+
+    class AreaGenerator {
+    public:
+        /// \param grid Put every vertex on whole meters, so there are many collinear edges and queries.
+        AreaGenerator(unsigned seed, bool grid) : rng_(seed), grid_(grid) {
+        }
+
+        double uniform(double min, double max) {
+            return std::uniform_real_distribution<double>(min, max)(rng_);
+        }
+
+        int uniformInt(int min, int max) {
+            return std::uniform_int_distribution<int>(min, max)(rng_);
+        }
+
+        Eigen::Vector2d queryPoint() {
+            Eigen::Vector2d p(uniform(-80.0, 80.0), uniform(-80.0, 80.0));
+            return grid_ ? Eigen::Vector2d(p.array().round().matrix()) : p;
+        }
+
+        /// Star shaped polygon around a center. On the grid, some polygons are degenerate: empty, a single point,
+        /// two points or all points on one line.
+        geometry_msgs::Polygon polygon(double cx, double cy, double radius, int vertex_count) {
+            geometry_msgs::Polygon polygon;
+            if (grid_) {
+                cx = std::round(cx);
+                cy = std::round(cy);
+                switch (uniformInt(0, 9)) {
+                    case 0:
+                        return polygon;
+                    case 1:
+                        polygon.points.push_back(point(cx, cy));
+                        return polygon;
+                    case 2:
+                        polygon.points = {point(cx, cy), point(cx + std::round(radius), cy)};
+                        return polygon;
+                    case 3:
+                        for (int i = 0; i < 4; i++) {
+                            polygon.points.push_back(point(cx + i, cy + i));
+                        }
+                        return polygon;
+                    default:
+                        break;
+                }
+            }
+            for (int i = 0; i < vertex_count; i++) {
+                double angle = 2.0 * M_PI * i / vertex_count;
+                double r = radius * uniform(0.5, 1.0);
+                double x = cx + r * std::cos(angle);
+                double y = cy + r * std::sin(angle);
+                if (grid_) {
+                    x = std::round(x);
+                    y = std::round(y);
+                }
+                polygon.points.push_back(point(x, y));
+            }
+            // A repeated vertex gives a zero length edge
+            if (!polygon.points.empty() && uniformInt(0, 4) == 0) {
+                polygon.points.push_back(polygon.points.back());
+            }
+            return polygon;
+        }
+
+        mower_map::MapArea area() {
+            mower_map::MapArea area;
+            double cx = uniform(-50.0, 50.0), cy = uniform(-50.0, 50.0), r = uniform(5.0, 20.0);
+            area.area = polygon(cx, cy, r, uniformInt(3, 24));
+            for (int i = uniformInt(0, 3); i > 0; i--) {
+                area.obstacles.push_back(polygon(cx + uniform(-r / 3, r / 3), cy + uniform(-r / 3, r / 3),
+                                                 uniform(1.0, 3.0), uniformInt(3, 8)));
+            }
+            return area;
+        }
+
+    private:
+        std::mt19937 rng_;
+        bool grid_;
+    };
+
+    void expectSameAnswers(const MapIndex &index, const BruteForceMap &brute_force, AreaGenerator &generator,
+                           int queries) {
+        for (int k = 0; k < queries; k++) {
+            const Eigen::Vector2d p = generator.queryPoint();
+            const Eigen::Vector2d q = generator.uniformInt(0, 9) == 0 ? p : generator.queryPoint();
+
+            // Off the grid, so the point is never exactly on an edge
+            const Eigen::Vector2d inside_query = p + Eigen::Vector2d(0.37, 0.61);
+            for (auto type: {MapFeature::NAVIGATION_AREA, MapFeature::MOWING_AREA}) {
+                ASSERT_EQ(index.containingArea(type, inside_query), brute_force.containingArea(type, inside_query))
+                                            << "type " << int(type) << " at " << inside_query.transpose();
+            }
+
+            const double expected_distance = brute_force.nearestDistance(p);
+            const NearestEdge nearest = index.nearestEdge(p);
+            ASSERT_EQ(nearest.found, std::isfinite(expected_distance));
+            if (nearest.found) {
+                ASSERT_NEAR(nearest.distance, expected_distance, 1e-9) << "at " << p.transpose();
+                EXPECT_NEAR((nearest.point - p).norm(), nearest.distance, 1e-9);
+                // The reported polygon has an edge through the reported point
+                bool on_edge = false;
+                forEachEdge(polygonOf(brute_force.area(nearest.feature), nearest.feature.obstacle_index),
+                            [&](const Eigen::Vector2d &a, const Eigen::Vector2d &b) {
+                                on_edge |= (AreaIndex::closestPoint(a, b, p) - nearest.point).norm() < 1e-9;
+                            });
+                EXPECT_TRUE(on_edge);
+            } else {
+                EXPECT_TRUE(std::isinf(nearest.distance));
+            }
+
+            const double expected_t = brute_force.firstIntersection(p, q);
+            const SegmentHit hit = index.intersect(p, q);
+            ASSERT_EQ(hit.found, std::isfinite(expected_t)) << p.transpose() << " to " << q.transpose();
+            if (hit.found) {
+                ASSERT_EQ(hit.t, expected_t) << p.transpose() << " to " << q.transpose();
+                bool on_edge = false;
+                forEachEdge(polygonOf(brute_force.area(hit.feature), hit.feature.obstacle_index),
+                            [&](const Eigen::Vector2d &a, const Eigen::Vector2d &b) {
+                                double t;
+                                on_edge |= AreaIndex::intersectSegments(p, q, a, b, t) && t == hit.t;
+                            });
+                EXPECT_TRUE(on_edge);
+            }
+        }
+    }
+
+    /// Random edits like the services of mower_map_service make, each followed by queries.
+    void runEdits(AreaGenerator &generator) {
+        BruteForceMap brute_force;
+        auto &navigation_areas = brute_force.areas[MapFeature::NAVIGATION_AREA];
+        auto &mowing_areas = brute_force.areas[MapFeature::MOWING_AREA];
+        for (int i = 0; i < 4; i++) {
+            navigation_areas.push_back(generator.area());
+        }
+        for (int i = 0; i < 12; i++) {
+            mowing_areas.push_back(generator.area());
+        }
+        MapIndex index;
+        index.rebuild(navigation_areas, mowing_areas);
+        ASSERT_NO_FATAL_FAILURE(expectSameAnswers(index, brute_force, generator, 1000));
+
+        for (int edit = 0; edit < 40; edit++) {
+            SCOPED_TRACE("edit " + std::to_string(edit));
+            switch (generator.uniformInt(0, 3)) {
+                case 0: {
+                    auto type = generator.uniformInt(0, 2) == 0 ? MapFeature::NAVIGATION_AREA
+                                                                : MapFeature::MOWING_AREA;
+                    brute_force.areas[type].push_back(generator.area());
+                    index.add(type, brute_force.areas[type].back());
+                    break;
+                }
+                case 1:
+                    if (!mowing_areas.empty()) {
+                        size_t i = generator.uniformInt(0, mowing_areas.size() - 1);
+                        mowing_areas.erase(mowing_areas.begin() + i);
+                        index.erase(MapFeature::MOWING_AREA, i);
+                    }
+                    break;
+                case 2:
+                    if (!mowing_areas.empty()) {
+                        size_t i = generator.uniformInt(0, mowing_areas.size() - 1);
+                        navigation_areas.push_back(mowing_areas[i]);
+                        mowing_areas.erase(mowing_areas.begin() + i);
+                        index.convertToNavigationArea(i);
+                    }
+                    break;
+                default:
+                    if (generator.uniformInt(0, 9) == 0) {
+                        navigation_areas.clear();
+                        mowing_areas.clear();
+                        index.clear();
+                    }
+                    break;
+            }
+            ASSERT_NO_FATAL_FAILURE(expectSameAnswers(index, brute_force, generator, 100));
+        }
+    }
+}
+
+TEST(AreaIndex, IntersectSegments) {
+    typedef Eigen::Vector2d V;
+    double t = -1.0;
+
+    // Crossing, touching at an end point, missing
+    EXPECT_TRUE(AreaIndex::intersectSegments(V(0, 0), V(4, 0), V(1, -1), V(1, 1), t));
+    EXPECT_EQ(t, 0.25);
+    EXPECT_TRUE(AreaIndex::intersectSegments(V(0, 0), V(4, 0), V(4, 0), V(4, 3), t));
+    EXPECT_EQ(t, 1.0);
+    EXPECT_FALSE(AreaIndex::intersectSegments(V(0, 0), V(4, 0), V(5, -1), V(5, 1), t));
+
+    // Parallel
+    EXPECT_FALSE(AreaIndex::intersectSegments(V(0, 0), V(4, 0), V(0, 1), V(4, 1), t));
+
+    // Collinear: overlapping in either direction, containing, touching, disjoint
+    EXPECT_TRUE(AreaIndex::intersectSegments(V(0, 0), V(4, 0), V(2, 0), V(6, 0), t));
+    EXPECT_EQ(t, 0.5);
+    EXPECT_TRUE(AreaIndex::intersectSegments(V(0, 0), V(4, 0), V(6, 0), V(3, 0), t));
+    EXPECT_EQ(t, 0.75);
+    EXPECT_TRUE(AreaIndex::intersectSegments(V(0, 0), V(4, 0), V(-1, 0), V(5, 0), t));
+    EXPECT_EQ(t, 0.0);
+    EXPECT_TRUE(AreaIndex::intersectSegments(V(0, 0), V(4, 0), V(-2, 0), V(0, 0), t));
+    EXPECT_EQ(t, 0.0);
+    EXPECT_FALSE(AreaIndex::intersectSegments(V(0, 0), V(4, 0), V(5, 0), V(7, 0), t));
+    EXPECT_FALSE(AreaIndex::intersectSegments(V(0, 0), V(4, 0), V(-3, 0), V(-1, 0), t));
+
+    // Zero length edge on, off and beside the segment
+    EXPECT_TRUE(AreaIndex::intersectSegments(V(0, 0), V(4, 0), V(3, 0), V(3, 0), t));
+    EXPECT_EQ(t, 0.75);
+    EXPECT_FALSE(AreaIndex::intersectSegments(V(0, 0), V(4, 0), V(3, 1), V(3, 1), t));
+    EXPECT_FALSE(AreaIndex::intersectSegments(V(0, 0), V(4, 0), V(6, 0), V(6, 0), t));
+
+    // Zero length segment on, off and on the line of the edge
+    EXPECT_TRUE(AreaIndex::intersectSegments(V(2, 0), V(2, 0), V(0, 0), V(4, 0), t));
+    EXPECT_EQ(t, 0.0);
+    EXPECT_FALSE(AreaIndex::intersectSegments(V(2, 1), V(2, 1), V(0, 0), V(4, 0), t));
+    EXPECT_FALSE(AreaIndex::intersectSegments(V(6, 0), V(6, 0), V(0, 0), V(4, 0), t));
+
+    // Both zero length
+    EXPECT_TRUE(AreaIndex::intersectSegments(V(1, 1), V(1, 1), V(1, 1), V(1, 1), t));
+    EXPECT_FALSE(AreaIndex::intersectSegments(V(1, 1), V(1, 1), V(1, 2), V(1, 2), t));
+}
+
+TEST(AreaIndex, ClosestPoint) {
+    typedef Eigen::Vector2d V;
+    EXPECT_EQ(AreaIndex::closestPoint(V(0, 0), V(4, 0), V(1, 3)), V(1, 0));
+    EXPECT_EQ(AreaIndex::closestPoint(V(0, 0), V(4, 0), V(-2, 1)), V(0, 0));
+    EXPECT_EQ(AreaIndex::closestPoint(V(0, 0), V(4, 0), V(7, -1)), V(4, 0));
+    EXPECT_EQ(AreaIndex::closestPoint(V(2, 2), V(2, 2), V(5, 6)), V(2, 2));
+}
+
+TEST(MapIndex, Empty) {
+    MapIndex index;
+    index.rebuild({}, {});
+    EXPECT_EQ(index.containingArea(MapFeature::MOWING_AREA, Eigen::Vector2d(0, 0)), -1);
+    NearestEdge nearest = index.nearestEdge(Eigen::Vector2d(0, 0));
+    EXPECT_FALSE(nearest.found);
+    EXPECT_TRUE(std::isinf(nearest.distance));
+    EXPECT_FALSE(index.intersect(Eigen::Vector2d(-1, 0), Eigen::Vector2d(1, 0)).found);
+}
+
+TEST(MapIndex, DegenerateAreas) {
+    mower_map::MapArea empty;
+    mower_map::MapArea single_point;
+    single_point.area.points = {point(10, 10)};
+    mower_map::MapArea collinear;
+    collinear.area.points = {point(0, 0), point(2, 0), point(4, 0)};
+    // Obstacle without vertices inside a normal square
+    mower_map::MapArea square;
+    square.area.points = {point(20, 0), point(24, 0), point(24, 4), point(20, 4)};
+    square.obstacles.emplace_back();
+
+    MapIndex index;
+    index.rebuild({empty, single_point}, {collinear, square});
+
+    EXPECT_EQ(index.containingArea(MapFeature::NAVIGATION_AREA, Eigen::Vector2d(10, 10)), -1);
+    EXPECT_EQ(index.containingArea(MapFeature::MOWING_AREA, Eigen::Vector2d(1, 0)), -1);
+    EXPECT_EQ(index.containingArea(MapFeature::MOWING_AREA, Eigen::Vector2d(22, 2)), 1);
+
+    NearestEdge nearest = index.nearestEdge(Eigen::Vector2d(10, 13));
+    ASSERT_TRUE(nearest.found);
+    EXPECT_EQ(nearest.distance, 3.0);
+    EXPECT_EQ(nearest.feature.type, MapFeature::NAVIGATION_AREA);
+    EXPECT_EQ(nearest.feature.area_index, 1);
+
+    // Along the collinear polygon, it starts on an edge
+    SegmentHit hit = index.intersect(Eigen::Vector2d(-1, 0), Eigen::Vector2d(3, 0));
+    ASSERT_TRUE(hit.found);
+    EXPECT_EQ(hit.t, 0.25);
+    EXPECT_EQ(hit.point, Eigen::Vector2d(0, 0));
+    EXPECT_EQ(hit.feature.type, MapFeature::MOWING_AREA);
+    EXPECT_EQ(hit.feature.area_index, 0);
+
+    // Through the single point
+    hit = index.intersect(Eigen::Vector2d(8, 8), Eigen::Vector2d(12, 12));
+    ASSERT_TRUE(hit.found);
+    EXPECT_EQ(hit.t, 0.5);
+    EXPECT_EQ(hit.feature.type, MapFeature::NAVIGATION_AREA);
+    EXPECT_EQ(hit.feature.area_index, 1);
+}
+
+TEST(MapIndex, MatchesBruteForce) {
+    AreaGenerator generator(1, false);
+    runEdits(generator);
+}
+
+TEST(MapIndex, MatchesBruteForceOnGrid) {
+    AreaGenerator generator(2, true);
+    runEdits(generator);
+}
+
+int main(int argc, char **argv) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,321 @@
+// Copyright (c) 2022 Clemens Elflein. All rights reserved.
+//
+// This work is licensed under a Creative Commons Attribution-NonCommercial-ShareAlike 4.0 International License.
+//
+// Feel free to use the design in your private/educational projects, but don't try to sell the design or products based on it without getting my consent first.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+//
+//
+
+
+#include <random>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <grid_map_core/grid_map_core.hpp>
+#include <gtest/gtest.h>
+
+#include "../src/MapRaster.h"
+
+
+namespace {
+    constexpr int KERNEL_SIZE = 5;
+
+    struct TestArea {
+        grid_map::Polygon outline;
+        std::vector<grid_map::Polygon> obstacles;
+    };
+
+    /// The polygons of the map, kept like the globals of mower_map_service.
+    struct TestMap {
+        std::vector<TestArea> navigation_areas;
+        std::vector<TestArea> mowing_areas;
+        bool show_fake_obstacle = false;
+        grid_map::Polygon fake_obstacle;
+
+        /// Same order as paintOps() in mower_map_service.
+        std::vector<PaintOp> paintOps() const {
+            std::vector<PaintOp> ops;
+            for (const auto *areas: {&navigation_areas, &mowing_areas}) {
+                for (const auto &area: *areas) {
+                    ops.emplace_back(area.outline, 0);
+                    for (const auto &obstacle: area.obstacles) {
+                        ops.emplace_back(obstacle, 1);
+                    }
+                }
+            }
+            if (show_fake_obstacle) {
+                ops.emplace_back(fake_obstacle, 1);
+            }
+            return ops;
+        }
+    };
+
+    void invalidate(const grid_map::Polygon &polygon, Bounds &dirty) {
+        for (const auto &vertex: polygon.getVertices()) {
+            dirty.add(vertex.x(), vertex.y());
+        }
+    }
+
+    void invalidate(const TestArea &area, Bounds &dirty) {
+        invalidate(area.outline, dirty);
+        for (const auto &obstacle: area.obstacles) {
+            invalidate(obstacle, dirty);
+        }
+    }
+
+    /// The map mower_map_service would build for areas inside x [-2.7, 5.3], y [-3.7, 2.3].
+    grid_map::GridMap makeMap() {
+        grid_map::GridMap map({"navigation_area"});
+        map.setGeometry(grid_map::Length(10.0, 8.0), 0.05, grid_map::Position(1.3, -0.7));
+        map.clearAll();
+        return map;
+    }
+
+    /// Painted with grid_map::PolygonIterator, like buildMap() did before the scanline fill.
+    OccupancyMatrix referenceCells(const grid_map::GridMap &map, const std::vector<PaintOp> &ops) {
+        OccupancyMatrix cells = OccupancyMatrix::Ones(map.getSize()(0), map.getSize()(1));
+        for (const auto &op: ops) {
+            for (grid_map::PolygonIterator iterator(map, op.polygon); !iterator.isPastEnd(); ++iterator) {
+                const grid_map::Index index(*iterator);
+                cells(index(0), index(1)) = op.value;
+            }
+        }
+        return cells;
+    }
+
+    /// Mean of the kernel around every cell, summed cell by cell and mirrored at the border like cv::blur.
+    grid_map::Matrix referenceBlur(const OccupancyMatrix &cells) {
+        const int radius = KERNEL_SIZE / 2;
+        const int rows = cells.rows();
+        const int cols = cells.cols();
+        auto reflect = [](int index, int size) {
+            return index < 0 ? -index : (index >= size ? 2 * size - 2 - index : index);
+        };
+        grid_map::Matrix layer(rows, cols);
+        for (int j = 0; j < cols; j++) {
+            for (int i = 0; i < rows; i++) {
+                int sum = 0;
+                for (int dj = -radius; dj <= radius; dj++) {
+                    for (int di = -radius; di <= radius; di++) {
+                        sum += cells(reflect(i + di, rows), reflect(j + dj, cols));
+                    }
+                }
+                layer(i, j) = static_cast<float>(sum) / static_cast<float>(KERNEL_SIZE * KERNEL_SIZE);
+            }
+        }
+        return layer;
+    }
+
+    void buildFromScratch(const grid_map::GridMap &map, const std::vector<PaintOp> &ops, OccupancyMatrix &cells,
+                          grid_map::Matrix &layer, WorkStealingPool &pool, int tile_size) {
+        const CellRect all = CellRect::all(map.getSize());
+        cells.resize(map.getSize()(0), map.getSize()(1));
+        layer.setConstant(NAN);
+        paintCellsParallel(map, ops, all, cells, pool, tile_size);
+        blurCells(cells, all, KERNEL_SIZE, layer, pool, tile_size);
+    }
+
+    class PolygonGenerator {
+    public:
+        explicit PolygonGenerator(unsigned seed) : rng_(seed) {
+        }
+
+        /// Random vertices around a random center, so some polygons intersect themselves. Half of the polygons
+        /// have their vertices on multiples of 2.5cm, i.e. exactly on cell borders and centers.
+        grid_map::Polygon polygon(double max_size) {
+            std::uniform_real_distribution<double> center_x(-1.5, 4.0);
+            std::uniform_real_distribution<double> center_y(-2.5, 1.0);
+            std::uniform_real_distribution<double> offset(-max_size / 2.0, max_size / 2.0);
+            std::uniform_int_distribution<int> vertex_count(3, 9);
+            const bool snap = std::bernoulli_distribution(0.5)(rng_);
+            const grid_map::Position center(center_x(rng_), center_y(rng_));
+            grid_map::Polygon polygon;
+            for (int i = vertex_count(rng_); i > 0; i--) {
+                grid_map::Position vertex = center + grid_map::Position(offset(rng_), offset(rng_));
+                if (snap) {
+                    vertex = (vertex / 0.025).array().round().matrix() * 0.025;
+                }
+                polygon.addVertex(vertex);
+            }
+            return polygon;
+        }
+
+        TestArea area() {
+            TestArea area;
+            area.outline = polygon(2.0);
+            for (int i = std::uniform_int_distribution<int>(0, 2)(rng_); i > 0; i--) {
+                area.obstacles.push_back(polygon(0.8));
+            }
+            return area;
+        }
+
+        int uniform(int min, int max) {
+            return std::uniform_int_distribution<int>(min, max)(rng_);
+        }
+
+    private:
+        std::mt19937 rng_;
+    };
+}
+
+/// Parameters: number of threads, tile size in cells
+class MapRasterTest : public ::testing::TestWithParam<std::tuple<int, int>> {
+protected:
+    MapRasterTest() : pool(std::get<0>(GetParam())), tile_size(std::get<1>(GetParam())) {
+    }
+
+    void buildFromScratch(const grid_map::GridMap &map, const std::vector<PaintOp> &ops, OccupancyMatrix &cells,
+                          grid_map::Matrix &layer) {
+        ::buildFromScratch(map, ops, cells, layer, pool, tile_size);
+    }
+
+    WorkStealingPool pool;
+    const int tile_size;
+};
+
+TEST(MapRaster, FullBuildMatchesPolygonIterator) {
+    PolygonGenerator generator(1);
+    TestMap test_map;
+    for (int i = 0; i < 6; i++) {
+        test_map.navigation_areas.push_back(generator.area());
+        test_map.mowing_areas.push_back(generator.area());
+    }
+    test_map.show_fake_obstacle = true;
+    test_map.fake_obstacle = generator.polygon(0.8);
+
+    grid_map::GridMap map = makeMap();
+    const std::vector<PaintOp> ops = test_map.paintOps();
+    OccupancyMatrix cells;
+    WorkStealingPool pool(4);
+    buildFromScratch(map, ops, cells, map["navigation_area"], pool, 21);
+
+    const OccupancyMatrix expected_cells = referenceCells(map, ops);
+    EXPECT_TRUE(cells == expected_cells) << (cells.cast<int>() - expected_cells.cast<int>()).cwiseAbs().sum()
+                                         << " cells differ";
+    EXPECT_TRUE(map["navigation_area"] == referenceBlur(expected_cells));
+}
+
+TEST_P(MapRasterTest, BlurMatchesReference) {
+    // Random cells, so the mirroring at the map border matters as well
+    std::mt19937 rng(3);
+    std::bernoulli_distribution occupied(0.5);
+    OccupancyMatrix cells(45, 38);
+    for (int j = 0; j < cells.cols(); j++) {
+        for (int i = 0; i < cells.rows(); i++) {
+            cells(i, j) = occupied(rng);
+        }
+    }
+    const grid_map::Matrix expected = referenceBlur(cells);
+
+    grid_map::Matrix layer = grid_map::Matrix::Constant(cells.rows(), cells.cols(), NAN);
+    blurCells(cells, CellRect::all(grid_map::Size(cells.rows(), cells.cols())), KERNEL_SIZE, layer, pool, tile_size);
+    EXPECT_TRUE(layer == expected);
+
+    // Blurring only a part gives the same cells there and leaves the rest alone
+    CellRect part;
+    part.start = grid_map::Index(3, 17);
+    part.end = grid_map::Index(44, 38);
+    layer.setConstant(NAN);
+    blurCells(cells, part, KERNEL_SIZE, layer, pool, tile_size);
+    const grid_map::Size size = part.size();
+    EXPECT_TRUE(layer.block(3, 17, size(0), size(1)) == expected.block(3, 17, size(0), size(1)));
+    EXPECT_EQ(layer.array().isNaN().count(), cells.size() - size.prod());
+}
+
+TEST_P(MapRasterTest, IncrementalUpdateMatchesFullBuild) {
+    PolygonGenerator generator(2);
+    TestMap test_map;
+    for (int i = 0; i < 3; i++) {
+        test_map.navigation_areas.push_back(generator.area());
+        test_map.mowing_areas.push_back(generator.area());
+    }
+
+    grid_map::GridMap map = makeMap();
+    OccupancyMatrix cells;
+    buildFromScratch(map, test_map.paintOps(), cells, map["navigation_area"]);
+
+    grid_map::GridMap expected_map = makeMap();
+    OccupancyMatrix expected_cells;
+    for (int edit = 0; edit < 50; edit++) {
+        // Invalidate like the services of mower_map_service do
+        Bounds dirty;
+        std::string name;
+        switch (generator.uniform(0, 5)) {
+            case 0:
+                name = "add navigation area";
+                test_map.navigation_areas.push_back(generator.area());
+                invalidate(test_map.navigation_areas.back(), dirty);
+                break;
+            case 1:
+                name = "add mowing area";
+                test_map.mowing_areas.push_back(generator.area());
+                invalidate(test_map.mowing_areas.back(), dirty);
+                break;
+            case 2: {
+                name = "delete mowing area";
+                if (test_map.mowing_areas.empty()) {
+                    break;
+                }
+                size_t index = generator.uniform(0, test_map.mowing_areas.size() - 1);
+                invalidate(test_map.mowing_areas[index], dirty);
+                test_map.mowing_areas.erase(test_map.mowing_areas.begin() + index);
+                break;
+            }
+            case 3: {
+                name = "convert to navigation area";
+                if (test_map.mowing_areas.empty()) {
+                    break;
+                }
+                size_t index = generator.uniform(0, test_map.mowing_areas.size() - 1);
+                test_map.navigation_areas.push_back(test_map.mowing_areas[index]);
+                test_map.mowing_areas.erase(test_map.mowing_areas.begin() + index);
+                invalidate(test_map.navigation_areas.back(), dirty);
+                break;
+            }
+            case 4:
+                name = "set nav point";
+                if (test_map.show_fake_obstacle) {
+                    invalidate(test_map.fake_obstacle, dirty);
+                }
+                test_map.fake_obstacle = generator.polygon(0.8);
+                test_map.show_fake_obstacle = true;
+                invalidate(test_map.fake_obstacle, dirty);
+                break;
+            default:
+                name = "clear nav point";
+                if (test_map.show_fake_obstacle) {
+                    invalidate(test_map.fake_obstacle, dirty);
+                }
+                test_map.show_fake_obstacle = false;
+                break;
+        }
+
+        const std::vector<PaintOp> ops = test_map.paintOps();
+        if (!dirty.empty()) {
+            updateCells(map, ops, dirty, KERNEL_SIZE, cells, map["navigation_area"], pool, tile_size);
+        }
+        buildFromScratch(expected_map, ops, expected_cells, expected_map["navigation_area"]);
+        ASSERT_TRUE(cells == expected_cells) << "cells differ after edit " << edit << " (" << name << ")";
+        ASSERT_TRUE(map["navigation_area"] == expected_map["navigation_area"])
+                                    << "layer differs after edit " << edit << " (" << name << ")";
+    }
+    EXPECT_TRUE(cells == referenceCells(map, test_map.paintOps()));
+}
+
+INSTANTIATE_TEST_CASE_P(ThreadsAndTiles, MapRasterTest,
+                        ::testing::Values(std::make_tuple(1, 256), std::make_tuple(1, 16),
+                                          std::make_tuple(4, 16), std::make_tuple(4, 21)));
+
+int main(int argc, char **argv) {
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}